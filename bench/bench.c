@@ -0,0 +1,399 @@
+/**
+ * @file bench.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Headless load generator and latency benchmark for both chat servers
+ */
+
+/* UChat Bench
+Registers M simulated clients at a running server, sends chat messages at a fixed
+rate round robin from all clients and measures the fan-out latency of every copy.
+Usage: ./bench.bin (-t udp|unix|abstract) (-c Clients) (-r Messages per second) (-d Seconds)
+	(-B Binary protocol) (-C Accept coalesced frames) (-f csv|json) (-n No csv header)
+*/
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "chat_proto.h"
+#include "chat_client.h"
+
+#define SERVER_PORT 8421
+#define SERVER_IP "127.0.0.1"
+#define SERVER_SOCKET_FILE_PATH "/tmp/uchat_ser"
+#define CLIENT_SOCKET_FILE_BASEPATH "/tmp/uchat_cli"
+#define MARKER "BENCH" /* starts every measured message */
+#define RCVBUF_BYTES (4 * 1024 * 1024)
+#define REGISTER_TIMEOUT_MS 2000
+#define DRAIN_MS 1000 /* time to wait for late copies after the last send */
+#define EPOLL_BATCH 64
+
+struct Bench {
+	bool unix_transport;
+	bool abstract; /* unix sockets named in the abstract namespace instead of socket files */
+	bool binary;
+	bool coalesce; /* binary clients read several frames per datagram */
+	int n_clients;
+	long rate;
+	double duration;
+	struct ChatClient *clients; /* one connection per simulated client, receive buffers included */
+	int epfd;
+	bool *registered;
+	unsigned long sent;
+	unsigned long delivered;
+	unsigned long foreign; /* copies of messages which were not sent by this run */
+	uint32_t *latency_us;
+	size_t n_latency, cap_latency;
+};
+
+/**
+ * @brief Monotonic time in nanoseconds
+ * @param void
+ * @return time
+ */
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Socket file of a simulated unix client
+ * @param client number
+ * @param output buffer
+ * @param buffer size
+ * @return void
+ */
+void client_path(int i, char *path, size_t len) {
+	snprintf(path, len, "%sbench%d", CLIENT_SOCKET_FILE_BASEPATH, i);
+}
+
+/**
+ * @brief Record the latency of one received copy
+ * @param bench
+ * @param message text or payload, not zero terminated
+ * @param length
+ * @param receive time
+ * @return void
+ */
+void bench_measure(struct Bench *b, const char *payload, size_t len, uint64_t now) {
+	/* text copies are "[name] BENCH ...", binary payloads start with the marker */
+	const char *marker = memmem(payload, len, MARKER, strlen(MARKER));
+	if (!marker) return;
+
+	unsigned long long sent_ns;
+	unsigned long run;
+	if (sscanf(marker, MARKER " %lu %llu", &run, &sent_ns) != 2 || run != (unsigned long)getpid()) {
+		b->foreign++;
+		return;
+	}
+	if (b->n_latency == b->cap_latency) {
+		b->cap_latency = b->cap_latency ? b->cap_latency * 2 : 65536;
+		b->latency_us = realloc(b->latency_us, b->cap_latency * sizeof(uint32_t));
+	}
+	b->latency_us[b->n_latency++] = (now - sent_ns) / 1000;
+	b->delivered++;
+}
+
+/**
+ * @brief Record the latency of a received binary copy or a registration
+ * @param simulated client
+ * @param frame header
+ * @param payload
+ * @return void
+ */
+void bench_frame(struct ChatClient *c, const struct ChatHeader *h, const char *payload) {
+	struct Bench *b = c->ctx;
+	if (h->type == CHAT_WELCOME) b->registered[c - b->clients] = true;
+	if (h->type == CHAT_MESSAGE) bench_measure(b, payload, h->len, now_ns());
+}
+
+/**
+ * @brief Record the latency of a received text copy or a registration
+ * @param simulated client
+ * @param zero terminated message
+ * @param message length
+ * @return void
+ */
+void bench_text(struct ChatClient *c, const char *text, size_t len) {
+	struct Bench *b = c->ctx;
+	if (strstr(text, "Successfully registered")) {
+		b->registered[c - b->clients] = true;
+		return;
+	}
+	bench_measure(b, text, len, now_ns());
+}
+
+/**
+ * @brief Socket of a simulated client failed
+ * @param simulated client
+ * @return void
+ */
+void bench_lost(struct ChatClient *c) {
+	/* its copies are counted as dropped */
+}
+
+const struct ChatClientOps bench_ops = {
+	.frame = bench_frame,
+	.text = bench_text,
+	.lost = bench_lost
+};
+
+/**
+ * @brief Receive everything which is waiting, at most until the deadline
+ * @param bench
+ * @param wait time in milliseconds
+ * @return void
+ */
+void bench_poll(struct Bench *b, int timeout_ms) {
+	struct epoll_event events[EPOLL_BATCH];
+	int n = epoll_wait(b->epfd, events, EPOLL_BATCH, timeout_ms);
+	for (int k = 0; k < n; k++) {
+		struct ChatClient *c = &b->clients[events[k].data.u32];
+		/* drain the socket, the receive buffer of the client is reused for every datagram */
+		while (chat_client_read(c) == CHAT_CLIENT_RECV_BATCH);
+	}
+}
+
+/**
+ * @brief Create the sockets of all simulated clients and register them
+ * @param bench
+ * @return 0 on success, -1 if not every client got registered
+ */
+int bench_connect(struct Bench *b) {
+	char name[CHAT_NAME_LEN + 1];
+	int rcvbuf = RCVBUF_BYTES;
+	struct sockaddr_storage server = { 0 };
+	socklen_t serverlen;
+
+	b->clients = calloc(b->n_clients, sizeof(struct ChatClient));
+	b->registered = calloc(b->n_clients, sizeof(bool));
+	b->epfd = epoll_create1(0);
+	if (b->unix_transport) {
+		struct sockaddr_un *s = (struct sockaddr_un *)&server;
+		s->sun_family = AF_LOCAL;
+		/* an abstract name is the path behind a zero byte, zero padded like the server binds it */
+		strcpy(s->sun_path + b->abstract, SERVER_SOCKET_FILE_PATH);
+		serverlen = sizeof(*s);
+	} else {
+		struct sockaddr_in *s = (struct sockaddr_in *)&server;
+		s->sin_family = AF_INET;
+		s->sin_port = htons(SERVER_PORT);
+		s->sin_addr.s_addr = inet_addr(SERVER_IP);
+		serverlen = sizeof(*s);
+	}
+
+	for (int i = 0; i < b->n_clients; i++) b->clients[i].sock = -1;
+	for (int i = 0; i < b->n_clients; i++) {
+		int sock = socket(b->unix_transport ? AF_LOCAL : AF_INET, SOCK_DGRAM, 0);
+		if (sock < 0) {
+			perror("socket");
+			return -1;
+		}
+		snprintf(name, sizeof(name), "bench%d", i);
+		struct ChatClient *c = &b->clients[i];
+		chat_client_init(c, sock, &server, serverlen, name, &bench_ops, b);
+		c->text_proto = !b->binary;
+		if (b->coalesce) c->register_flags |= CHAT_FLAG_COALESCE;
+		/* the unix server takes text messages already formatted */
+		if (b->unix_transport) snprintf(c->text_prefix, sizeof(c->text_prefix), "[%s] ", name);
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+		/* unix clients need a socket file or an abstract name, else the server cant answer */
+		if (b->unix_transport) {
+			struct sockaddr_un address = { .sun_family = AF_LOCAL };
+			client_path(i, address.sun_path + b->abstract, sizeof(address.sun_path) - b->abstract);
+			if (!b->abstract) unlink(address.sun_path);
+			if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+				perror("bind");
+				return -1;
+			}
+		}
+		struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+		epoll_ctl(b->epfd, EPOLL_CTL_ADD, sock, &ev);
+
+		if (chat_client_register(c) < 0) {
+			perror("Server not available");
+			return -1;
+		}
+		/* one client after the other, unix sockets only queue a few datagrams
+		 * and the join notices to the other clients have to be drained */
+		uint64_t deadline = now_ns() + REGISTER_TIMEOUT_MS * 1000000ull;
+		while (!b->registered[i] && now_ns() < deadline)
+			bench_poll(b, 10);
+		if (!b->registered[i]) {
+			fprintf(stderr, "Client %d was not registered, server full or not running?\n", i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Send messages at the configured rate and receive all copies
+ * @param bench
+ * @return void
+ */
+void bench_run(struct Bench *b) {
+	char payload[128];
+	uint64_t start = now_ns();
+	uint64_t end = start + (uint64_t)(b->duration * 1e9);
+	uint64_t interval = 1000000000ull / (b->rate > 0 ? b->rate : 1);
+	uint64_t next = start;
+
+	while (1) {
+		uint64_t now = now_ns();
+		if (now >= end) break;
+		/* send everything which is due, a slow loop catches up */
+		while (next <= now && next < end) {
+			int i = b->sent % b->n_clients;
+			snprintf(payload, sizeof(payload), MARKER " %lu %llu", (unsigned long)getpid(), (unsigned long long)now_ns());
+			if (chat_client_message(&b->clients[i], payload) >= 0) b->sent++;
+			next += interval;
+		}
+		uint64_t wait = next > now ? next - now : 0;
+		bench_poll(b, wait / 1000000);
+	}
+	uint64_t drain = now_ns() + DRAIN_MS * 1000000ull;
+	while (now_ns() < drain && b->delivered < b->sent * b->n_clients)
+		bench_poll(b, 10);
+}
+
+/**
+ * @brief Disconnect all simulated clients
+ * @param bench
+ * @return void
+ */
+void bench_close(struct Bench *b) {
+	char path[108];
+	for (int i = 0; i < b->n_clients; i++) {
+		if (b->clients[i].sock < 0) continue;
+		chat_client_disconnect(&b->clients[i], 0);
+		close(b->clients[i].sock);
+		if (b->unix_transport && !b->abstract) {
+			client_path(i, path, sizeof(path));
+			unlink(path);
+		}
+	}
+	close(b->epfd);
+}
+
+/**
+ * @brief Compare two latencies for qsort
+ * @param first
+ * @param second
+ * @return order
+ */
+int cmp_u32(const void *x, const void *y) {
+	uint32_t a = *(const uint32_t *)x, b = *(const uint32_t *)y;
+	return a < b ? -1 : a > b;
+}
+
+/**
+ * @brief Latency percentile in microseconds
+ * @param bench with sorted latencies
+ * @param percentile between 0 and 1
+ * @return latency
+ */
+uint32_t percentile(const struct Bench *b, double p) {
+	if (!b->n_latency) return 0;
+	size_t k = (size_t)(p * (b->n_latency - 1) + 0.5);
+	return b->latency_us[k];
+}
+
+/**
+ * @brief Print the results
+ * @param bench
+ * @param true for json, else csv
+ * @param print the csv header
+ * @return void
+ */
+void bench_report(struct Bench *b, bool json, bool header) {
+	qsort(b->latency_us, b->n_latency, sizeof(uint32_t), cmp_u32);
+	unsigned long expected = b->sent * b->n_clients;
+	unsigned long dropped = expected > b->delivered ? expected - b->delivered : 0;
+	double msgs_per_s = b->delivered / b->duration;
+	const char *transport = b->abstract ? "abstract" : b->unix_transport ? "unix" : "udp";
+	const char *protocol = b->coalesce ? "coalesced" : b->binary ? "binary" : "text";
+
+	if (json) {
+		printf("{\"transport\": \"%s\", \"protocol\": \"%s\", \"clients\": %d, \"rate\": %ld, \"duration_s\": %.1f, "
+			"\"sent\": %lu, \"expected\": %lu, \"delivered\": %lu, \"dropped\": %lu, "
+			"\"p50_us\": %u, \"p99_us\": %u, \"p999_us\": %u, \"max_us\": %u, \"server_msgs_per_s\": %.0f}\n",
+			transport, protocol, b->n_clients, b->rate, b->duration, b->sent, expected, b->delivered, dropped,
+			percentile(b, 0.5), percentile(b, 0.99), percentile(b, 0.999), percentile(b, 1.0), msgs_per_s);
+		return;
+	}
+	if (header)
+		printf("transport,protocol,clients,rate,duration_s,sent,expected,delivered,dropped,p50_us,p99_us,p999_us,max_us,server_msgs_per_s\n");
+	printf("%s,%s,%d,%ld,%.1f,%lu,%lu,%lu,%lu,%u,%u,%u,%u,%.0f\n",
+		transport, protocol, b->n_clients, b->rate, b->duration, b->sent, expected, b->delivered, dropped,
+		percentile(b, 0.5), percentile(b, 0.99), percentile(b, 0.999), percentile(b, 1.0), msgs_per_s);
+}
+
+/**
+ * @brief Main function, runs one benchmark
+ * @param number of arguments
+ * @param list of arguments
+ * @return success state
+ */
+int main(int argc, char *argv[]) {
+	struct Bench b = { .n_clients = 10, .rate = 100, .duration = 5 };
+	bool json = false, header = true;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:c:r:d:BCf:n")) != -1) {
+		switch (opt) {
+		case 't':
+			b.abstract = strcmp(optarg, "abstract") == 0;
+			b.unix_transport = b.abstract || strcmp(optarg, "unix") == 0;
+			break;
+		case 'c':
+			b.n_clients = atoi(optarg);
+			break;
+		case 'r':
+			b.rate = atol(optarg);
+			break;
+		case 'd':
+			b.duration = atof(optarg);
+			break;
+		case 'B':
+			b.binary = true;
+			break;
+		case 'C':
+			b.binary = b.coalesce = true;
+			break;
+		case 'f':
+			json = strcmp(optarg, "json") == 0;
+			break;
+		case 'n':
+			header = false;
+			break;
+		default:
+			fprintf(stderr, "Usage %s (-t udp|unix|abstract) (-c Clients) (-r Messages per second) (-d Seconds) (-B Binary protocol) (-C Accept coalesced frames) (-f csv|json) (-n No csv header)\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (b.n_clients < 1 || b.rate < 1 || b.duration <= 0) {
+		fprintf(stderr, "Clients, rate and duration have to be positive\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (bench_connect(&b) < 0) {
+		bench_close(&b);
+		exit(EXIT_FAILURE);
+	}
+	bench_run(&b);
+	bench_close(&b);
+	bench_report(&b, json, header);
+	return 0;
+}
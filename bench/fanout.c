@@ -0,0 +1,288 @@
+/**
+ * @file fanout.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Microbenchmark of the fan-out loop over the client registry
+ */
+
+/* UChat Fan-out Bench
+Fills a client table with N clients and times the loop which collects the
+addresses of all text clients for one broadcast, once with the clients stored
+as one struct per client and once with the column registry of the servers.
+The same is done for a room whose members are spread over the table.
+Usage: ./fanout.bin (-c Clients, repeatable) (-m Room members) (-r Rounds) (-n No csv header)
+*/
+
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "chat_proto.h"
+#include "registry.h"
+
+#define MAX_SIZES 8
+#define MIN_RUN_NS 200000000ull /* every measurement runs at least this long */
+#define PREFETCH 8 /* room members prefetched ahead, as in the servers */
+
+/* Client as the servers stored it before the registry was split into columns */
+struct ClientRow {
+	struct sockaddr_in data;
+	char name[CHAT_NAME_LEN + 1];
+	size_t name_len;
+	bool binary;
+	void *rel;
+};
+
+/* Cold part of a client in the column layout */
+struct ClientInfo {
+	char name[CHAT_NAME_LEN + 1];
+	size_t name_len;
+	void *rel;
+	unsigned long messages;
+};
+
+enum { COL_ADDR, COL_STATE, COL_INFO, COL_COUNT };
+
+#define STATE_BINARY 0x01
+#define STATE_RELIABLE 0x02
+
+struct Table {
+	int n;
+	struct ClientRow *rows;
+	struct Registry reg;
+	int *members; /* client handles of the room */
+	int n_members;
+	struct sockaddr_in *out; /* addresses collected for one broadcast */
+};
+
+/**
+ * @brief Monotonic time in nanoseconds
+ * @param void
+ * @return time
+ */
+uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Fill both layouts with the same clients, half of them binary, one in eight reliable
+ * @param table
+ * @param number of clients
+ * @param number of room members
+ * @return 0 on success, -1 if out of memory
+ */
+int table_init(struct Table *t, int n, int n_members) {
+	memset(t, 0, sizeof(*t));
+	t->n = n;
+	t->n_members = n_members < n ? n_members : n;
+	t->rows = calloc(n, sizeof(struct ClientRow));
+	t->members = calloc(t->n_members > 0 ? t->n_members : 1, sizeof(int));
+	t->out = calloc(n, sizeof(struct sockaddr_in));
+	if (!t->rows || !t->members || !t->out) return -1;
+
+	size_t columns[COL_COUNT] = { sizeof(struct sockaddr_in), sizeof(uint8_t), sizeof(struct ClientInfo) };
+	registry_init(&t->reg, columns, COL_COUNT, 0);
+	srand(1);
+	for (int i = 0; i < n; i++) {
+		struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(1024 + i % 60000), .sin_addr.s_addr = htonl(0x7f000001 + i) };
+		bool binary = rand() & 1, reliable = rand() % 8 == 0;
+		t->rows[i].data = addr;
+		t->rows[i].binary = binary;
+		t->rows[i].rel = reliable ? t : NULL;
+		t->rows[i].name_len = snprintf(t->rows[i].name, sizeof(t->rows[i].name), "client%d", i);
+
+		int h = registry_add(&t->reg);
+		if (h < 0) return -1;
+		*(struct sockaddr_in *)registry_get(&t->reg, COL_ADDR, h) = addr;
+		*(uint8_t *)registry_get(&t->reg, COL_STATE, h) = (binary ? STATE_BINARY : 0) | (reliable ? STATE_RELIABLE : 0);
+		struct ClientInfo *info = registry_get(&t->reg, COL_INFO, h);
+		info->rel = t->rows[i].rel;
+		info->name_len = snprintf(info->name, sizeof(info->name), "client%d", i);
+	}
+	/* churn like a running server, so handles and positions no longer match */
+	for (int i = 0; i < n / 4; i++) {
+		int h = rand() % n;
+		if (registry_pos(&t->reg, h) < 0) continue;
+		struct sockaddr_in addr = *(struct sockaddr_in *)registry_get(&t->reg, COL_ADDR, h);
+		uint8_t state = *(uint8_t *)registry_get(&t->reg, COL_STATE, h);
+		registry_remove(&t->reg, h);
+		int again = registry_add(&t->reg);
+		*(struct sockaddr_in *)registry_get(&t->reg, COL_ADDR, again) = addr;
+		*(uint8_t *)registry_get(&t->reg, COL_STATE, again) = state;
+	}
+	for (int k = 0; k < t->n_members; k++)
+		t->members[k] = rand() % n;
+	return 0;
+}
+
+/**
+ * @brief Free both layouts
+ * @param table
+ * @return void
+ */
+void table_free(struct Table *t) {
+	free(t->rows);
+	free(t->members);
+	free(t->out);
+	registry_free(&t->reg);
+}
+
+/**
+ * @brief Collect the text clients, one struct per client
+ * @param table
+ * @return number of collected addresses
+ */
+int fanout_rows(struct Table *t) {
+	int len = 0;
+	for (int i = 0; i < t->n; i++) {
+		const struct ClientRow *c = &t->rows[i];
+		/* always copy, only keep it for text clients; avoids a mispredicted branch per client */
+		t->out[len] = c->data;
+		len += !c->binary & !c->rel;
+	}
+	return len;
+}
+
+/**
+ * @brief Collect the text clients, address and state columns
+ * @param table
+ * @return number of collected addresses
+ */
+int fanout_columns(struct Table *t) {
+	const struct sockaddr_in *addrs = registry_column(&t->reg, COL_ADDR);
+	const uint8_t *state = registry_column(&t->reg, COL_STATE);
+	int len = 0;
+	for (uint32_t k = 0; k < t->reg.count; k++) {
+		t->out[len] = addrs[k];
+		len += !(state[k] & (STATE_BINARY | STATE_RELIABLE));
+	}
+	return len;
+}
+
+/**
+ * @brief Collect the text clients of the room, one struct per client
+ * @param table
+ * @return number of collected addresses
+ */
+int room_rows(struct Table *t) {
+	int len = 0;
+	for (int k = 0; k < t->n_members; k++) {
+		const struct ClientRow *c = &t->rows[t->members[k]];
+		t->out[len] = c->data;
+		len += !c->binary & !c->rel;
+	}
+	return len;
+}
+
+/**
+ * @brief Collect the text clients of the room, address and state columns with prefetching
+ * @param table
+ * @return number of collected addresses
+ */
+int room_columns(struct Table *t) {
+	const struct sockaddr_in *addrs = registry_column(&t->reg, COL_ADDR);
+	const uint8_t *state = registry_column(&t->reg, COL_STATE);
+	const uint32_t *slots = t->reg.slots;
+	int len = 0;
+	for (int k = 0; k < t->n_members; k++) {
+		/* two stages: the slot of a member far ahead, then the columns of a member whose slot is cached */
+		if (k + 2 * PREFETCH < t->n_members)
+			__builtin_prefetch(&slots[t->members[k + 2 * PREFETCH]]);
+		if (k + PREFETCH < t->n_members) {
+			uint32_t ahead = slots[t->members[k + PREFETCH]];
+			__builtin_prefetch(&addrs[ahead]);
+			__builtin_prefetch(&state[ahead]);
+		}
+		uint32_t pos = slots[t->members[k]];
+		t->out[len] = addrs[pos];
+		len += !(state[pos] & (STATE_BINARY | STATE_RELIABLE));
+	}
+	return len;
+}
+
+/**
+ * @brief Time one fan-out loop, best of all rounds
+ * @param table
+ * @param loop
+ * @param number of rounds
+ * @param clients walked per call
+ * @return nanoseconds per walked client
+ */
+double measure(struct Table *t, int (*fanout)(struct Table *), int rounds, int walked) {
+	double best = 0;
+	volatile int sink = 0;
+	for (int r = 0; r < rounds; r++) {
+		unsigned long calls = 0;
+		uint64_t start = now_ns(), elapsed;
+		do {
+			sink += fanout(t);
+			calls++;
+		} while ((elapsed = now_ns() - start) < MIN_RUN_NS / rounds);
+		double ns = (double)elapsed / calls / (walked > 0 ? walked : 1);
+		if (r == 0 || ns < best) best = ns;
+	}
+	return best;
+}
+
+/**
+ * @brief Main function, runs the fan-out loops for every table size
+ * @param number of arguments
+ * @param list of arguments
+ * @return success state
+ */
+int main(int argc, char *argv[]) {
+	int sizes[MAX_SIZES], n_sizes = 0, members = 1000, rounds = 5, opt;
+	bool header = true;
+
+	while ((opt = getopt(argc, argv, "c:m:r:n")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (n_sizes < MAX_SIZES) sizes[n_sizes++] = atoi(optarg);
+			break;
+		case 'm':
+			members = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'n':
+			header = false;
+			break;
+		default:
+			fprintf(stderr, "Usage %s (-c Clients, repeatable) (-m Room members) (-r Rounds) (-n No csv header)\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!n_sizes) {
+		sizes[n_sizes++] = 10000;
+		sizes[n_sizes++] = 100000;
+	}
+	if (rounds < 1) rounds = 1;
+
+	if (header) printf("clients,loop,rows_ns,columns_ns,speedup\n");
+	for (int s = 0; s < n_sizes; s++) {
+		struct Table t;
+		if (sizes[s] < 1 || table_init(&t, sizes[s], members) < 0) {
+			fprintf(stderr, "Cant build a table of %d clients\n", sizes[s]);
+			exit(EXIT_FAILURE);
+		}
+		if (fanout_rows(&t) != fanout_columns(&t)) {
+			fprintf(stderr, "Both layouts have to select the same clients\n");
+			exit(EXIT_FAILURE);
+		}
+		double rows = measure(&t, fanout_rows, rounds, t.n);
+		double columns = measure(&t, fanout_columns, rounds, t.n);
+		printf("%d,all,%.3f,%.3f,%.2f\n", t.n, rows, columns, rows / columns);
+		rows = measure(&t, room_rows, rounds, t.n_members);
+		columns = measure(&t, room_columns, rounds, t.n_members);
+		printf("%d,room%d,%.3f,%.3f,%.2f\n", t.n, t.n_members, rows, columns, rows / columns);
+		table_free(&t);
+	}
+	return 0;
+}
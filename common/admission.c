@@ -0,0 +1,137 @@
+/**
+ * @file admission.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Queue of clients waiting for a place on a full server
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "admission.h"
+#include "log.h"
+
+int admission_init(struct AdmissionQueue *q, uint32_t capacity, client_key_fn key_of) {
+	memset(q, 0, sizeof(*q));
+	q->head = q->tail = 1;
+	if (!capacity) return 0;
+	q->slots = calloc(capacity, sizeof(*q->slots));
+	if (!q->slots || client_index_init(&q->index, capacity, key_of) < 0) {
+		free(q->slots);
+		q->slots = NULL;
+		return -1;
+	}
+	q->capacity = capacity;
+	return 0;
+}
+
+void admission_free(struct AdmissionQueue *q) {
+	if (!q->slots) return;
+	client_index_free(&q->index);
+	free(q->slots);
+	q->slots = NULL;
+}
+
+/**
+ * @brief Slot of a ticket
+ * @param queue
+ * @param ticket
+ * @return slot
+ */
+static struct AdmissionEntry *slot_of(struct AdmissionQueue *q, uint64_t ticket) {
+	return &q->slots[ticket % q->capacity];
+}
+
+/**
+ * @brief Free the slot of a queued client
+ * @param queue
+ * @param slot
+ * @return void
+ */
+static void release(struct AdmissionQueue *q, struct AdmissionEntry *e) {
+	size_t len;
+	const void *key = q->index.key_of(e - q->slots, &len);
+	client_index_remove(&q->index, key, len);
+	e->ticket = 0;
+	q->count--;
+}
+
+/**
+ * @brief Move the head over freed slots and the clients which stopped retrying
+ * @param queue
+ * @param current time in milliseconds
+ * @return void
+ */
+static void advance(struct AdmissionQueue *q, uint64_t now) {
+	while (q->head != q->tail) {
+		struct AdmissionEntry *e = slot_of(q, q->head);
+		if (e->ticket == q->head) {
+			if (e->seen + ADMISSION_EXPIRE_MS > now) return;
+			release(q, e);
+			q->expired++;
+		}
+		q->head++;
+	}
+}
+
+uint32_t admission_push(struct AdmissionQueue *q, const void *key, size_t len, const struct AdmissionEntry *e, uint64_t now) {
+	if (!q->capacity) {
+		q->rejected++;
+		return 0;
+	}
+	int i = client_index_find(&q->index, key, len);
+	if (i >= 0) {
+		/* a retry, the client keeps its place */
+		struct AdmissionEntry *queued = &q->slots[i];
+		queued->seen = now;
+		queued->flags = e->flags;
+		queued->seq = e->seq;
+		queued->cred = e->cred;
+		return queued->ticket - q->head + 1;
+	}
+
+	advance(q, now);
+	if (q->tail - q->head == q->capacity) {
+		q->rejected++;
+		return 0;
+	}
+	struct AdmissionEntry *slot = slot_of(q, q->tail);
+	*slot = *e;
+	slot->ticket = q->tail;
+	slot->seen = now;
+	/* the slot holds the address now, the index reads the key from there */
+	if (client_index_insert(&q->index, key, len, slot - q->slots) < 0) {
+		slot->ticket = 0;
+		q->rejected++;
+		return 0;
+	}
+	q->tail++;
+	q->count++;
+	q->queued++;
+	return slot->ticket - q->head + 1;
+}
+
+int admission_pop(struct AdmissionQueue *q, struct AdmissionEntry *out, uint64_t now) {
+	if (!q->capacity) return -1;
+	advance(q, now);
+	if (q->head == q->tail) return -1;
+	struct AdmissionEntry *e = slot_of(q, q->head);
+	*out = *e;
+	release(q, e);
+	q->head++;
+	q->promoted++;
+	return 0;
+}
+
+bool admission_cancel(struct AdmissionQueue *q, const void *key, size_t len) {
+	if (!q->capacity) return false;
+	int i = client_index_find(&q->index, key, len);
+	if (i < 0) return false;
+	release(q, &q->slots[i]);
+	return true;
+}
+
+void admission_print_stats(const struct AdmissionQueue *q) {
+	if (!q->capacity) return;
+	LOG_INFO("Admission queue of %u places queued %lu clients, %lu got a place, %lu stopped waiting, %lu were rejected, %u waiting",
+		q->capacity, q->queued, q->promoted, q->expired, q->rejected, q->count);
+}
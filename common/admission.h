@@ -0,0 +1,103 @@
+/**
+ * @file admission.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Queue of clients waiting for a place on a full server
+ */
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "chat_proto.h"
+#include "client_index.h"
+
+#define ADMISSION_DEFAULT_LEN 256
+/* Queued clients repeat their registration at least every CHAT_RETRY_MAX_MS,
+ * a client which stayed silent for this long is gone */
+#define ADMISSION_EXPIRE_MS (3 * CHAT_RETRY_MAX_MS)
+
+/* Registration of a waiting client, kept until a place frees */
+struct AdmissionEntry {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	char name[CHAT_NAME_LEN + 1];
+	size_t name_len;
+	bool binary;
+	uint8_t flags; /* flags of the REGISTER frame */
+	uint32_t seq; /* seq of the REGISTER frame, a reliable stream starts there */
+	struct ucred cred; /* process which registered, pid 0 if the transport has no credentials */
+	uint64_t seen; /* time of the last registration in milliseconds */
+	uint64_t ticket; /* place in the order of arrival, 0 for a free slot */
+};
+
+/* FIFO of waiting clients in a ring of slots, indexed by the address of the
+ * client. The ticket of a client is its place in the order of arrival and
+ * fixes its slot. A repeated registration finds the slot through the index,
+ * refreshes it and learns its position without walking the queue. A client
+ * which leaves the queue frees its slot at once, the head skips it later. */
+struct AdmissionQueue {
+	struct AdmissionEntry *slots;
+	uint32_t capacity;
+	uint64_t head; /* oldest ticket still in the ring */
+	uint64_t tail; /* next ticket */
+	uint32_t count; /* waiting clients */
+	struct ClientIndex index; /* address key to slot */
+	unsigned long queued, promoted, expired, rejected;
+};
+
+/**
+ * @brief Allocate a queue
+ * @param queue
+ * @param number of waiting clients, 0 for no queue
+ * @param key lookup of a slot, the key of the address the slot holds
+ * @return 0 on success, -1 if out of memory
+ */
+int admission_init(struct AdmissionQueue *q, uint32_t capacity, client_key_fn key_of);
+
+/**
+ * @brief Free the queue
+ * @param queue
+ * @return void
+ */
+void admission_free(struct AdmissionQueue *q);
+
+/**
+ * @brief Queue a registration or refresh the one the client is queued with
+ * @param queue
+ * @param key bytes of the address
+ * @param key length
+ * @param registration, ticket and seen are set by the queue
+ * @param current time in milliseconds
+ * @return position in the queue starting at 1, or 0 if the queue is full
+ */
+uint32_t admission_push(struct AdmissionQueue *q, const void *key, size_t len, const struct AdmissionEntry *e, uint64_t now);
+
+/**
+ * @brief Take the oldest registration whose client is still there
+ * @param queue
+ * @param output
+ * @param current time in milliseconds
+ * @return 0 on success, -1 if nobody is waiting
+ */
+int admission_pop(struct AdmissionQueue *q, struct AdmissionEntry *out, uint64_t now);
+
+/**
+ * @brief Remove a client from the queue, e.g. on its disconnect
+ * @param queue
+ * @param key bytes of the address
+ * @param key length
+ * @return true if the client was queued
+ */
+bool admission_cancel(struct AdmissionQueue *q, const void *key, size_t len);
+
+/**
+ * @brief Log the queue statistics
+ * @param queue
+ * @return void
+ */
+void admission_print_stats(const struct AdmissionQueue *q);
+
+#endif
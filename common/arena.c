@@ -0,0 +1,77 @@
+/**
+ * @file arena.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Per batch scratch memory for outgoing messages
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "arena.h"
+#include "log.h"
+
+#define ARENA_ALIGN 16
+
+int arena_init(struct Arena *a, size_t size) {
+	memset(a, 0, sizeof(*a));
+	a->base = malloc(size);
+	if (!a->base) return -1;
+	a->size = size;
+	return 0;
+}
+
+void arena_free(struct Arena *a) {
+	arena_reset(a);
+	free(a->base);
+	memset(a, 0, sizeof(*a));
+}
+
+void *arena_alloc(struct Arena *a, size_t len) {
+	size_t need = (len + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	a->allocs++;
+	if (a->used + need <= a->size) {
+		void *p = a->base + a->used;
+		a->used += need;
+		if (a->used > a->peak) a->peak = a->used;
+		return p;
+	}
+	/* batch does not fit, keep the block until the next reset */
+	struct ArenaBlock *block = malloc(sizeof(struct ArenaBlock) + len);
+	if (!block) return NULL;
+	block->next = a->overflow;
+	a->overflow = block;
+	a->heap_allocs++;
+	return block->data;
+}
+
+char *arena_format(struct Arena *a, size_t *len, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n < 0) return NULL;
+
+	char *s = arena_alloc(a, n + 1);
+	if (!s) return NULL;
+	va_start(ap, fmt);
+	vsnprintf(s, n + 1, fmt, ap);
+	va_end(ap);
+	if (len) *len = n;
+	return s;
+}
+
+void arena_reset(struct Arena *a) {
+	while (a->overflow) {
+		struct ArenaBlock *next = a->overflow->next;
+		free(a->overflow);
+		a->overflow = next;
+	}
+	a->used = 0;
+}
+
+void arena_print_stats(const struct Arena *a) {
+	LOG_INFO("Formatted %lu messages in a %zu byte arena (peak %zu bytes), %lu heap allocations",
+		a->allocs, a->size, a->peak, a->heap_allocs);
+}
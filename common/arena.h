@@ -0,0 +1,78 @@
+/**
+ * @file arena.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Per batch scratch memory for outgoing messages
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Memory for the messages formatted while one receive batch is handled is
+ * taken from one preallocated block and given back at once by arena_reset.
+ * Only if a batch needs more than size bytes the arena falls back to the heap,
+ * heap_allocs counts these fallbacks and stays 0 in steady state. */
+struct ArenaBlock {
+	struct ArenaBlock *next;
+	char data[];
+};
+
+struct Arena {
+	char *base;
+	size_t size;
+	size_t used;
+	size_t peak;
+	struct ArenaBlock *overflow;
+	unsigned long allocs;
+	unsigned long heap_allocs;
+};
+
+/**
+ * @brief Allocate the block of an arena
+ * @param arena
+ * @param block size in bytes
+ * @return 0 on success, -1 if out of memory
+ */
+int arena_init(struct Arena *a, size_t size);
+
+/**
+ * @brief Free the block and all heap fallbacks of an arena
+ * @param arena
+ * @return void
+ */
+void arena_free(struct Arena *a);
+
+/**
+ * @brief Take len bytes from the arena, valid until the next reset
+ * @param arena
+ * @param number of bytes
+ * @return memory or NULL if out of memory
+ */
+void *arena_alloc(struct Arena *a, size_t len);
+
+/**
+ * @brief Format a zero terminated string into the arena
+ * @param arena
+ * @param length of the formatted string without the zero
+ * @param printf format
+ * @return string or NULL if out of memory
+ */
+char *arena_format(struct Arena *a, size_t *len, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+/**
+ * @brief Give all memory taken since the last reset back to the arena
+ * @param arena
+ * @return void
+ */
+void arena_reset(struct Arena *a);
+
+/**
+ * @brief Print the arena usage
+ * @param arena
+ * @return void
+ */
+void arena_print_stats(const struct Arena *a);
+
+#endif
@@ -0,0 +1,115 @@
+/**
+ * @file broadcast.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Batched fan-out of one payload to many clients through the send of a transport
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "broadcast.h"
+
+int broadcast_init(struct Broadcast *b, int capacity, socklen_t addrlen) {
+	memset(b, 0, sizeof(*b));
+	if (capacity < 1) capacity = 1;
+	b->addrlen = addrlen;
+	b->msgs = calloc(capacity, sizeof(struct mmsghdr));
+	b->addrs = calloc(capacity, addrlen);
+	b->targets = calloc(capacity, sizeof(int));
+	b->result = calloc(capacity, sizeof(int));
+	if (!b->msgs || !b->addrs || !b->targets || !b->result) {
+		broadcast_free(b);
+		return -1;
+	}
+	b->capacity = capacity;
+	return 0;
+}
+
+int broadcast_reserve(struct Broadcast *b, int capacity) {
+	if (capacity <= b->capacity) return 0;
+	struct mmsghdr *msgs = realloc(b->msgs, capacity * sizeof(struct mmsghdr));
+	if (!msgs) return -1;
+	b->msgs = msgs;
+	/* the queued headers point into the addresses, they are set again by the next broadcast_add */
+	char *addrs = realloc(b->addrs, (size_t)capacity * b->addrlen);
+	if (!addrs) return -1;
+	b->addrs = addrs;
+	for (int k = 0; k < b->len; k++)
+		b->msgs[k].msg_hdr.msg_name = b->addrs + (size_t)k * b->addrlen;
+	int *targets = realloc(b->targets, capacity * sizeof(int));
+	if (!targets) return -1;
+	b->targets = targets;
+	int *result = realloc(b->result, capacity * sizeof(int));
+	if (!result) return -1;
+	b->result = result;
+	b->capacity = capacity;
+	return 0;
+}
+
+void broadcast_free(struct Broadcast *b) {
+	free(b->msgs);
+	free(b->addrs);
+	free(b->targets);
+	free(b->result);
+	memset(b, 0, sizeof(*b));
+}
+
+void broadcast_begin(struct Broadcast *b, const void *payload, size_t len) {
+	b->iov[0].iov_base = (void *)payload;
+	b->iov[0].iov_len = len;
+	b->iovlen = 1;
+	b->len = 0;
+}
+
+void broadcast_begin_frame(struct Broadcast *b, const void *header, size_t hlen, const void *payload, size_t len) {
+	b->iov[0].iov_base = (void *)header;
+	b->iov[0].iov_len = hlen;
+	b->iov[1].iov_base = (void *)payload;
+	b->iov[1].iov_len = len;
+	b->iovlen = 2;
+	b->len = 0;
+}
+
+void broadcast_add(struct Broadcast *b, const void *addr, int target) {
+	if (b->len >= b->capacity) return;
+	struct msghdr *hdr = &b->msgs[b->len].msg_hdr;
+	char *copy = b->addrs + (size_t)b->len * b->addrlen;
+	memcpy(copy, addr, b->addrlen);
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->msg_name = copy;
+	hdr->msg_namelen = b->addrlen;
+	hdr->msg_iov = b->iov;
+	hdr->msg_iovlen = b->iovlen;
+	b->targets[b->len] = target;
+	b->result[b->len] = 0;
+	b->len++;
+}
+
+const void *broadcast_addr(const struct Broadcast *b, int k) {
+	return b->addrs + (size_t)k * b->addrlen;
+}
+
+int broadcast_flush(struct Broadcast *b, const struct ChatTransport *t, int sock) {
+	int sent = 0, done = 0;
+
+	while (done < b->len) {
+		int chunk = b->len - done;
+		if (chunk > BROADCAST_CHUNK) chunk = BROADCAST_CHUNK;
+
+		int n = t->send(sock, &b->msgs[done], chunk);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			/* sendmmsg only fails if the very first message fails,
+			 * mark that one and go on with the rest */
+			b->result[done] = -errno;
+			done++;
+			continue;
+		}
+		for (int k = done; k < done + n; k++)
+			b->result[k] = b->msgs[k].msg_len;
+		sent += n;
+		done += n;
+	}
+	return sent;
+}
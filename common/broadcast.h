@@ -0,0 +1,106 @@
+/**
+ * @file broadcast.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Batched fan-out of one payload to many clients through the send of a transport
+ */
+
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "transport.h"
+
+/* The kernel handles at most UIO_MAXIOV (1024) messages per sendmmsg call */
+#define BROADCAST_CHUNK 1024
+
+/* All queued headers point to the same iovec, so the payload is formatted once
+ * and never copied per recipient. A frame is sent as two iovecs, the header
+ * and the payload, so a forwarded payload is not copied either. The addresses
+ * are copied, so the registry lock is not held while the vector is sent.
+ * After a flush result[k] holds the number of bytes sent to targets[k] or
+ * -errno if the send to that client failed. */
+struct Broadcast {
+	struct mmsghdr *msgs;
+	struct iovec iov[2];
+	int iovlen;
+	char *addrs; /* addrlen bytes per recipient */
+	socklen_t addrlen;
+	int *targets;
+	int *result;
+	int capacity;
+	int len;
+};
+
+/**
+ * @brief Allocate a broadcast vector for up to capacity recipients
+ * @param broadcast vector
+ * @param maximum number of recipients
+ * @param length of a socket address of the transport
+ * @return 0 on success, -1 if out of memory
+ */
+int broadcast_init(struct Broadcast *b, int capacity, socklen_t addrlen);
+
+/**
+ * @brief Grow a broadcast vector, queued recipients are kept
+ * @param broadcast vector
+ * @param maximum number of recipients
+ * @return 0 on success, -1 if out of memory
+ */
+int broadcast_reserve(struct Broadcast *b, int capacity);
+
+/**
+ * @brief Free a broadcast vector
+ * @param broadcast vector
+ * @return void
+ */
+void broadcast_free(struct Broadcast *b);
+
+/**
+ * @brief Start a new broadcast, drops all queued recipients
+ * @param broadcast vector
+ * @param payload shared by all recipients, must stay valid until the flush
+ * @param payload length
+ * @return void
+ */
+void broadcast_begin(struct Broadcast *b, const void *payload, size_t len);
+
+/**
+ * @brief Start a new broadcast of a frame header followed by a payload
+ * @param broadcast vector
+ * @param frame header, must stay valid until the flush
+ * @param header length
+ * @param payload shared by all recipients, must stay valid until the flush
+ * @param payload length
+ * @return void
+ */
+void broadcast_begin_frame(struct Broadcast *b, const void *header, size_t hlen, const void *payload, size_t len);
+
+/**
+ * @brief Queue one recipient
+ * @param broadcast vector
+ * @param socket address of the recipient, copied
+ * @param client index reported back in targets
+ * @return void
+ */
+void broadcast_add(struct Broadcast *b, const void *addr, int target);
+
+/**
+ * @brief Address of a queued recipient
+ * @param broadcast vector
+ * @param recipient
+ * @return socket address
+ */
+const void *broadcast_addr(const struct Broadcast *b, int k);
+
+/**
+ * @brief Send the payload to all queued recipients
+ * @param broadcast vector
+ * @param transport of the socket
+ * @param socket to send on
+ * @return number of recipients the payload was sent to
+ */
+int broadcast_flush(struct Broadcast *b, const struct ChatTransport *t, int sock);
+
+#endif
@@ -0,0 +1,425 @@
+/**
+ * @file chat_client.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Client side of the chat protocol, shared by the interactive clients and the benchmark
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include "chat_client.h"
+
+/* Characters starting a message of the text protocol */
+#define TEXT_REGISTER '#'
+#define TEXT_DISCONNECT '%'
+#define TEXT_JOIN '>'
+#define TEXT_LEAVE '<'
+#define TEXT_PUBLISH '*'
+#define TEXT_HEARTBEAT "~"
+#define TEXT_FULL "##"
+#define TEXT_CLOSING "--"
+
+/**
+ * @brief Current time for the timers of the client
+ * @param void
+ * @return monotonic milliseconds
+ */
+static uint64_t clock_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void chat_client_init(struct ChatClient *c, int sock, const void *server, socklen_t serverlen, const char *name,
+		const struct ChatClientOps *ops, void *ctx) {
+	memset(c, 0, offsetof(struct ChatClient, buf));
+	c->sock = sock;
+	memcpy(&c->server, server, serverlen);
+	c->serverlen = serverlen;
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	snprintf(c->text_prefix, sizeof(c->text_prefix), "+");
+	c->ops = ops;
+	c->ctx = ctx;
+	c->timer_fd = -1;
+	c->register_flags = CHAT_FLAG_COMPRESSED;
+	c->retry_ms = CHAT_CLIENT_RETRY_MS;
+	c->seed = clock_ms() ^ getpid() ^ (uintptr_t)c;
+}
+
+int chat_client_reliable(struct ChatClient *c) {
+	c->peer = malloc(sizeof(*c->peer));
+	if (!c->peer) return -1;
+	rel_peer_init(c->peer, 1, 1);
+	return 0;
+}
+
+void chat_client_free(struct ChatClient *c) {
+	if (!c->peer) return;
+	rel_peer_free(c->peer);
+	free(c->peer);
+	c->peer = NULL;
+}
+
+/**
+ * @brief Send a datagram to the server
+ * @param client
+ * @param data
+ * @param length
+ * @return bytes sent or -1 on error
+ */
+static ssize_t send_raw(struct ChatClient *c, const void *data, size_t len) {
+	return sendto(c->sock, data, len, 0, (struct sockaddr *)&c->server, c->serverlen);
+}
+
+/**
+ * @brief Send one frame of the reliable stream, called by rel_poll
+ * @param reliable stream
+ * @param packed header
+ * @param payload
+ * @param payload length
+ * @param client
+ * @return void
+ */
+static void rel_send(struct RelPeer *p, const char *header, const char *payload, size_t len, void *ctx) {
+	struct ChatClient *c = ctx;
+	struct iovec iov[2] = {
+		{ (void *)header, CHAT_HEADER_LEN },
+		{ (void *)payload, len }
+	};
+	struct msghdr msg = {
+		.msg_name = &c->server,
+		.msg_namelen = c->serverlen,
+		.msg_iov = iov,
+		.msg_iovlen = 2
+	};
+	sendmsg(c->sock, &msg, 0);
+}
+
+/**
+ * @brief Send a frame without touching the timer
+ * @param client
+ * @param frame type
+ * @param payload
+ * @param payload length
+ * @return bytes sent or -1 on error
+ */
+static ssize_t send_frame(struct ChatClient *c, int type, const char *payload, size_t len) {
+	char frame[CHAT_HEADER_LEN + CHAT_CLIENT_PAYLOAD_LEN];
+	if (len > CHAT_CLIENT_PAYLOAD_LEN) len = CHAT_CLIENT_PAYLOAD_LEN;
+	if (c->peer) {
+		/* the stream numbers the frame, rel_poll sends it and keeps it until it is acked */
+		struct RelBlob *blob = rel_blob_get(payload, len);
+		if (!blob) return -1;
+		int64_t queued = rel_queue(c->peer, type, type == CHAT_REGISTER ? c->register_flags : 0, 0, blob);
+		rel_blob_put(blob);
+		if (queued < 0) return -1;
+		return rel_poll(c->peer, clock_ms(), rel_send, c) == 0 ? -1 : (ssize_t)len;
+	}
+	size_t hlen = chat_pack(frame, type, type == CHAT_REGISTER ? c->register_flags : 0, 0,
+		type == CHAT_MESSAGE || type == CHAT_PUBLISH ? ++c->seq : 0, len);
+	if (len) memcpy(frame + hlen, payload, len);
+	return send_raw(c, frame, hlen + len);
+}
+
+/**
+ * @brief Send a text protocol command with the name of the user
+ * @param client
+ * @param command character
+ * @return bytes sent or -1 on error
+ */
+static ssize_t send_named(struct ChatClient *c, char command) {
+	char text[CHAT_NAME_LEN + 2];
+	int len = snprintf(text, sizeof(text), "%c%s", command, c->name);
+	return send_raw(c, text, len);
+}
+
+/**
+ * @brief Wait before the next registration, equal jitter on an exponential backoff
+ * @param client
+ * @return milliseconds, between half and all of the backoff
+ */
+static uint32_t retry_delay(struct ChatClient *c) {
+	uint32_t half = c->retry_ms / 2;
+	uint32_t delay = half + rand_r(&c->seed) % (c->retry_ms - half + 1);
+	c->retry_ms = c->retry_ms < CHAT_RETRY_MAX_MS / 2 ? c->retry_ms * 2 : CHAT_RETRY_MAX_MS;
+	return delay;
+}
+
+/**
+ * @brief Send the registration in the protocol of the client
+ * @param client
+ * @param current time in milliseconds
+ * @return bytes sent or -1 on error
+ */
+static ssize_t send_register(struct ChatClient *c, uint64_t now) {
+	c->next_register = now + retry_delay(c);
+	c->last_heartbeat = now;
+	if (c->text_proto) return send_named(c, TEXT_REGISTER);
+	return send_frame(c, CHAT_REGISTER, c->name, strlen(c->name));
+}
+
+ssize_t chat_client_register(struct ChatClient *c) {
+	return send_register(c, clock_ms());
+}
+
+/**
+ * @brief Tell the server that the client is still there, outside of the reliable stream
+ * @param client
+ * @param current time in milliseconds
+ * @return bytes sent or -1 on error
+ */
+static ssize_t send_heartbeat(struct ChatClient *c, uint64_t now) {
+	char frame[CHAT_HEADER_LEN];
+	c->last_heartbeat = now;
+	if (c->text_proto) return send_raw(c, TEXT_HEARTBEAT, strlen(TEXT_HEARTBEAT));
+	return send_raw(c, frame, chat_pack(frame, CHAT_HEARTBEAT, 0, 0, 0, 0));
+}
+
+uint64_t chat_client_poll(struct ChatClient *c, uint64_t now) {
+	uint64_t next = UINT64_MAX;
+	/* a reliable registration is queued once and retransmitted with backoff until the server acks it */
+	if (!c->registered && now >= c->next_register && (!c->peer || c->peer->next_seq == 1)) {
+		if (send_register(c, now) < 0) {
+			c->ops->lost(c);
+			return UINT64_MAX;
+		}
+	}
+	if (!c->registered && (!c->peer || c->peer->next_seq == 1)) next = c->next_register;
+	if (c->peer) {
+		uint64_t deadline = rel_poll(c->peer, now, rel_send, c);
+		if (deadline == 0) {
+			c->ops->lost(c);
+			return UINT64_MAX;
+		}
+		if (deadline < next) next = deadline;
+	}
+	/* the server removes clients which stay silent for too long */
+	if (c->registered) {
+		if (now - c->last_heartbeat >= CHAT_HEARTBEAT_MS) send_heartbeat(c, now);
+		if (c->last_heartbeat + CHAT_HEARTBEAT_MS < next) next = c->last_heartbeat + CHAT_HEARTBEAT_MS;
+	}
+	return next;
+}
+
+/**
+ * @brief Run the due work and let the timer expire at the next deadline
+ * @param client
+ * @return void
+ */
+static void schedule(struct ChatClient *c) {
+	if (c->timer_fd < 0) return;
+	uint64_t now = clock_ms();
+	uint64_t next = chat_client_poll(c, now);
+	/* a stopped timer is the idle state, the client sleeps until the socket or the user wakes it */
+	event_loop_timer_set(c->timer_fd, next == UINT64_MAX ? 0 : next > now ? next - now : 1);
+}
+
+/**
+ * @brief Hand a frame to the client, a compressed payload restored
+ * @param client
+ * @param frame header
+ * @param payload
+ * @return void
+ */
+static void deliver(struct ChatClient *c, const struct ChatHeader *h, const char *payload) {
+	if (!(h->flags & CHAT_FLAG_COMPRESSED)) {
+		c->ops->frame(c, h, payload);
+		return;
+	}
+	struct ChatHeader plain = *h;
+	int len = chat_decompress(payload, h->len, c->plain, sizeof(c->plain));
+	if (len < 0) return;
+	plain.flags &= ~CHAT_FLAG_COMPRESSED;
+	plain.len = len;
+	c->ops->frame(c, &plain, c->plain);
+}
+
+/**
+ * @brief Hand a frame of the reliable stream which is next in order to the client, called by rel_on_data
+ * @param reliable stream
+ * @param frame header
+ * @param payload
+ * @param client
+ * @return void
+ */
+static void deliver_frame(struct RelPeer *p, const struct ChatHeader *h, const char *payload, void *ctx) {
+	struct ChatClient *c = ctx;
+	/* promoted from the waiting queue, the server took the registration
+	 * of an older stream, it is queued once more to line up the seqs */
+	if (h->type == CHAT_WELCOME && p->next_seq == 1)
+		send_frame(c, CHAT_REGISTER, c->name, strlen(c->name));
+	deliver(c, h, payload);
+}
+
+/**
+ * @brief Handle one received datagram
+ * @param client
+ * @param datagram length, the datagram is in the buffer of the client and zero terminated
+ * @return void
+ */
+static void handle_datagram(struct ChatClient *c, size_t n) {
+	struct ChatHeader h;
+	const char *payload;
+	if (!chat_is_frame(c->buf, n)) {
+		memset(&h, 0, sizeof(h));
+		h.version = CHAT_PROTO_VERSION;
+		h.sender = CHAT_SENDER_SERVER;
+		if (strncmp(c->buf, TEXT_FULL, strlen(TEXT_FULL)) == 0) {
+			h.type = CHAT_FULL;
+			h.seq = strtoul(c->buf + strlen(TEXT_FULL), NULL, 10);
+		} else if (strncmp(c->buf, TEXT_CLOSING, strlen(TEXT_CLOSING)) == 0) h.type = CHAT_CLOSING;
+		if (h.type != CHAT_FULL) c->retry_ms = CHAT_CLIENT_RETRY_MS;
+		if (h.type) c->ops->frame(c, &h, c->buf + n);
+		else if (n) c->ops->text(c, c->buf, n);
+		return;
+	}
+	/* the server may pack several frames into one datagram, each ends after its payload */
+	for (size_t off = 0; off < n && (payload = chat_unpack(c->buf + off, n - off, &h)); off += CHAT_HEADER_LEN + h.len) {
+		if (h.type != CHAT_FULL) c->retry_ms = CHAT_CLIENT_RETRY_MS;
+		if (h.type == CHAT_ACK) {
+			if (c->peer) rel_on_ack(c->peer, &h, payload, clock_ms());
+		} else if (c->peer && (h.flags & CHAT_FLAG_RELIABLE)) {
+			/* ack every frame, duplicates too, their ack may have been lost */
+			char ack[REL_ACK_LEN];
+			rel_on_data(c->peer, &h, payload, deliver_frame, c);
+			/* the callback may have restarted or freed the stream */
+			if (c->peer) send_raw(c, ack, rel_ack(c->peer, 0, ack));
+		} else {
+			deliver(c, &h, payload);
+		}
+	}
+}
+
+int chat_client_read(struct ChatClient *c) {
+	int n;
+	for (n = 0; n < CHAT_CLIENT_RECV_BATCH; n++) {
+		ssize_t len = recv(c->sock, c->buf, CHAT_CLIENT_RECV_LEN, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+			c->ops->lost(c);
+			return -1;
+		}
+		c->buf[len] = '\0';
+		c->registered = true;
+		handle_datagram(c, len);
+	}
+	return n;
+}
+
+/**
+ * @brief Socket of the client is readable
+ * @param loop
+ * @param socket
+ * @param unused
+ * @param client
+ * @return void
+ */
+static void on_readable(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	struct ChatClient *c = ctx;
+	if (chat_client_read(c) >= 0) schedule(c);
+}
+
+/**
+ * @brief Timer of the client expired
+ * @param loop
+ * @param timerfd
+ * @param expirations
+ * @param client
+ * @return void
+ */
+static void on_timer(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	schedule(ctx);
+}
+
+int chat_client_attach(struct ChatClient *c, struct EventLoop *loop) {
+	int fd = event_loop_add_timer(loop, 0, on_timer, c);
+	if (fd < 0) return -1;
+	if (event_loop_add(loop, c->sock, on_readable, c) < 0) {
+		event_loop_del(loop, fd);
+		return -1;
+	}
+	c->timer_fd = fd;
+	schedule(c);
+	return 0;
+}
+
+void chat_client_restart(struct ChatClient *c) {
+	c->registered = false;
+	c->next_register = clock_ms() + retry_delay(c);
+	/* the server dropped the registration, it is sent again on a fresh stream */
+	if (c->peer) {
+		rel_peer_free(c->peer);
+		rel_peer_init(c->peer, 1, 1);
+	}
+	schedule(c);
+}
+
+ssize_t chat_client_send(struct ChatClient *c, int type, const char *payload, size_t len) {
+	ssize_t sent = send_frame(c, type, payload, len);
+	/* a reliable frame may be due for a retransmit before the armed deadline */
+	if (c->peer) schedule(c);
+	return sent;
+}
+
+ssize_t chat_client_message(struct ChatClient *c, const char *text) {
+	if (!c->text_proto) return chat_client_send(c, CHAT_MESSAGE, text, strlen(text));
+	char buf[CHAT_CLIENT_PAYLOAD_LEN];
+	int len = snprintf(buf, sizeof(buf), "%s%s", c->text_prefix, text);
+	return send_raw(c, buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1);
+}
+
+ssize_t chat_client_room(struct ChatClient *c, int type, const char *room, size_t room_len, const char *text) {
+	char buf[CHAT_CLIENT_PAYLOAD_LEN];
+	if (c->text_proto) {
+		char command = type == CHAT_ROOM_JOIN ? TEXT_JOIN : type == CHAT_ROOM_LEAVE ? TEXT_LEAVE : TEXT_PUBLISH;
+		int len;
+		if (type == CHAT_PUBLISH)
+			len = snprintf(buf, sizeof(buf), "%c%.*s %s", command, (int)room_len, room, text);
+		else
+			len = snprintf(buf, sizeof(buf), "%c%.*s", command, (int)room_len, room);
+		return send_raw(c, buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1);
+	}
+	if (type != CHAT_PUBLISH) return chat_client_send(c, type, room, room_len);
+	size_t len = chat_room_pack(buf, sizeof(buf), room, room_len, text, strlen(text));
+	return len ? chat_client_send(c, CHAT_PUBLISH, buf, len) : -1;
+}
+
+ssize_t chat_client_input(struct ChatClient *c, const char *line) {
+	const char *room, *text;
+	size_t room_len;
+	int command = chat_room_command(line, &room, &room_len, &text);
+	if (command) return chat_client_room(c, command, room, room_len, text);
+	if (line[0] == '\0') return 0;
+	return chat_client_message(c, line);
+}
+
+void chat_client_disconnect(struct ChatClient *c, int wait_ms) {
+	if (c->text_proto) {
+		send_named(c, TEXT_DISCONNECT);
+		return;
+	}
+	send_frame(c, CHAT_DISCONNECT, NULL, 0);
+	if (!c->peer) return;
+
+	/* only acks are looked at, the user is gone */
+	uint64_t end = clock_ms() + wait_ms;
+	while (rel_outstanding(c->peer) > 0) {
+		uint64_t now = clock_ms();
+		if (now >= end) return;
+		uint64_t deadline = rel_poll(c->peer, now, rel_send, c);
+		if (deadline == 0) return;
+		if (deadline > end) deadline = end;
+		struct pollfd pfd = { .fd = c->sock, .events = POLLIN };
+		if (poll(&pfd, 1, deadline > now ? deadline - now : 0) <= 0) continue;
+		ssize_t n = recv(c->sock, c->buf, CHAT_CLIENT_RECV_LEN, MSG_DONTWAIT);
+		struct ChatHeader h;
+		const char *payload = n > 0 ? chat_unpack(c->buf, n, &h) : NULL;
+		if (payload && h.type == CHAT_ACK) rel_on_ack(c->peer, &h, payload, clock_ms());
+	}
+}
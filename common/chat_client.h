@@ -0,0 +1,175 @@
+/**
+ * @file chat_client.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Client side of the chat protocol, shared by the interactive clients and the benchmark
+ */
+
+#ifndef CHAT_CLIENT_H
+#define CHAT_CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "chat_proto.h"
+#include "reliable.h"
+#include "event_loop.h"
+
+#define CHAT_CLIENT_RECV_LEN 4096 /* a datagram of several frames or one long frame */
+#define CHAT_CLIENT_PAYLOAD_LEN (CHAT_CLIENT_RECV_LEN - CHAT_HEADER_LEN) /* longest payload or text message sent */
+#define CHAT_CLIENT_TEXT_LEN (CHAT_CLIENT_RECV_LEN + CHAT_NAME_LEN + CHAT_ROOM_LEN + 8) /* a payload rendered with the names of room and sender */
+#define CHAT_CLIENT_RECV_BATCH 32 /* datagrams read per wakeup before the other sources of the loop get their turn */
+#define CHAT_CLIENT_RETRY_MS 1000 /* first wait before the registration is sent again, doubled up to CHAT_RETRY_MAX_MS */
+
+struct ChatClient;
+
+/* Called from chat_client_read and the timer of the client */
+struct ChatClientOps {
+	/* Frame of the server, reliable frames in stream order. The "##" and
+	 * "--" of a text server are passed as FULL and CLOSING without payload,
+	 * the place in the queue after "##" as seq of the FULL. */
+	void (*frame)(struct ChatClient *c, const struct ChatHeader *h, const char *payload);
+	/* Zero terminated message of a text server */
+	void (*text)(struct ChatClient *c, const char *text, size_t len);
+	/* The server can not be reached, the socket failed or the reliable stream gave up */
+	void (*lost)(struct ChatClient *c);
+};
+
+/* One connection to a server over a datagram socket of any family. Every
+ * buffer is part of the struct, so receiving and sending never allocate.
+ * The receive loop never blocks, the caller waits for the socket, e.g. with
+ * chat_client_attach, and the single timer of the client runs at the next
+ * deadline of the registration, the heartbeat or the reliable stream. */
+struct ChatClient {
+	int sock;
+	struct sockaddr_storage server;
+	socklen_t serverlen;
+	char name[CHAT_NAME_LEN + 1];
+	bool text_proto; /* talk the old text protocol instead of binary frames */
+	char text_prefix[CHAT_NAME_LEN + 4]; /* put in front of a text message, "+" or "[name] " */
+	int register_flags; /* sent with REGISTER, CHAT_FLAG_COMPRESSED and e.g. CHAT_FLAG_COALESCE */
+	bool registered; /* the server answered since the last registration */
+	uint32_t seq;
+	struct RelPeer *peer; /* reliable stream, NULL without one */
+	uint64_t next_register, last_heartbeat;
+	uint32_t retry_ms; /* backoff of the next registration, reset by an answer other than FULL */
+	unsigned int seed; /* jitter of the backoff, so waiting clients dont retry in step */
+	const struct ChatClientOps *ops;
+	void *ctx;
+	int timer_fd; /* one shot timer of the event loop, -1 if not attached */
+	char buf[CHAT_CLIENT_RECV_LEN + 1]; /* room for the terminating zero of a text message */
+	char plain[CHAT_CLIENT_RECV_LEN]; /* payload of a compressed frame */
+};
+
+/**
+ * @brief Set up a client, the registration is sent by the first chat_client_poll
+ * @param client
+ * @param datagram socket, bound if the family needs it
+ * @param socket address of the server
+ * @param address length
+ * @param name of the user
+ * @param callbacks
+ * @param context of the callbacks
+ * @return void
+ */
+void chat_client_init(struct ChatClient *c, int sock, const void *server, socklen_t serverlen, const char *name,
+	const struct ChatClientOps *ops, void *ctx);
+
+/**
+ * @brief Ask for a reliable stream in both directions, binary protocol only, call before the registration
+ * @param client
+ * @return 0 on success, -1 if out of memory
+ */
+int chat_client_reliable(struct ChatClient *c);
+
+/**
+ * @brief Release the reliable stream, the socket is not closed
+ * @param client
+ * @return void
+ */
+void chat_client_free(struct ChatClient *c);
+
+/**
+ * @brief Let an event loop watch the socket and run the timer of the client
+ * @param client
+ * @param loop
+ * @return 0 on success, -1 on error
+ */
+int chat_client_attach(struct ChatClient *c, struct EventLoop *loop);
+
+/**
+ * @brief Read and handle every waiting datagram, up to CHAT_CLIENT_RECV_BATCH
+ * @param client
+ * @return datagrams read or -1 if the socket failed
+ */
+int chat_client_read(struct ChatClient *c);
+
+/**
+ * @brief Send the registration now, e.g. by a client without event loop
+ * @param client
+ * @return bytes sent or -1 on error
+ */
+ssize_t chat_client_register(struct ChatClient *c);
+
+/**
+ * @brief Send the registration, heartbeat and retransmits which are due
+ * @param client
+ * @param current time in milliseconds
+ * @return time of the next deadline, UINT64_MAX if there is none
+ */
+uint64_t chat_client_poll(struct ChatClient *c, uint64_t now);
+
+/**
+ * @brief Register again after a FULL of the server, on a fresh reliable stream, after the backoff
+ * @param client
+ * @return void
+ */
+void chat_client_restart(struct ChatClient *c);
+
+/**
+ * @brief Send a frame, queued on the reliable stream if the client has one
+ * @param client
+ * @param frame type
+ * @param payload
+ * @param payload length, cut at CHAT_CLIENT_PAYLOAD_LEN
+ * @return bytes sent or -1 on error
+ */
+ssize_t chat_client_send(struct ChatClient *c, int type, const char *payload, size_t len);
+
+/**
+ * @brief Send a chat message in the protocol of the client
+ * @param client
+ * @param zero terminated text
+ * @return bytes sent or -1 on error
+ */
+ssize_t chat_client_message(struct ChatClient *c, const char *text);
+
+/**
+ * @brief Send a room command in the protocol of the client
+ * @param client
+ * @param CHAT_ROOM_JOIN, CHAT_ROOM_LEAVE or CHAT_PUBLISH
+ * @param room name, not zero terminated
+ * @param room name length
+ * @param zero terminated text of CHAT_PUBLISH
+ * @return bytes sent or -1 on error
+ */
+ssize_t chat_client_room(struct ChatClient *c, int type, const char *room, size_t room_len, const char *text);
+
+/**
+ * @brief Send a line typed by the user, a room command or a chat message
+ * @param client
+ * @param zero terminated line without the line break
+ * @return bytes sent, 0 for an empty line or -1 on error
+ */
+ssize_t chat_client_input(struct ChatClient *c, const char *line);
+
+/**
+ * @brief Send the disconnect and wait until the server acked the reliable stream
+ * @param client
+ * @param longest wait in milliseconds
+ * @return void
+ */
+void chat_client_disconnect(struct ChatClient *c, int wait_ms);
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * @file chat_engine.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Protocol core shared by the chat servers of every transport
+ */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "chat_engine.h"
+#include "log.h"
+
+void chat_request_frame(struct ChatRequest *r, const struct ChatHeader *h, const char *payload) {
+	memset(r, 0, sizeof(*r));
+	r->h = *h;
+	r->payload = payload;
+	r->frame = true;
+	if (h->type == CHAT_PUBLISH)
+		r->msg = chat_room_unpack(payload, h->len, &r->room, &r->room_len, &r->msg_len);
+}
+
+int chat_request_parse(const char *buffer, size_t nbytes, struct ChatRequest *r) {
+	if (chat_is_frame(buffer, nbytes)) {
+		struct ChatHeader h;
+		const char *payload = chat_unpack(buffer, nbytes, &h);
+		if (!payload) {
+			LOG_DEBUG("Dropping invalid frame of %zu bytes", nbytes);
+			return -1;
+		}
+		LOG_DEBUG("Got frame type %d, seq %u, length = %u", h.type, h.seq, h.len);
+		chat_request_frame(r, &h, payload);
+		return 0;
+	}
+
+	LOG_DEBUG("Got message: \"%s\", length = %zu", buffer, nbytes);
+	memset(r, 0, sizeof(*r));
+	r->payload = buffer + 1;
+	switch (buffer[0]) {
+	case CHAT_TEXT_REGISTER:
+		r->h.type = CHAT_REGISTER;
+		break;
+	case CHAT_TEXT_DISCONNECT:
+		r->h.type = CHAT_DISCONNECT;
+		break;
+	case CHAT_TEXT_MESSAGE:
+		r->h.type = CHAT_MESSAGE;
+		break;
+	case CHAT_TEXT_JOIN:
+		r->h.type = CHAT_ROOM_JOIN;
+		break;
+	case CHAT_TEXT_LEAVE:
+		r->h.type = CHAT_ROOM_LEAVE;
+		break;
+	case CHAT_TEXT_PUBLISH:
+		r->h.type = CHAT_PUBLISH;
+		r->room = buffer + 1;
+		r->room_len = strcspn(r->room, " ");
+		r->msg = r->room + r->room_len;
+		if (*r->msg == ' ') r->msg++;
+		r->msg_len = strlen(r->msg);
+		break;
+	case CHAT_TEXT_HEARTBEAT:
+		r->h.type = CHAT_HEARTBEAT;
+		break;
+	default:
+		r->h.type = CHAT_MESSAGE;
+		r->h.flags = CHAT_FLAG_FORMATTED;
+		r->payload = buffer;
+	}
+	r->h.len = strlen(r->payload);
+	return 0;
+}
+
+void chat_dispatch(const chat_handler handlers[CHAT_TYPES], void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen) {
+	/* a PUBLISH without a valid room is still a valid frame, e.g. for a reliable stream, but has nothing to publish */
+	if (r->h.type == CHAT_PUBLISH && !r->msg) return;
+	if (r->h.type < CHAT_TYPES && handlers[r->h.type])
+		handlers[r->h.type](ctx, r, addr, addrlen);
+}
+
+int chat_client_find(const struct ClientIndex *ix, const struct ChatTransport *t, const void *addr) {
+	size_t len;
+	const void *key = t->key(addr, &len);
+	int i = client_index_find(ix, key, len);
+	LOG_DEBUG("Client at index %d", i);
+	return i;
+}
+
+int chat_console_read(struct ChatConsole *c, int fd, void (*command)(char *line)) {
+	ssize_t nbytes = read(fd, c->line + c->used, sizeof(c->line) - 1 - c->used);
+	/* console closed, e.g. server runs in the background */
+	if (nbytes <= 0) return -1;
+	c->used += nbytes;
+
+	char *start = c->line, *end;
+	while ((end = memchr(start, '\n', c->line + c->used - start))) {
+		*end = '\0';
+		command(start);
+		start = end + 1;
+	}
+	c->used -= start - c->line;
+	memmove(c->line, start, c->used);
+	/* drop lines which dont fit into the buffer */
+	if (c->used == sizeof(c->line) - 1) c->used = 0;
+	return 0;
+}
+
+void chat_gauges(FILE *out, uint32_t clients, int rooms, unsigned long memberships) {
+	fprintf(out, "# HELP uchat_clients Registered clients\n# TYPE uchat_clients gauge\nuchat_clients %u\n", clients);
+	fprintf(out, "# HELP uchat_rooms Rooms with members\n# TYPE uchat_rooms gauge\nuchat_rooms %d\n", rooms);
+	fprintf(out, "# HELP uchat_room_memberships Clients in rooms, counted once per room\n# TYPE uchat_room_memberships gauge\n"
+		"uchat_room_memberships %lu\n", memberships);
+}
+
+uint64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
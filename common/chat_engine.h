@@ -0,0 +1,131 @@
+/**
+ * @file chat_engine.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Protocol core shared by the chat servers of every transport
+ */
+
+#ifndef CHAT_ENGINE_H
+#define CHAT_ENGINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include "chat_proto.h"
+#include "client_index.h"
+#include "transport.h"
+
+#define CHAT_CONSOLE_LEN 4096
+
+/* Characters starting a message of the text protocol */
+#define CHAT_TEXT_REGISTER '#'
+#define CHAT_TEXT_DISCONNECT '%'
+#define CHAT_TEXT_MESSAGE '+' /* text behind it without the name of the sender */
+#define CHAT_TEXT_JOIN '>'
+#define CHAT_TEXT_LEAVE '<'
+#define CHAT_TEXT_PUBLISH '*' /* room name up to the first space, the text behind it */
+#define CHAT_TEXT_HEARTBEAT '~'
+
+/* One request of a client in either protocol. A text message is decoded into
+ * the header a binary client would have sent, any other text than the
+ * commands above is a MESSAGE with CHAT_FLAG_FORMATTED, it already starts
+ * with the name of the sender. */
+struct ChatRequest {
+	struct ChatHeader h;
+	const char *payload; /* h.len bytes: name, text or room name */
+	bool frame; /* sent as a binary frame, a frame is forwarded untouched */
+	/* room and text of a PUBLISH */
+	const char *room, *msg;
+	size_t room_len, msg_len;
+};
+
+/* Handles one request type, indexed by ChatType. ctx is passed through
+ * from the dispatch, e.g. the worker which received the request. */
+typedef void (*chat_handler)(void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen);
+
+/* Lines typed on the server console, collected over several reads */
+struct ChatConsole {
+	char line[CHAT_CONSOLE_LEN];
+	size_t used;
+};
+
+/**
+ * @brief Decode a received datagram
+ * @param zero terminated datagram
+ * @param datagram length
+ * @param request, points into the datagram
+ * @return 0 on success, -1 if the datagram is an invalid frame
+ */
+int chat_request_parse(const char *buffer, size_t nbytes, struct ChatRequest *r);
+
+/**
+ * @brief Decode an already unpacked frame, e.g. one delivered by a reliable stream
+ * @param request
+ * @param frame header
+ * @param payload
+ * @return void
+ */
+void chat_request_frame(struct ChatRequest *r, const struct ChatHeader *h, const char *payload);
+
+/**
+ * @brief Call the handler of the request type, requests without handler and a PUBLISH without valid room are ignored
+ * @param handlers indexed by ChatType
+ * @param context of the handlers
+ * @param request
+ * @param address of the client
+ * @param address length
+ * @return void
+ */
+void chat_dispatch(const chat_handler handlers[CHAT_TYPES], void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen);
+
+/**
+ * @brief Handle of the client at an address
+ * @param client index
+ * @param transport of the address
+ * @param address
+ * @return handle or -1 if not present
+ */
+int chat_client_find(const struct ClientIndex *ix, const struct ChatTransport *t, const void *addr);
+
+/**
+ * @brief Read the console and run every complete line, lines longer than the buffer are dropped
+ * @param console
+ * @param file descriptor, e.g. stdin
+ * @param command run for every line, zero terminated without the line break
+ * @return 0 or -1 if the console was closed
+ */
+int chat_console_read(struct ChatConsole *c, int fd, void (*command)(char *line));
+
+/**
+ * @brief Write the gauges every server has to a metrics snapshot
+ * @param output
+ * @param registered clients
+ * @param rooms with members
+ * @param memberships of all rooms
+ * @return void
+ */
+void chat_gauges(FILE *out, uint32_t clients, int rooms, unsigned long memberships);
+
+/**
+ * @brief Current time for timers and expiry
+ * @param void
+ * @return monotonic milliseconds
+ */
+uint64_t now_ms(void);
+
+/**
+ * @brief Current time for the rate limits and the coalescing window
+ * @param void
+ * @return monotonic microseconds
+ */
+uint64_t now_us(void);
+
+/**
+ * @brief Current time for the fan-out latency
+ * @param void
+ * @return monotonic nanoseconds
+ */
+uint64_t now_ns(void);
+
+#endif
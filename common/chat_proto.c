@@ -0,0 +1,172 @@
+/**
+ * @file chat_proto.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Binary framed chat protocol shared by clients and servers
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "chat_proto.h"
+#include "lz.h"
+
+#define CHAT_ROSTER_MAX (1u << 20) /* ids above are bogus, a server never has that many clients */
+
+int chat_is_frame(const void *buf, size_t n) {
+	return n > 0 && ((const uint8_t *)buf)[0] == CHAT_PROTO_MAGIC;
+}
+
+size_t chat_pack(void *buf, int type, int flags, uint32_t sender, uint32_t seq, uint16_t len) {
+	uint8_t *p = buf;
+	uint32_t sender_n = htonl(sender), seq_n = htonl(seq);
+	uint16_t len_n = htons(len), reserved = 0;
+
+	p[0] = CHAT_PROTO_MAGIC;
+	p[1] = CHAT_PROTO_VERSION;
+	p[2] = type;
+	p[3] = flags;
+	memcpy(p + 4, &sender_n, 4);
+	memcpy(p + 8, &seq_n, 4);
+	memcpy(p + 12, &len_n, 2);
+	memcpy(p + 14, &reserved, 2);
+	return CHAT_HEADER_LEN;
+}
+
+const char *chat_unpack(const void *buf, size_t n, struct ChatHeader *h) {
+	const uint8_t *p = buf;
+	uint32_t sender_n, seq_n;
+	uint16_t len_n;
+
+	if (n < CHAT_HEADER_LEN || p[0] != CHAT_PROTO_MAGIC || p[1] != CHAT_PROTO_VERSION) return NULL;
+	memcpy(&sender_n, p + 4, 4);
+	memcpy(&seq_n, p + 8, 4);
+	memcpy(&len_n, p + 12, 2);
+	h->version = p[1];
+	h->type = p[2];
+	h->flags = p[3];
+	h->sender = ntohl(sender_n);
+	h->seq = ntohl(seq_n);
+	h->len = ntohs(len_n);
+	if (h->len > n - CHAT_HEADER_LEN) return NULL;
+	return (const char *)p + CHAT_HEADER_LEN;
+}
+
+int chat_roster_set(struct ChatRoster *r, uint32_t id, const char *name, size_t len) {
+	if (id == CHAT_SENDER_SERVER) return 0;
+	if (id >= CHAT_ROSTER_MAX) return -1;
+	if (id >= r->capacity) {
+		uint32_t capacity = r->capacity ? r->capacity : 16;
+		while (capacity <= id) capacity *= 2;
+		void *names = realloc(r->names, (size_t)capacity * sizeof(*r->names));
+		if (!names) return -1;
+		r->names = names;
+		memset(r->names + r->capacity, 0, (size_t)(capacity - r->capacity) * sizeof(*r->names));
+		r->capacity = capacity;
+	}
+	if (len > CHAT_NAME_LEN) len = CHAT_NAME_LEN;
+	memcpy(r->names[id], name, len);
+	r->names[id][len] = '\0';
+	return 0;
+}
+
+const char *chat_roster_get(const struct ChatRoster *r, uint32_t id) {
+	if (id == CHAT_SENDER_SERVER) return "SERVER";
+	if (id >= r->capacity || r->names[id][0] == '\0') return "?";
+	return r->names[id];
+}
+
+size_t chat_room_pack(char *buf, size_t size, const char *room, size_t room_len, const char *text, size_t len) {
+	if (room_len == 0 || room_len > CHAT_ROOM_LEN || 1 + room_len + len > size) return 0;
+	buf[0] = room_len;
+	memcpy(buf + 1, room, room_len);
+	memcpy(buf + 1 + room_len, text, len);
+	return 1 + room_len + len;
+}
+
+const char *chat_room_unpack(const char *payload, size_t len, const char **room, size_t *room_len, size_t *text_len) {
+	if (len < 1) return NULL;
+	size_t n = (uint8_t)payload[0];
+	if (n == 0 || n > CHAT_ROOM_LEN || 1 + n > len) return NULL;
+	*room = payload + 1;
+	*room_len = n;
+	*text_len = len - 1 - n;
+	return payload + 1 + n;
+}
+
+int chat_room_command(const char *line, const char **room, size_t *room_len, const char **text) {
+	static const struct { const char *name; int type; } commands[] = {
+		{ "/join ", CHAT_ROOM_JOIN }, { "/leave ", CHAT_ROOM_LEAVE }, { "/room ", CHAT_PUBLISH }
+	};
+	for (size_t k = 0; k < sizeof(commands) / sizeof(commands[0]); k++) {
+		size_t n = strlen(commands[k].name);
+		if (strncmp(line, commands[k].name, n) != 0) continue;
+		*room = line + n;
+		*room_len = strcspn(*room, " ");
+		*text = *room + *room_len;
+		if (**text == ' ') (*text)++;
+		if (*room_len == 0 || *room_len > CHAT_ROOM_LEN) return 0;
+		if (commands[k].type == CHAT_PUBLISH && **text == '\0') return 0;
+		return commands[k].type;
+	}
+	return 0;
+}
+
+int chat_render(struct ChatRoster *r, const struct ChatHeader *h, const char *payload, char *out, size_t outlen) {
+	int len = h->len, n;
+	switch (h->type) {
+	case CHAT_WELCOME:
+		chat_roster_set(r, h->sender, payload, len);
+		n = snprintf(out, outlen, "[SERVER] Successfully registered to the server");
+		break;
+	case CHAT_JOIN:
+		chat_roster_set(r, h->sender, payload, len);
+		n = snprintf(out, outlen, "[SERVER] \"%.*s\" joined the server", len, payload);
+		break;
+	case CHAT_LEAVE:
+		n = snprintf(out, outlen, "[SERVER] \"%.*s\" disconnected from the server", len, payload);
+		break;
+	case CHAT_MESSAGE:
+		if (h->flags & CHAT_FLAG_FORMATTED)
+			n = snprintf(out, outlen, "%.*s", len, payload);
+		else
+			n = snprintf(out, outlen, "[%s] %.*s", chat_roster_get(r, h->sender), len, payload);
+		break;
+	case CHAT_NOTICE:
+		n = snprintf(out, outlen, "[SERVER] %.*s", len, payload);
+		break;
+	case CHAT_PUBLISH: {
+		const char *room, *text;
+		size_t room_len, text_len;
+		if (!(text = chat_room_unpack(payload, len, &room, &room_len, &text_len))) return -1;
+		n = snprintf(out, outlen, "[#%.*s] [%s] %.*s", (int)room_len, room, chat_roster_get(r, h->sender), (int)text_len, text);
+		break;
+	}
+	default:
+		return -1;
+	}
+	if (n < 0) return -1;
+	return (size_t)n < outlen ? n : (int)outlen - 1;
+}
+
+size_t chat_compress(const char *payload, size_t len, char *out, size_t size) {
+	uint16_t len_n = htons(len);
+	if (len > LZ_MAX_INPUT) return 0;
+	/* at least one byte has to be saved */
+	if (size >= len) size = len - 1;
+	if (len == 0 || size <= sizeof(len_n)) return 0;
+	size_t n = lz_compress(payload, len, out + sizeof(len_n), size - sizeof(len_n));
+	if (!n) return 0;
+	memcpy(out, &len_n, sizeof(len_n));
+	return sizeof(len_n) + n;
+}
+
+int chat_decompress(const char *payload, size_t len, char *out, size_t size) {
+	uint16_t len_n;
+	if (len < sizeof(len_n)) return -1;
+	memcpy(&len_n, payload, sizeof(len_n));
+	if (ntohs(len_n) > size) return -1;
+	int n = lz_decompress(payload + sizeof(len_n), len - sizeof(len_n), out, ntohs(len_n));
+	return n == ntohs(len_n) ? n : -1;
+}
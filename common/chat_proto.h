@@ -0,0 +1,216 @@
+/**
+ * @file chat_proto.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Binary framed chat protocol shared by clients and servers
+ */
+
+#ifndef CHAT_PROTO_H
+#define CHAT_PROTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A binary frame starts with the magic byte, which never starts a message of
+ * the text protocol ('#', '%', '+', '>', '<', '*', '~' or '[' from the clients). A server answers
+ * every client in the protocol it registered with, so old text clients and
+ * binary clients can share one server.
+ *
+ * Header, all fields in network byte order, followed by len payload bytes:
+ *   0  magic    1  version  2  type  3  flags
+ *   4  sender id (slot of the client on the server, CHAT_SENDER_SERVER for the server)
+ *   8  sequence number, counted per sender
+ *  12  payload length      14  reserved, 0 */
+#define CHAT_PROTO_MAGIC 0xC7
+#define CHAT_PROTO_VERSION 1
+#define CHAT_HEADER_LEN 16
+#define CHAT_SENDER_SERVER 0xffffffffu
+#define CHAT_NAME_LEN 50
+#define CHAT_ROOM_LEN 32
+/* Registered clients send a HEARTBEAT, or '~' in the text protocol, this
+ * often, so the server does not remove them as idle */
+#define CHAT_HEARTBEAT_MS 10000
+/* Clients repeat an unanswered registration with exponential backoff, but at
+ * least this often, so a server keeps a client waiting in its queue */
+#define CHAT_RETRY_MAX_MS 16000
+
+/* Client to server: REGISTER (payload name), DISCONNECT, MESSAGE (payload text).
+ * Server to client: WELCOME (sender is the own id, payload the own name),
+ * JOIN and LEAVE (sender and name of another client), MESSAGE (forwarded
+ * untouched with the id of its sender), NOTICE (server text), FULL (seq is the
+ * place in the waiting queue of the server, 0 if the client was not queued,
+ * "##" and the place in the text protocol), CLOSING.
+ * Both directions: ACK for reliable streams.
+ * Rooms: ROOM_JOIN and ROOM_LEAVE (payload room name) from the client,
+ * PUBLISH (payload room name length byte, room name, text) from the client
+ * and forwarded untouched with the id of its sender to the room.
+ * HEARTBEAT from the client only tells the server that it is still there. */
+enum ChatType {
+	CHAT_REGISTER = 1,
+	CHAT_DISCONNECT,
+	CHAT_MESSAGE,
+	CHAT_WELCOME,
+	CHAT_JOIN,
+	CHAT_LEAVE,
+	CHAT_NOTICE,
+	CHAT_FULL,
+	CHAT_CLOSING,
+	CHAT_ACK,
+	CHAT_ROOM_JOIN,
+	CHAT_ROOM_LEAVE,
+	CHAT_PUBLISH,
+	CHAT_HEARTBEAT,
+	CHAT_TYPES /* one more than the highest type */
+};
+
+/* Payload of a MESSAGE already starts with "[name] ", sent by a text client */
+#define CHAT_FLAG_FORMATTED 0x01
+/* Frame belongs to the reliable stream of a client, its seq is the stream
+ * position and the receiver answers with an ACK, see reliable.h */
+#define CHAT_FLAG_RELIABLE 0x02
+/* Set on REGISTER by a client which reads every frame of a datagram. The
+ * server may then pack several frames back to back into one datagram, each
+ * frame ends after its payload length, up to CHAT_COALESCE_MAX bytes. */
+#define CHAT_FLAG_COALESCE 0x04
+#define CHAT_COALESCE_MAX 1400 /* fits into one ethernet frame with ip and udp headers */
+/* MESSAGE sent before the client registered, replayed from the history of the server */
+#define CHAT_FLAG_HISTORY 0x08
+/* Set on REGISTER by a local client which maps the shared memory ring of the
+ * server. A server with a ring answers with the flag on the WELCOME, whose seq
+ * is then the ring position from which on the client reads the frames to all
+ * clients from the ring instead of its socket. */
+#define CHAT_FLAG_SHARED 0x10
+/* Set on REGISTER by a client which can decompress. The server may then send
+ * a long payload compressed, once for all of these clients, with the flag on
+ * the frame: 2 bytes length of the original payload followed by an LZ block,
+ * see lz.h. The payload length in the header is the compressed one. */
+#define CHAT_FLAG_COMPRESSED 0x20
+#define CHAT_COMPRESS_MIN 256 /* shorter payloads rarely get smaller */
+
+struct ChatHeader {
+	uint8_t version;
+	uint8_t type;
+	uint8_t flags;
+	uint32_t sender;
+	uint32_t seq;
+	uint16_t len;
+};
+
+/* Names of the other clients by sender id, learned from WELCOME and JOIN frames */
+struct ChatRoster {
+	char (*names)[CHAT_NAME_LEN + 1];
+	uint32_t capacity;
+};
+
+/**
+ * @brief Check if a datagram is a binary frame
+ * @param datagram
+ * @param datagram length
+ * @return 1 if the datagram starts with the magic byte
+ */
+int chat_is_frame(const void *buf, size_t n);
+
+/**
+ * @brief Write a frame header
+ * @param buffer of at least CHAT_HEADER_LEN bytes
+ * @param frame type
+ * @param flags
+ * @param sender id
+ * @param sequence number
+ * @param payload length
+ * @return CHAT_HEADER_LEN
+ */
+size_t chat_pack(void *buf, int type, int flags, uint32_t sender, uint32_t seq, uint16_t len);
+
+/**
+ * @brief Read and check a frame header
+ * @param datagram
+ * @param datagram length
+ * @param header
+ * @return pointer to the payload or NULL if the frame is invalid or truncated
+ */
+const char *chat_unpack(const void *buf, size_t n, struct ChatHeader *h);
+
+/**
+ * @brief Remember the name of a sender id
+ * @param roster
+ * @param sender id
+ * @param name, not zero terminated
+ * @param name length
+ * @return 0 on success, -1 if out of memory
+ */
+int chat_roster_set(struct ChatRoster *r, uint32_t id, const char *name, size_t len);
+
+/**
+ * @brief Name of a sender id
+ * @param roster
+ * @param sender id
+ * @return name, "?" if the id is unknown
+ */
+const char *chat_roster_get(const struct ChatRoster *r, uint32_t id);
+
+/**
+ * @brief Write the payload of a PUBLISH frame
+ * @param buffer
+ * @param buffer size
+ * @param room name, not zero terminated
+ * @param room name length, at most CHAT_ROOM_LEN
+ * @param text
+ * @param text length
+ * @return payload length or 0 if the room name is invalid or the text does not fit
+ */
+size_t chat_room_pack(char *buf, size_t size, const char *room, size_t room_len, const char *text, size_t len);
+
+/**
+ * @brief Split the payload of a PUBLISH frame
+ * @param payload
+ * @param payload length
+ * @param room name, not zero terminated
+ * @param room name length
+ * @param text length
+ * @return text or NULL if the payload is invalid
+ */
+const char *chat_room_unpack(const char *payload, size_t len, const char **room, size_t *room_len, size_t *text_len);
+
+/**
+ * @brief Parse a room command typed by the user: /join ROOM, /leave ROOM or /room ROOM TEXT
+ * @param zero terminated line
+ * @param room name, not zero terminated
+ * @param room name length
+ * @param text of /room, zero terminated
+ * @return CHAT_ROOM_JOIN, CHAT_ROOM_LEAVE, CHAT_PUBLISH or 0 if the line is no valid room command
+ */
+int chat_room_command(const char *line, const char **room, size_t *room_len, const char **text);
+
+/**
+ * @brief Update the roster from a received frame and render it as the text protocol would show it
+ * @param roster
+ * @param frame header
+ * @param payload
+ * @param output buffer
+ * @param size of the output buffer
+ * @return length of the zero terminated text or -1 if the frame has nothing to show
+ */
+int chat_render(struct ChatRoster *r, const struct ChatHeader *h, const char *payload, char *out, size_t outlen);
+
+/**
+ * @brief Compress a payload for a frame with CHAT_FLAG_COMPRESSED
+ * @param payload
+ * @param payload length
+ * @param output
+ * @param output size
+ * @return compressed length or 0 if the payload does not get smaller
+ */
+size_t chat_compress(const char *payload, size_t len, char *out, size_t size);
+
+/**
+ * @brief Restore the payload of a frame with CHAT_FLAG_COMPRESSED
+ * @param compressed payload
+ * @param compressed length
+ * @param output
+ * @param output size
+ * @return payload length or -1 if the payload is invalid or does not fit
+ */
+int chat_decompress(const char *payload, size_t len, char *out, size_t size);
+
+#endif
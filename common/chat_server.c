@@ -0,0 +1,1455 @@
+/**
+ * @file chat_server.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Clients, registration, expiry and request handlers shared by the chat servers of every transport
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include "chat_server.h"
+#include "log.h"
+#include "metrics.h"
+
+#define STDIN 0
+
+/* Idle clients found by one tick of the idle timers */
+struct IdleTick {
+	struct ChatServer *srv;
+	uint64_t now;
+	int n_dead;
+	int dead[CHAT_IDLE_MAX_EXPIRED];
+	struct ChatIdleTimer *timers[CHAT_IDLE_MAX_EXPIRED];
+};
+
+/* The client index, the admission queue and the metrics gauges have no
+ * context, they reach the one server of the process through this */
+static struct ChatServer *key_server;
+
+static void register_client(struct ChatContext *cx, const struct ChatRegistration *reg);
+
+/**
+ * @brief Key bytes of a registered client, taken from its address
+ * @param client handle
+ * @param key length
+ * @return key bytes
+ */
+static const void *client_key(int id, size_t *len) {
+	return key_server->transport->key(chat_server_addr(key_server, id), len);
+}
+
+/**
+ * @brief Key bytes of a waiting client, taken from its address
+ * @param slot of the admission queue
+ * @param key length
+ * @return key bytes
+ */
+static const void *waiting_key(int slot, size_t *len) {
+	return key_server->transport->key(&key_server->admission.slots[slot].addr, len);
+}
+
+void chat_server_defaults(struct ChatServer *s) {
+	memset(s, 0, sizeof(*s));
+	s->idle_timeout = CHAT_IDLE_DEFAULT_TIMEOUT;
+	s->history_replay = HISTORY_DEFAULT_REPLAY;
+	s->admission_len = ADMISSION_DEFAULT_LEN;
+	s->compress_min = CHAT_COMPRESS_MIN;
+	s->batch = RECV_RING_DEFAULT_BATCH;
+	s->ring_depth = RECV_RING_DEFAULT_DEPTH;
+	s->backend = EVENT_BACKEND_EPOLL;
+}
+
+int chat_server_option(struct ChatServer *s, int opt, const char *arg) {
+	switch (opt) {
+	case 'd':
+		log_debug = 1;
+		LOG_DEBUG("Debug mode enabled");
+		break;
+	case 'b':
+		s->batch = atoi(arg);
+		break;
+	case 'r':
+		s->ring_depth = atoi(arg);
+		break;
+	case 's':
+		s->stats_interval = atoi(arg);
+		break;
+	case 'u':
+		s->backend = EVENT_BACKEND_URING;
+		break;
+	case 'i':
+		s->idle_timeout = atoi(arg);
+		if (s->idle_timeout < 0) s->idle_timeout = 0;
+		break;
+	case 'H':
+		s->history_dir = arg;
+		break;
+	case 'n':
+		s->history_replay = atoi(arg);
+		break;
+	case 'l':
+		s->client_limit = strtoul(arg, NULL, 10);
+		break;
+	case 'L':
+		s->ingress_limit = strtoul(arg, NULL, 10);
+		break;
+	case 'm':
+		s->metrics_where = arg;
+		break;
+	case 'q':
+		s->admission_len = atoi(arg);
+		if (s->admission_len < 0) s->admission_len = 0;
+		break;
+	case 'z':
+		s->compress_min = atoi(arg);
+		if (s->compress_min < 0) s->compress_min = 0;
+		break;
+	default:
+		return -1;
+	}
+	return 0;
+}
+
+int chat_server_limit(struct ChatServer *s, int argc, char *argv[]) {
+	if (optind >= argc) return -1;
+	if (argc - optind > 1) LOG_ERROR("Too many arguments submitted");
+	s->max_clients = atoi(argv[optind]);
+	if (s->max_clients < 0) s->max_clients = 0;
+	if (s->max_clients)
+		LOG_INFO("%d-clients server started", s->max_clients);
+	else
+		LOG_INFO("Server started without client limit");
+	return 0;
+}
+
+/**
+ * @brief Run one command typed on the server console
+ * @param zero terminated command line
+ * @return void
+ */
+static void admin_command(char *line) {
+	chat_server_command(key_server->admin, line);
+	chat_context_done(key_server->admin);
+}
+
+/**
+ * @brief Event loop callback for the server console, runs every complete line
+ * @param event loop
+ * @param stdin
+ * @param unused
+ * @param unused
+ * @return void
+ */
+static void on_console(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	static struct ChatConsole console;
+	/* console closed, e.g. server runs in the background */
+	if (chat_console_read(&console, fd, admin_command) < 0)
+		event_loop_del(l, fd);
+}
+
+/**
+ * @brief Event loop callback for the periodic statistics timer
+ * @param event loop
+ * @param timerfd
+ * @param number of expirations
+ * @param server
+ * @return void
+ */
+static void on_stats_timer(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	chat_server_print_stats(ctx);
+}
+
+/**
+ * @brief Event loop callback for the idle tick, advances the coarse clock and the idle timers
+ * @param event loop
+ * @param timerfd
+ * @param number of expirations
+ * @param server
+ * @return void
+ */
+static void on_idle_tick(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	struct ChatServer *s = ctx;
+	chat_server_idle_tick(s->admin);
+	chat_context_done(s->admin);
+}
+
+/**
+ * @brief Event loop callback for SIGINT and SIGTERM, sends the closing message to all clients
+ * @param event loop
+ * @param signalfd
+ * @param signal number
+ * @param server
+ * @return void
+ */
+static void on_signal(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	struct ChatServer *s = ctx;
+	LOG_INFO("Got signal %lu, sending disconnect message to all clients", value);
+	int sent = chat_server_closing(s->admin);
+	chat_context_done(s->admin);
+	LOG_INFO("Sent disconnect message to %d clients", sent);
+	event_loop_stop(l);
+}
+
+int chat_server_init(struct ChatServer *s, const struct ChatTransport *t, const struct ChatServerOps *ops, size_t ext_size, int n_contexts) {
+	s->transport = t;
+	s->ops = ops;
+	key_server = s;
+	if (event_loop_init(&s->loop, s->backend) < 0) {
+		LOG_ERROR("Cant create the event loop");
+		return -1;
+	}
+	/* Str+C and kill arrive through a signalfd, this blocks both signals
+	 * before any worker starts, so only the event loop sees them */
+	int signals[] = {SIGINT, SIGTERM};
+	if (event_loop_add_signals(&s->loop, signals, 2, on_signal, s) < 0) {
+		LOG_ERROR("Cant watch SIGINT and SIGTERM");
+		return -1;
+	}
+	if (s->idle_timeout && event_loop_add_timer(&s->loop, CHAT_IDLE_TICK_MS, on_idle_tick, s) < 0) {
+		LOG_ERROR("Cant start the idle timer, idle clients are kept");
+		s->idle_timeout = 0;
+	}
+	pthread_rwlock_init(&s->lock, NULL);
+	pthread_mutex_init(&s->idle_lock, NULL);
+
+	// the client table grows with the clients up to the limit
+	size_t columns[CHAT_CLIENT_COLUMNS] = { t->addrlen, sizeof(uint8_t), sizeof(uint64_t), sizeof(uint64_t), sizeof(struct ChatServerClient), ext_size };
+	registry_init(&s->clients, columns, CHAT_CLIENT_COLUMNS, s->max_clients);
+	if (client_index_init(&s->index, REGISTRY_CHUNK, client_key) < 0) {
+		LOG_ERROR("Cant allocate client index");
+		return -1;
+	}
+	/* without a limit nobody has to wait */
+	if (admission_init(&s->admission, s->max_clients ? s->admission_len : 0, waiting_key) < 0) {
+		LOG_ERROR("Cant allocate the queue for %d waiting clients", s->admission_len);
+		return -1;
+	}
+	if (s->max_clients && s->admission_len) LOG_INFO("Up to %d clients wait for a place while the server is full", s->admission_len);
+	if (rooms_init(&s->rooms, ROOMS_DEFAULT_MAX, ROOMS_DEFAULT_MEMBERSHIPS, REGISTRY_CHUNK) < 0) {
+		LOG_ERROR("Cant allocate the index for %d rooms", ROOMS_DEFAULT_MAX);
+		return -1;
+	}
+
+	s->coarse_ms = now_ms();
+	timer_wheel_init(&s->idle_wheel, CHAT_IDLE_TICK_MS, s->coarse_ms);
+	if (s->idle_timeout) LOG_INFO("Clients silent for %d seconds are removed", s->idle_timeout);
+	token_rate_init(&s->client_rate, s->client_limit, s->client_limit * CHAT_RATE_BURST_SECONDS);
+	/* every context gets its share of the server limit, rounded up, a client always goes to the same context */
+	unsigned long share = (s->ingress_limit + n_contexts - 1) / n_contexts;
+	token_rate_init(&s->ingress_rate, share, share * CHAT_RATE_BURST_SECONDS);
+	if (s->client_limit) LOG_INFO("Clients may send %lu messages per second", s->client_limit);
+	if (s->ingress_limit) LOG_INFO("All clients together may send %lu messages per second", s->ingress_limit);
+	if (s->compress_min) LOG_INFO("Payloads of %d bytes and more are compressed for the clients which ask for it", s->compress_min);
+	if (s->history_dir && history_open(&s->history, s->history_dir, s->history_replay) < 0) {
+		LOG_ERROR("Cant open the history in %s", s->history_dir);
+		return -1;
+	}
+	return 0;
+}
+
+int chat_server_start(struct ChatServer *s, struct ChatContext *admin) {
+	s->admin = admin;
+	if (event_loop_add(&s->loop, STDIN, on_console, NULL) < 0)
+		LOG_INFO("Console cant be watched, admin commands are disabled");
+	if (s->stats_interval > 0 && event_loop_add_timer(&s->loop, s->stats_interval * 1000, on_stats_timer, s) < 0)
+		LOG_ERROR("Cant start the stats timer");
+	if (s->metrics_where) {
+		if (metrics_serve(s->metrics_where, chat_server_gauges) < 0) {
+			LOG_ERROR("Cant serve the metrics on %s", s->metrics_where);
+			return -1;
+		}
+		LOG_INFO("Metrics are served on %s", s->metrics_where);
+	}
+	return 0;
+}
+
+int chat_server_run(struct ChatServer *s) {
+	LOG_INFO("Event loop uses %s, type help for admin commands", event_loop_backend(&s->loop));
+	int ret = event_loop_run(&s->loop);
+	return __atomic_load_n(&s->failed, __ATOMIC_ACQUIRE) ? -1 : ret;
+}
+
+void chat_server_shutdown(struct ChatServer *s) {
+	__atomic_store_n(&s->failed, true, __ATOMIC_RELEASE);
+	/* the signalfd of the event loop picks it up like Str+C, the clients get
+	 * the closing message and chat_server_run returns on the main thread */
+	kill(getpid(), SIGINT);
+}
+
+/**
+ * @brief Log the messages dropped by the rate limits
+ * @param server
+ * @return void
+ */
+static void print_rate_stats(struct ChatServer *s) {
+	unsigned long by_client = 0, by_server = 0;
+	if (!s->client_rate.interval_us && !s->ingress_rate.interval_us) return;
+	for (struct ChatContext *cx = s->contexts; cx; cx = cx->next) {
+		by_client += __atomic_load_n(&cx->limited_client, __ATOMIC_RELAXED);
+		by_server += __atomic_load_n(&cx->limited_ingress, __ATOMIC_RELAXED);
+	}
+	LOG_INFO("Rate limits dropped %lu messages of single clients and %lu over the server limit", by_client, by_server);
+}
+
+void chat_server_close(struct ChatServer *s) {
+	print_rate_stats(s);
+	admission_print_stats(&s->admission);
+	history_print_stats(&s->history);
+	history_close(&s->history);
+	metrics_print_stats();
+	metrics_close();
+}
+
+int chat_context_init(struct ChatContext *cx, struct ChatServer *s, int sock, size_t arena_bytes) {
+	memset(cx, 0, sizeof(*cx));
+	cx->srv = s;
+	cx->sock = sock;
+	if (arena_init(&cx->arena, arena_bytes) < 0 || broadcast_init(&cx->bcast, REGISTRY_CHUNK, s->transport->addrlen) < 0) return -1;
+	cx->next = s->contexts;
+	s->contexts = cx;
+	return 0;
+}
+
+int chat_context_receive(struct ChatContext *cx, struct RecvRing *ring) {
+	char peer[TRANSPORT_NAME_LEN];
+	struct ChatServer *s = cx->srv;
+	int first;
+	uint64_t bytes = 0;
+	int n = recv_ring_fill(ring, s->transport, cx->sock, &first);
+	if (n <= 0) return n;
+	cx->recv_ns = now_ns();
+	cx->now_us = cx->recv_ns / 1000;
+	LOG_DEBUG("Wakeup picked up %d datagrams", n);
+	metrics_add(METRIC_RX_DATAGRAMS, n);
+
+	for (int k = first; k < first + n; k++) {
+		struct RecvSlot *slot = &ring->slots[k];
+		// Print sender information if debug is on
+		if (LOG_DEBUG_ENABLED) s->transport->format(&slot->addr, peer, sizeof(peer));
+		LOG_DEBUG("Sender information %d, %s, %d", slot->addr.ss_family, peer, slot->addrlen);
+		bytes += slot->len;
+		/* the handlers check the sender against the process which registered the client */
+		if (ring->control) cx->cred = &slot->cred;
+		chat_server_handle(cx, slot->buf, slot->len, &slot->addr, slot->addrlen);
+	}
+	cx->cred = NULL;
+	metrics_add(METRIC_RX_BYTES, bytes);
+	return n;
+}
+
+void chat_context_done(struct ChatContext *cx) {
+	if (cx->srv->ops->batch_end) cx->srv->ops->batch_end(cx);
+	arena_reset(&cx->arena);
+}
+
+void chat_context_print_stats(const struct ChatContext *cx) {
+	const struct ChatCompress *z = &cx->z;
+	arena_print_stats(&cx->arena);
+	if (!z->payloads && !z->skipped) return;
+	LOG_INFO("Compressed %lu payloads from %lu to %lu bytes (%.1f%%), %lu did not get smaller", z->payloads,
+		(unsigned long)z->plain_bytes, (unsigned long)z->compressed_bytes,
+		z->plain_bytes ? 100.0 * z->compressed_bytes / z->plain_bytes : 0.0, z->skipped);
+}
+
+size_t chat_context_compress(struct ChatContext *cx, const char *payload, size_t len) {
+	struct ChatServer *s = cx->srv;
+	struct ChatCompress *z = &cx->z;
+	if (!s->compress_min || len < (size_t)s->compress_min || !__atomic_load_n(&s->compress_clients, __ATOMIC_RELAXED)) return 0;
+	size_t zlen = chat_compress(payload, len, z->buf, sizeof(z->buf));
+	if (!zlen) {
+		z->skipped++;
+		return 0;
+	}
+	z->payloads++;
+	z->plain_bytes += len;
+	z->compressed_bytes += zlen;
+	return zlen;
+}
+
+struct ChatServerClient *chat_server_client(struct ChatServer *s, int id) {
+	return registry_get(&s->clients, CHAT_CLIENT_INFO, id);
+}
+
+void *chat_server_addr(struct ChatServer *s, int id) {
+	return registry_get(&s->clients, CHAT_CLIENT_ADDR, id);
+}
+
+uint8_t chat_server_state(struct ChatServer *s, int id) {
+	return *(uint8_t *)registry_get(&s->clients, CHAT_CLIENT_STATE, id);
+}
+
+void *chat_server_ext(struct ChatServer *s, int id) {
+	return registry_get(&s->clients, CHAT_CLIENT_EXT, id);
+}
+
+void chat_server_seen(struct ChatServer *s, int id) {
+	__atomic_store_n((uint64_t *)registry_get(&s->clients, CHAT_CLIENT_SEEN, id), __atomic_load_n(&s->coarse_ms, __ATOMIC_RELAXED),
+		__ATOMIC_RELAXED);
+}
+
+int chat_server_find(struct ChatContext *cx, const void *addr) {
+	struct ChatServer *s = cx->srv;
+	int id = chat_client_find(&s->index, s->transport, addr);
+	/* another process using the address of a client, e.g. through an inherited socket, is not that client */
+	if (id >= 0 && s->ops->verify && !s->ops->verify(cx, id)) return -1;
+	return id;
+}
+
+int chat_server_audience(struct ChatServer *s, const char *room, size_t room_len, int *room_id) {
+	if (!room) {
+		*room_id = -1;
+		return s->clients.count;
+	}
+	*room_id = rooms_find(&s->rooms, room, room_len);
+	return *room_id < 0 ? 0 : (int)s->rooms.rooms[*room_id].count;
+}
+
+int chat_server_audience_pos(struct ChatServer *s, int room_id, int k, int *id) {
+	if (room_id < 0) {
+		*id = registry_handle_at(&s->clients, k);
+		return k;
+	}
+	const struct Room *room = &s->rooms.rooms[room_id];
+	*id = room->members[k].client;
+	/* room members are scattered over the registry, fetch the position of a member
+	 * far ahead and the address of a member whose position is already cached */
+	if (k + 2 * CHAT_SERVER_FANOUT_PREFETCH < (int)room->count)
+		__builtin_prefetch(&s->clients.slots[room->members[k + 2 * CHAT_SERVER_FANOUT_PREFETCH].client]);
+	if (k + CHAT_SERVER_FANOUT_PREFETCH < (int)room->count) {
+		int ahead = registry_pos(&s->clients, room->members[k + CHAT_SERVER_FANOUT_PREFETCH].client);
+		__builtin_prefetch(registry_at(&s->clients, CHAT_CLIENT_ADDR, ahead));
+		__builtin_prefetch(registry_at(&s->clients, CHAT_CLIENT_STATE, ahead));
+	}
+	return registry_pos(&s->clients, *id);
+}
+
+/**
+ * @brief Report the per client result of the last fan-out
+ * @param context which sent the broadcast
+ * @param broadcast vector which was sent
+ * @return void
+ */
+static void report_broadcast(struct ChatContext *cx, struct Broadcast *b) {
+	char peer[TRANSPORT_NAME_LEN];
+	const struct ChatTransport *t = cx->srv->transport;
+	/* the last iovec is the payload, frames carry the header in front */
+	struct iovec *payload = &b->iov[b->iovlen - 1];
+	for (int k = 0; k < b->len; k++) {
+		int i = b->targets[k];
+		if (b->result[k] < 0) {
+			LOG_ERROR("Sending message to client %d (%s) failed: %s", i+1, t->format(broadcast_addr(b, k), peer, sizeof(peer)),
+				strerror(-b->result[k]));
+		} else if (LOG_DEBUG_ENABLED) {
+			LOG_DEBUG("Sending %s to client %d of %d. Target: %s: Message \"%.*s\"", b->iovlen > 1 ? "frame" : "message",
+				i+1, b->len, t->format(broadcast_addr(b, k), peer, sizeof(peer)), (int)payload->iov_len, (char *)payload->iov_base);
+		}
+	}
+}
+
+int chat_server_fanout(struct ChatContext *cx, uint8_t want, uint8_t mask, int except, const char *room, size_t room_len) {
+	struct ChatServer *s = cx->srv;
+	struct Broadcast *b = &cx->bcast;
+	int room_id;
+	pthread_rwlock_rdlock(&s->lock);
+	int count = chat_server_audience(s, room, room_len, &room_id);
+	if (chat_server_reserve(b, count) < 0) count = b->capacity;
+	/* only the address and state columns are read */
+	const char *addrs = registry_column(&s->clients, CHAT_CLIENT_ADDR);
+	const uint8_t *state = registry_column(&s->clients, CHAT_CLIENT_STATE);
+	for (int k = 0; k < count; k++) {
+		int i, pos = chat_server_audience_pos(s, room_id, k, &i);
+		if ((state[pos] & mask) != want || i == except) continue;
+		broadcast_add(b, addrs + (size_t)pos * s->transport->addrlen, i);
+	}
+	pthread_rwlock_unlock(&s->lock);
+	return chat_server_broadcast(cx, b);
+}
+
+int chat_server_reserve(struct Broadcast *b, int count) {
+	/* grow in whole registry chunks, like the registry itself */
+	if (broadcast_reserve(b, (count + REGISTRY_CHUNK - 1) / REGISTRY_CHUNK * REGISTRY_CHUNK) < 0) {
+		LOG_ERROR("Cant grow the broadcast vector to %d clients", count);
+		return -1;
+	}
+	return 0;
+}
+
+int chat_server_broadcast(struct ChatContext *cx, struct Broadcast *b) {
+	if (!b->len) return 0;
+	int sent = broadcast_flush(b, cx->srv->transport, cx->sock);
+	size_t bytes = 0;
+	for (int j = 0; j < b->iovlen; j++)
+		bytes += b->iov[j].iov_len;
+	/* counted once per fan-out, not per client */
+	metrics_add(METRIC_TX_DATAGRAMS, sent);
+	metrics_add(METRIC_TX_BYTES, (uint64_t)sent * bytes);
+	metrics_add(METRIC_SEND_ERRORS, b->len - sent);
+	report_broadcast(cx, b);
+	return sent;
+}
+
+uint32_t chat_server_next_seq(struct ChatServer *s) {
+	return __atomic_add_fetch(&s->seq, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Send one message through the transport of the server
+ * @param context whose socket is used
+ * @param message with its address
+ * @return void
+ */
+static void send_one(struct ChatContext *cx, struct msghdr *msg) {
+	struct mmsghdr m = { .msg_hdr = *msg };
+	metrics_sent(cx->srv->transport->send(cx->sock, &m, 1) == 1 ? (ssize_t)m.msg_len : -1);
+}
+
+/**
+ * @brief Send one datagram to a single address
+ * @param context whose socket is used
+ * @param address
+ * @param address length
+ * @param datagram
+ * @param datagram length
+ * @return void
+ */
+static void send_datagram(struct ChatContext *cx, const void *addr, socklen_t addrlen, const char *data, size_t len) {
+	struct iovec iov = { (void *)data, len };
+	struct msghdr msg = {
+		.msg_name = (void *)addr,
+		.msg_namelen = addrlen,
+		.msg_iov = &iov,
+		.msg_iovlen = 1
+	};
+	send_one(cx, &msg);
+}
+
+/**
+ * @brief Send one frame to a single address
+ * @param context whose socket is used
+ * @param address
+ * @param address length
+ * @param frame type
+ * @param frame flags
+ * @param sender id
+ * @param sequence number
+ * @param payload
+ * @param payload length
+ * @return void
+ */
+static void send_frame(struct ChatContext *cx, const void *addr, socklen_t addrlen, int type, int flags, uint32_t sender, uint32_t seq,
+		const char *payload, size_t len) {
+	char header[CHAT_HEADER_LEN];
+	struct iovec iov[2] = {
+		{ header, chat_pack(header, type, flags, sender, seq, len) },
+		{ (void *)payload, len }
+	};
+	struct msghdr msg = {
+		.msg_name = (void *)addr,
+		.msg_namelen = addrlen,
+		.msg_iov = iov,
+		.msg_iovlen = 2
+	};
+	send_one(cx, &msg);
+}
+
+/**
+ * @brief Send one frame with given flags and sequence number to a registered client, in its stream if it has one.
+ * The registry lock must be held.
+ * @param context whose socket is used
+ * @param client handle
+ * @param frame type
+ * @param frame flags
+ * @param sender id
+ * @param sequence number, only used outside of a stream
+ * @param payload
+ * @param payload length
+ * @return void
+ */
+static void client_frame_seq(struct ChatContext *cx, int id, int type, int flags, uint32_t sender, uint32_t seq,
+		const char *payload, size_t len) {
+	struct ChatServer *s = cx->srv;
+	if (s->ops->unicast && s->ops->unicast(cx, id, type, flags, sender, payload, len)) return;
+	send_frame(cx, chat_server_addr(s, id), s->transport->addrlen, type, flags, sender, seq, payload, len);
+}
+
+/**
+ * @brief Send one frame to a registered client, the registry lock must be held
+ * @param context whose socket is used
+ * @param client handle
+ * @param frame type
+ * @param sender id
+ * @param payload
+ * @param payload length
+ * @return void
+ */
+static void client_frame(struct ChatContext *cx, int id, int type, uint32_t sender, const char *payload, size_t len) {
+	client_frame_seq(cx, id, type, 0, sender, chat_server_next_seq(cx->srv), payload, len);
+}
+
+/**
+ * @brief Send a server notice to a single client in its protocol
+ * @param context whose socket is used
+ * @param client handle
+ * @param zero terminated notice without the server prefix
+ * @return void
+ */
+static void client_notice(struct ChatContext *cx, int id, const char *notice) {
+	struct ChatServer *s = cx->srv;
+	pthread_rwlock_rdlock(&s->lock);
+	if (!chat_server_client(s, id)) {
+		pthread_rwlock_unlock(&s->lock);
+		return;
+	}
+	if (chat_server_state(s, id) & CHAT_CLIENT_BINARY) {
+		client_frame(cx, id, CHAT_NOTICE, CHAT_SENDER_SERVER, notice, strlen(notice));
+	} else {
+		size_t len;
+		char *text = arena_format(&cx->arena, &len, CHAT_SERVER_PREFIX "%s", notice);
+		if (text) send_datagram(cx, chat_server_addr(s, id), s->transport->addrlen, text, len);
+	}
+	pthread_rwlock_unlock(&s->lock);
+}
+
+/**
+ * @brief Send the last messages to all clients to a client which just registered, the registry lock must be held
+ * @param context whose socket is used
+ * @param client handle
+ * @return void
+ */
+static void replay_history(struct ChatContext *cx, int id) {
+	struct ChatServer *s = cx->srv;
+	size_t len;
+	int count;
+	if (!s->history_dir) return;
+	char *tail = history_tail(&s->history, s->history_replay, &len, &count);
+	if (!tail) return;
+	char *out = malloc(len);
+	struct iovec *iov = malloc(count * sizeof(*iov));
+	struct mmsghdr *msgs = calloc(count, sizeof(*msgs));
+	if (!out || !iov || !msgs) {
+		LOG_ERROR("Cant allocate the replay of %d messages", count);
+		goto out;
+	}
+	uint8_t state = chat_server_state(s, id);
+	int n = history_render(tail, len, state & CHAT_CLIENT_BINARY, state & CHAT_CLIENT_COALESCE ? CHAT_COALESCE_MAX : 0, out, iov);
+	if ((state & CHAT_CLIENT_RELIABLE) && s->ops->unicast) {
+		/* reliable clients get the messages in their stream, one frame each */
+		for (int k = 0; k < n; k++) {
+			struct ChatHeader h;
+			const char *payload = chat_unpack(iov[k].iov_base, iov[k].iov_len, &h);
+			if (!payload || !s->ops->unicast(cx, id, h.type, h.flags, h.sender, payload, h.len)) break;
+		}
+		goto out;
+	}
+	/* one frame or one packed datagram each, the clients read every datagram on its own */
+	for (int k = 0; k < n; k++) {
+		msgs[k].msg_hdr.msg_name = chat_server_addr(s, id);
+		msgs[k].msg_hdr.msg_namelen = s->transport->addrlen;
+		msgs[k].msg_hdr.msg_iov = &iov[k];
+		msgs[k].msg_hdr.msg_iovlen = 1;
+	}
+	for (int k = 0, sent; k < n; k += sent) {
+		if ((sent = s->transport->send(cx->sock, msgs + k, n - k)) <= 0) {
+			LOG_DEBUG("Replaying the history failed: %s", strerror(errno));
+			metrics_sent(-1);
+			break;
+		}
+		for (int j = k; j < k + sent; j++)
+			metrics_sent(msgs[j].msg_len);
+	}
+	LOG_DEBUG("Replayed %d messages in %d datagrams", count, n);
+out:
+	free(msgs);
+	free(iov);
+	free(out);
+	free(tail);
+}
+
+/**
+ * @brief Tell a client that the server is full
+ * @param context whose socket is used
+ * @param registration of the client
+ * @param place in the admission queue, 0 if the client was rejected
+ * @return void
+ */
+static void send_full(struct ChatContext *cx, const struct ChatRegistration *reg, uint32_t place) {
+	char reject[CHAT_HEADER_LEN + 16];
+	size_t len;
+	if (reg->binary) {
+		len = chat_pack(reject, CHAT_FULL, 0, CHAT_SENDER_SERVER, place, 0);
+	} else {
+		/* old text clients only look at the "##" */
+		len = place ? (size_t)snprintf(reject, sizeof(reject), "##%u", place) : strlen(strcpy(reject, "##"));
+	}
+	send_datagram(cx, reg->addr, reg->addrlen, reject, len);
+}
+
+/**
+ * @brief State of a new client, what it asked for as far as the server offers it
+ * @param server
+ * @param registration of the client
+ * @return CHAT_CLIENT_ flags
+ */
+static uint8_t client_state(const struct ChatServer *s, const struct ChatRegistration *reg) {
+	if (!reg->binary) return 0;
+	uint8_t state = CHAT_CLIENT_BINARY;
+	if (reg->flags & CHAT_FLAG_RELIABLE) state |= CHAT_CLIENT_RELIABLE & s->features;
+	/* reliable clients get every frame in their stream, never packed */
+	if ((reg->flags & CHAT_FLAG_COALESCE) && !(state & CHAT_CLIENT_RELIABLE)) state |= CHAT_CLIENT_COALESCE & s->features;
+	if (reg->flags & CHAT_FLAG_SHARED) state |= CHAT_CLIENT_SHARED & s->features;
+	if ((reg->flags & CHAT_FLAG_COMPRESSED) && s->compress_min) state |= CHAT_CLIENT_COMPRESS;
+	return state;
+}
+
+/**
+ * @brief Queue a client which found the server full, or reject it if the queue is full as well.
+ * The registry lock must be held exclusively, it is released.
+ * @param context whose socket is used
+ * @param registration of the client
+ * @param key bytes of its address
+ * @param key length
+ * @return void
+ */
+static void queue_client(struct ChatContext *cx, const struct ChatRegistration *reg, const void *key, size_t key_len) {
+	struct ChatServer *s = cx->srv;
+	/* a waiting client which registers again keeps its place */
+	struct AdmissionEntry waiting = {
+		.addrlen = reg->addrlen,
+		.name_len = reg->name_len,
+		.binary = reg->binary,
+		.flags = reg->flags & (CHAT_FLAG_RELIABLE | CHAT_FLAG_COALESCE | CHAT_FLAG_SHARED | CHAT_FLAG_COMPRESSED),
+		.seq = reg->seq
+	};
+	memcpy(&waiting.addr, reg->addr, reg->addrlen);
+	memcpy(waiting.name, reg->name, reg->name_len);
+	if (reg->cred) waiting.cred = *reg->cred;
+	uint32_t place = admission_push(&s->admission, key, key_len, &waiting, now_ms());
+	pthread_rwlock_unlock(&s->lock);
+	if (!place) metrics_add(METRIC_REJECTS, 1);
+	send_full(cx, reg, place);
+}
+
+/**
+ * @brief Register a new client or queue it if the server is full
+ * @param context which received the registration
+ * @param registration
+ * @return void
+ */
+static void register_client(struct ChatContext *cx, const struct ChatRegistration *reg) {
+	struct ChatServer *s = cx->srv;
+	const struct ChatServerOps *ops = s->ops;
+	char name[CHAT_CLIENT_NAME_LEN + 1];
+	size_t name_len, len, cli_len = reg->name_len > CHAT_NAME_LEN ? CHAT_NAME_LEN : reg->name_len;
+	struct ChatIdleTimer *idle = NULL;
+
+	if (s->idle_timeout && !(idle = calloc(1, sizeof(*idle)))) {
+		LOG_ERROR("Cant allocate idle timer");
+		return;
+	}
+	LOG_INFO("New client [%.*s] registering...", (int)cli_len, reg->name);
+	/* held frames were meant for the clients registered before */
+	if (ops->flush) ops->flush(cx);
+
+	pthread_rwlock_wrlock(&s->lock);
+	// client is already registred TOFIX: other chat windows dies
+	/* a client which cant be answered, e.g. an unbound unix socket, is not registered either */
+	if (chat_client_find(&s->index, s->transport, reg->addr) >= 0 || !s->transport->reachable(reg->addr)) {
+		pthread_rwlock_unlock(&s->lock);
+		free(idle);
+		return;
+	}
+
+	/* a place goes to the queue as soon as it frees, so a free place means nobody waits */
+	size_t key_len;
+	const void *key = s->transport->key(reg->addr, &key_len);
+	int i = registry_add(&s->clients);
+	struct ChatServerClient *c = chat_server_client(s, i);
+	if (c) {
+		memcpy(chat_server_addr(s, i), reg->addr, s->transport->addrlen);
+		if (client_index_insert(&s->index, key, key_len, i) < 0) {
+			registry_remove(&s->clients, i);
+			c = NULL;
+		}
+	}
+	if (!c) {
+		free(idle);
+		queue_client(cx, reg, key, key_len);
+		return;
+	}
+	uint8_t state = client_state(s, reg);
+	*(uint8_t *)registry_get(&s->clients, CHAT_CLIENT_STATE, i) = state;
+	snprintf(c->name, sizeof(c->name), "%.*s", (int)cli_len, reg->name);
+	c->name_len = c->tag_len = strlen(c->name);
+	/* the server may still turn the client away, e.g. a user which has too many clients */
+	if (ops->attach && ops->attach(cx, i, reg) < 0) {
+		client_index_remove(&s->index, key, key_len);
+		registry_remove(&s->clients, i);
+		pthread_rwlock_unlock(&s->lock);
+		free(idle);
+		metrics_add(METRIC_REJECTS, 1);
+		send_full(cx, reg, 0);
+		return;
+	}
+	/* the client got a place without waiting for it, e.g. its retry came before the promotion */
+	admission_cancel(&s->admission, key, key_len);
+	LOG_DEBUG("Client registered with handle %d, %u clients", i, s->clients.count);
+	metrics_add(METRIC_REGISTRATIONS, 1);
+	if (state & CHAT_CLIENT_COMPRESS) __atomic_add_fetch(&s->compress_clients, 1, __ATOMIC_RELAXED);
+	memcpy(name, c->name, c->name_len + 1);
+	name_len = c->name_len;
+	chat_server_seen(s, i);
+	if (idle) {
+		idle->id = i;
+		c->idle = idle;
+		pthread_mutex_lock(&s->idle_lock);
+		timer_wheel_add(&s->idle_wheel, &idle->timer, s->coarse_ms + s->idle_timeout * 1000ull);
+		pthread_mutex_unlock(&s->idle_lock);
+	}
+
+	/* send connect message to connecting client, still under the exclusive lock,
+	 * so the handle cant be given to another client before the roster is out */
+	if (state & CHAT_CLIENT_BINARY) {
+		/* the own id first, then the names of all other clients */
+		int flags = 0;
+		uint32_t seq = chat_server_next_seq(s);
+		if (ops->welcome) ops->welcome(cx, i, &flags, &seq);
+		client_frame_seq(cx, i, CHAT_WELCOME, flags, i, seq, name, name_len);
+		for (uint32_t k = 0; k < s->clients.count; k++) {
+			int j = registry_handle_at(&s->clients, k);
+			struct ChatServerClient *other = registry_at(&s->clients, CHAT_CLIENT_INFO, k);
+			if (j == i) continue;
+			client_frame(cx, i, CHAT_JOIN, j, other->name, other->name_len);
+		}
+	} else {
+		const char *connected = CHAT_SERVER_PREFIX "Successfully registered to the server";
+		send_datagram(cx, reg->addr, reg->addrlen, connected, strlen(connected));
+	}
+	/* the roster is complete, the history comes before anything new */
+	replay_history(cx, i);
+	pthread_rwlock_unlock(&s->lock);
+
+	/* Sending connect message to all clients except the registring client */
+	char *joined = arena_format(&cx->arena, &len, CHAT_SERVER_PREFIX "\"%s\" joined the server", name);
+	ops->notify(cx, NULL, 0, joined, len, CHAT_JOIN, 0, i, chat_server_next_seq(s), name, name_len, i);
+	LOG_INFO("Client %s succesfully registered to the server%s", name, state & CHAT_CLIENT_RELIABLE ? " with a reliable stream" : "");
+}
+
+/**
+ * @brief Give free places to the clients which wait longest, called after a client left
+ * @param context whose socket is used
+ * @return void
+ */
+static void admit_waiting(struct ChatContext *cx) {
+	struct ChatServer *s = cx->srv;
+	struct AdmissionEntry e;
+	/* bounded, a client whose registration fails again is queued again */
+	for (uint32_t n = 0; n < s->admission.capacity; n++) {
+		pthread_rwlock_wrlock(&s->lock);
+		bool place = !s->clients.limit || s->clients.count < s->clients.limit;
+		int got = place ? admission_pop(&s->admission, &e, now_ms()) : -1;
+		pthread_rwlock_unlock(&s->lock);
+		if (got < 0) return;
+		LOG_INFO("Client [%s] got a place after waiting", e.name);
+		struct ChatRegistration reg = { e.name, e.name_len, e.binary, e.flags, e.seq, &e.addr, e.addrlen, e.cred.pid ? &e.cred : NULL };
+		register_client(cx, &reg);
+	}
+}
+
+void chat_server_remove(struct ChatServer *s, int id) {
+	struct ChatServerClient *c = chat_server_client(s, id);
+	rooms_leave_all(&s->rooms, id);
+	if (s->ops->detach) s->ops->detach(s, id);
+	if (c->idle) {
+		pthread_mutex_lock(&s->idle_lock);
+		timer_wheel_del(&s->idle_wheel, &c->idle->timer);
+		pthread_mutex_unlock(&s->idle_lock);
+		free(c->idle);
+	}
+	size_t key_len;
+	const void *key = client_key(id, &key_len);
+	client_index_remove(&s->index, key, key_len);
+	if (chat_server_state(s, id) & CHAT_CLIENT_COMPRESS) __atomic_sub_fetch(&s->compress_clients, 1, __ATOMIC_RELAXED);
+	/* the last client moves into the freed place */
+	registry_remove(&s->clients, id);
+	metrics_add(METRIC_DISCONNECTS, 1);
+}
+
+void chat_server_left(struct ChatContext *cx, int id, const char *name, size_t name_len) {
+	size_t len;
+	char *disc = arena_format(&cx->arena, &len, CHAT_SERVER_PREFIX "\"%s\" disconnected from the server", name);
+	cx->srv->ops->notify(cx, NULL, 0, disc, len, CHAT_LEAVE, 0, id, chat_server_next_seq(cx->srv), name, name_len, -1);
+	admit_waiting(cx);
+}
+
+/**
+ * @brief Disconnect a client on its request
+ * @param context which received the request
+ * @param address of the client
+ * @return void
+ */
+static void disconnect_client(struct ChatContext *cx, const void *addr) {
+	struct ChatServer *s = cx->srv;
+	char peer[TRANSPORT_NAME_LEN];
+	char name[CHAT_CLIENT_NAME_LEN + 1];
+	size_t name_len;
+
+	/* the held frames still reach the client */
+	if (s->ops->flush) s->ops->flush(cx);
+	pthread_rwlock_wrlock(&s->lock);
+	int pos = chat_server_find(cx, addr);
+	if (pos < 0) {
+		/* a waiting client gave up */
+		size_t key_len;
+		const void *key = s->transport->key(addr, &key_len);
+		bool waiting = admission_cancel(&s->admission, key, key_len);
+		pthread_rwlock_unlock(&s->lock);
+		if (waiting) LOG_INFO("Client at %s stopped waiting for a place", s->transport->format(addr, peer, sizeof(peer)));
+		else LOG_DEBUG("Unregistred client tried to disconnect");
+		return;
+	}
+	memcpy(name, chat_server_client(s, pos)->name, chat_server_client(s, pos)->name_len + 1);
+	name_len = chat_server_client(s, pos)->name_len;
+	chat_server_remove(s, pos);
+	pthread_rwlock_unlock(&s->lock);
+
+	LOG_INFO("Client %s at %s successfully disconnected", name, s->transport->format(addr, peer, sizeof(peer)));
+	/* Send disconnect message to every user */
+	chat_server_left(cx, pos, name, name_len);
+}
+
+/**
+ * @brief Remove a client which sent nothing for the idle timeout
+ * @param context whose socket is used
+ * @param client handle
+ * @param idle timer which found the client idle
+ * @param current time in milliseconds
+ * @return void
+ */
+static void expire_idle_client(struct ChatContext *cx, int pos, struct ChatIdleTimer *t, uint64_t now) {
+	struct ChatServer *s = cx->srv;
+	char name[CHAT_CLIENT_NAME_LEN + 1];
+	size_t name_len;
+
+	pthread_rwlock_wrlock(&s->lock);
+	/* the client may have left or sent something in the meantime */
+	if (!chat_server_client(s, pos) || chat_server_client(s, pos)->idle != t ||
+			*(uint64_t *)registry_get(&s->clients, CHAT_CLIENT_SEEN, pos) + s->idle_timeout * 1000ull > now) {
+		pthread_rwlock_unlock(&s->lock);
+		return;
+	}
+	memcpy(name, chat_server_client(s, pos)->name, chat_server_client(s, pos)->name_len + 1);
+	name_len = chat_server_client(s, pos)->name_len;
+	chat_server_remove(s, pos);
+	s->idle_expired++;
+	pthread_rwlock_unlock(&s->lock);
+
+	LOG_INFO("Client %s sent nothing for %d seconds and was removed", name, s->idle_timeout);
+	chat_server_left(cx, pos, name, name_len);
+}
+
+/**
+ * @brief Check a client whose idle timer ran out, called by the timer wheel with the registry lock and idle_lock held
+ * @param timer of the client
+ * @param tick collecting idle clients
+ * @return void
+ */
+static void on_idle_timer(struct TimerEntry *t, void *ctx) {
+	struct ChatIdleTimer *idle = (struct ChatIdleTimer *)((char *)t - offsetof(struct ChatIdleTimer, timer));
+	struct IdleTick *tick = ctx;
+	struct ChatServer *s = tick->srv;
+	uint64_t seen = __atomic_load_n((uint64_t *)registry_get(&s->clients, CHAT_CLIENT_SEEN, idle->id), __ATOMIC_RELAXED);
+	uint64_t expires = seen + s->idle_timeout * 1000ull;
+	/* the timer is only moved when it runs out, not for every message */
+	if (expires > tick->now) {
+		timer_wheel_add(&s->idle_wheel, t, expires);
+		return;
+	}
+	if (tick->n_dead < CHAT_IDLE_MAX_EXPIRED) {
+		tick->dead[tick->n_dead] = idle->id;
+		tick->timers[tick->n_dead++] = idle;
+	}
+	/* picked up again by the next tick if this one is full */
+	timer_wheel_add(&s->idle_wheel, t, tick->now + CHAT_IDLE_TICK_MS);
+}
+
+void chat_server_idle_tick(struct ChatContext *cx) {
+	struct ChatServer *s = cx->srv;
+	struct IdleTick tick = { .srv = s, .now = now_ms() };
+	__atomic_store_n(&s->coarse_ms, tick.now, __ATOMIC_RELAXED);
+	pthread_rwlock_rdlock(&s->lock);
+	pthread_mutex_lock(&s->idle_lock);
+	timer_wheel_advance(&s->idle_wheel, tick.now, on_idle_timer, &tick);
+	pthread_mutex_unlock(&s->idle_lock);
+	pthread_rwlock_unlock(&s->lock);
+	for (int k = 0; k < tick.n_dead; k++)
+		expire_idle_client(cx, tick.dead[k], tick.timers[k], tick.now);
+}
+
+/**
+ * @brief Keep a registered client from expiring, it sends nothing else
+ * @param context which received the heartbeat
+ * @param address of the client
+ * @return void
+ */
+static void heartbeat(struct ChatContext *cx, const void *addr) {
+	struct ChatServer *s = cx->srv;
+	pthread_rwlock_rdlock(&s->lock);
+	int pos = chat_server_find(cx, addr);
+	if (pos >= 0) chat_server_seen(s, pos);
+	pthread_rwlock_unlock(&s->lock);
+}
+
+/**
+ * @brief Check the rate limits of a message which fans out and count it, the registry lock must be held.
+ * Only the context the client goes to writes its bucket.
+ * @param context which received the message
+ * @param client handle of the sender
+ * @return true if the message may be sent, false if it is dropped
+ */
+static bool admit_message(struct ChatContext *cx, int pos) {
+	struct ChatServer *s = cx->srv;
+	struct ChatServerClient *c = chat_server_client(s, pos);
+	/* clients sharing an account share its bucket, more clients dont give more messages */
+	uint64_t *bucket = c->account ? &c->account->bucket : registry_get(&s->clients, CHAT_CLIENT_BUCKET, pos);
+	if (s->client_rate.interval_us && !token_take(bucket, &s->client_rate, cx->now_us)) {
+		__atomic_add_fetch(&c->limited, 1, __ATOMIC_RELAXED);
+		if (c->account) __atomic_add_fetch(&c->account->limited, 1, __ATOMIC_RELAXED);
+		cx->limited_client++;
+		metrics_add(METRIC_DROPS, 1);
+		return false;
+	}
+	if (s->ingress_rate.interval_us && !token_take(&cx->ingress, &s->ingress_rate, cx->now_us)) {
+		cx->limited_ingress++;
+		metrics_add(METRIC_DROPS, 1);
+		return false;
+	}
+	__atomic_add_fetch(&c->messages, 1, __ATOMIC_RELAXED);
+	if (c->account) __atomic_add_fetch(&c->account->messages, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+/**
+ * @brief Forward a chat message of a registered client to every client
+ * @param context which received the message
+ * @param address of the sender
+ * @param message text, not zero terminated
+ * @param text length
+ * @param sequence number of the sender
+ * @param CHAT_FLAG_FORMATTED if the text already starts with the name of the sender
+ * @return void
+ */
+static void chat_message(struct ChatContext *cx, const void *addr, const char *payload, size_t len, uint32_t seq, int flags) {
+	struct ChatServer *s = cx->srv;
+	char name[CHAT_CLIENT_NAME_LEN + 1];
+	size_t name_len = 0, tag_len = 0;
+
+	// send the message to every client if the sender is registred
+	pthread_rwlock_rdlock(&s->lock);
+	int pos = chat_server_find(cx, addr);
+	bool admitted = false;
+	if (pos >= 0) {
+		chat_server_seen(s, pos);
+		/* a flood is dropped here, before anything is formatted or sent */
+		if ((admitted = len && admit_message(cx, pos))) {
+			struct ChatServerClient *c = chat_server_client(s, pos);
+			name_len = c->name_len;
+			tag_len = c->tag_len;
+			memcpy(name, c->name, name_len + 1);
+		}
+	}
+	pthread_rwlock_unlock(&s->lock);
+	if (!admitted) return;
+	LOG_DEBUG("Chat Message: \"%.*s\"", (int)len, payload);
+
+	/* with verified senders the name in front of a text comes from the server, the sender cant pick it */
+	if ((flags & CHAT_FLAG_FORMATTED) && s->verified) {
+		if (len > tag_len + 3 && payload[0] == '[' && memcmp(payload + 1, name, tag_len) == 0 &&
+				payload[tag_len + 1] == ']' && payload[tag_len + 2] == ' ') {
+			payload += tag_len + 3;
+			len -= tag_len + 3;
+		}
+		flags &= ~CHAT_FLAG_FORMATTED;
+	}
+	/* text clients get "[name] text", text senders which formatted it get it as it is */
+	const char *text = payload;
+	size_t text_len = len;
+	if (!(flags & CHAT_FLAG_FORMATTED)) {
+		char *formatted = arena_alloc(&cx->arena, name_len + 3 + len);
+		if (formatted) {
+			formatted[0] = '[';
+			memcpy(formatted + 1, name, name_len);
+			memcpy(formatted + 1 + name_len, "] ", 2);
+			memcpy(formatted + 3 + name_len, payload, len);
+		}
+		text = formatted;
+		text_len = name_len + 3 + len;
+	}
+	/* binary clients get the payload untouched with the id of the sender */
+	s->ops->notify(cx, NULL, 0, text, text_len, CHAT_MESSAGE, flags, pos, seq, payload, len, -1);
+	metrics_latency(now_ns() - cx->recv_ns);
+	/* a formatted text is stored as it is, without the name */
+	if (s->history_dir) {
+		bool named = !(flags & CHAT_FLAG_FORMATTED);
+		history_append(&s->history, pos, named ? name : NULL, named ? name_len : 0, NULL, 0, payload, len);
+	}
+}
+
+/**
+ * @brief Add a registered client to a room
+ * @param context which received the request
+ * @param address of the client
+ * @param room name, not zero terminated
+ * @param room name length
+ * @return void
+ */
+static void join_room(struct ChatContext *cx, const void *addr, const char *room, size_t room_len) {
+	struct ChatServer *s = cx->srv;
+	char notice[CHAT_SERVER_DATAGRAM_LEN];
+	/* room messages held before the join are not for the client, the notice must not overtake them */
+	if (s->ops->flush) s->ops->flush(cx);
+	pthread_rwlock_wrlock(&s->lock);
+	int pos = chat_server_find(cx, addr);
+	int id = pos < 0 || room_len > CHAT_ROOM_LEN ? -1 : rooms_join(&s->rooms, pos, room, room_len);
+	uint32_t members = id < 0 ? 0 : s->rooms.rooms[id].count;
+	if (pos >= 0) chat_server_seen(s, pos);
+	pthread_rwlock_unlock(&s->lock);
+	if (pos < 0) return;
+
+	if (id < 0)
+		snprintf(notice, sizeof(notice), "Cant join #%.*s", (int)room_len, room);
+	else
+		snprintf(notice, sizeof(notice), "You joined #%.*s, %u members", (int)room_len, room, members);
+	LOG_DEBUG("Client %d: %s", pos, notice);
+	client_notice(cx, pos, notice);
+}
+
+/**
+ * @brief Remove a registered client from a room
+ * @param context which received the request
+ * @param address of the client
+ * @param room name, not zero terminated
+ * @param room name length
+ * @return void
+ */
+static void leave_room(struct ChatContext *cx, const void *addr, const char *room, size_t room_len) {
+	struct ChatServer *s = cx->srv;
+	char notice[CHAT_SERVER_DATAGRAM_LEN];
+	if (s->ops->flush) s->ops->flush(cx);
+	pthread_rwlock_wrlock(&s->lock);
+	int pos = chat_server_find(cx, addr);
+	int left = pos < 0 ? -1 : rooms_leave(&s->rooms, pos, room, room_len);
+	if (pos >= 0) chat_server_seen(s, pos);
+	pthread_rwlock_unlock(&s->lock);
+	if (pos < 0) return;
+
+	snprintf(notice, sizeof(notice), left < 0 ? "You are not in #%.*s" : "You left #%.*s", (int)room_len, room);
+	client_notice(cx, pos, notice);
+}
+
+/**
+ * @brief Forward a message of a registered client to the subscribers of a room it is in
+ * @param context which received the message
+ * @param address of the sender
+ * @param room name, not zero terminated
+ * @param room name length
+ * @param message text, not zero terminated
+ * @param text length
+ * @param PUBLISH payload as sent by a binary client or NULL
+ * @param payload length
+ * @param sequence number of the sender
+ * @return void
+ */
+static void room_message(struct ChatContext *cx, const void *addr, const char *room, size_t room_len, const char *msg, size_t msg_len,
+		const char *payload, size_t len, uint32_t seq) {
+	struct ChatServer *s = cx->srv;
+	char name[CHAT_CLIENT_NAME_LEN + 1];
+	bool member = false;
+
+	pthread_rwlock_rdlock(&s->lock);
+	int pos = chat_server_find(cx, addr);
+	bool admitted = false;
+	if (pos >= 0) {
+		chat_server_seen(s, pos);
+		if ((admitted = msg_len && admit_message(cx, pos))) {
+			struct ChatServerClient *c = chat_server_client(s, pos);
+			memcpy(name, c->name, c->name_len + 1);
+			int id = rooms_find(&s->rooms, room, room_len);
+			member = id >= 0 && rooms_is_member(&s->rooms, pos, id);
+		}
+	}
+	pthread_rwlock_unlock(&s->lock);
+	if (!admitted) return;
+	if (!member) {
+		char notice[CHAT_SERVER_DATAGRAM_LEN];
+		snprintf(notice, sizeof(notice), "You are not in #%.*s", (int)room_len, room);
+		client_notice(cx, pos, notice);
+		return;
+	}
+
+	/* text senders dont pack the payload, binary clients get it in one piece */
+	if (!payload) {
+		char *packed = arena_alloc(&cx->arena, 1 + room_len + msg_len);
+		if (!packed || !(len = chat_room_pack(packed, 1 + room_len + msg_len, room, room_len, msg, msg_len))) return;
+		payload = packed;
+	}
+	size_t text_len;
+	char *text = arena_format(&cx->arena, &text_len, "[#%.*s] [%s] %.*s", (int)room_len, room, name, (int)msg_len, msg);
+	s->ops->notify(cx, room, room_len, text, text_len, CHAT_PUBLISH, 0, pos, seq, payload, len, -1);
+	metrics_latency(now_ns() - cx->recv_ns);
+	if (s->history_dir) history_append(&s->history, pos, name, strlen(name), room, room_len, msg, msg_len);
+}
+
+/**
+ * @brief Request handler of REGISTER
+ * @param context which received the request
+ * @param request
+ * @param address of the client
+ * @param length of the address
+ * @return void
+ */
+static void on_register(void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen) {
+	struct ChatContext *cx = ctx;
+	struct ChatRegistration reg = { r->payload, r->h.len, r->frame, r->h.flags, r->h.seq, addr, addrlen, cx->cred };
+	register_client(cx, &reg);
+}
+
+/**
+ * @brief Request handler of DISCONNECT
+ * @param context which received the request
+ * @param request
+ * @param address of the client
+ * @param length of the address
+ * @return void
+ */
+static void on_disconnect(void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen) {
+	disconnect_client(ctx, addr);
+}
+
+/**
+ * @brief Request handler of MESSAGE
+ * @param context which received the request
+ * @param request
+ * @param address of the client
+ * @param length of the address
+ * @return void
+ */
+static void on_message(void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen) {
+	struct ChatContext *cx = ctx;
+	/* text clients of a server without formatted text mark a message with '+', other text is ignored */
+	if ((r->h.flags & CHAT_FLAG_FORMATTED) && !cx->srv->formatted_text) return;
+	chat_message(cx, addr, r->payload, r->h.len, r->h.seq, r->h.flags & CHAT_FLAG_FORMATTED);
+}
+
+/**
+ * @brief Request handler of ROOM_JOIN
+ * @param context which received the request
+ * @param request
+ * @param address of the client
+ * @param length of the address
+ * @return void
+ */
+static void on_room_join(void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen) {
+	join_room(ctx, addr, r->payload, r->h.len);
+}
+
+/**
+ * @brief Request handler of ROOM_LEAVE
+ * @param context which received the request
+ * @param request
+ * @param address of the client
+ * @param length of the address
+ * @return void
+ */
+static void on_room_leave(void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen) {
+	leave_room(ctx, addr, r->payload, r->h.len);
+}
+
+/**
+ * @brief Request handler of PUBLISH, a frame is forwarded untouched
+ * @param context which received the request
+ * @param request
+ * @param address of the client
+ * @param length of the address
+ * @return void
+ */
+static void on_publish(void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen) {
+	room_message(ctx, addr, r->room, r->room_len, r->msg, r->msg_len, r->frame ? r->payload : NULL, r->frame ? r->h.len : 0, r->h.seq);
+}
+
+/**
+ * @brief Request handler of HEARTBEAT
+ * @param context which received the request
+ * @param request
+ * @param address of the client
+ * @param length of the address
+ * @return void
+ */
+static void on_heartbeat(void *ctx, const struct ChatRequest *r, void *addr, socklen_t addrlen) {
+	heartbeat(ctx, addr);
+}
+
+const chat_handler chat_server_handlers[CHAT_TYPES] = {
+	[CHAT_REGISTER] = on_register,
+	[CHAT_DISCONNECT] = on_disconnect,
+	[CHAT_MESSAGE] = on_message,
+	[CHAT_ROOM_JOIN] = on_room_join,
+	[CHAT_ROOM_LEAVE] = on_room_leave,
+	[CHAT_PUBLISH] = on_publish,
+	[CHAT_HEARTBEAT] = on_heartbeat
+};
+
+void chat_server_handle(struct ChatContext *cx, const char *buffer, size_t nbytes, void *addr, socklen_t addrlen) {
+	struct ChatRequest r;
+	if (chat_request_parse(buffer, nbytes, &r) < 0) {
+		metrics_add(METRIC_DROPS, 1);
+		return;
+	}
+	if (r.frame && cx->srv->ops->frame && cx->srv->ops->frame(cx, &r, addr, addrlen)) return;
+	chat_dispatch(chat_server_handlers, cx, &r, addr, addrlen);
+}
+
+void chat_server_notice(struct ChatContext *cx, const char *body, size_t len) {
+	size_t prefix = strlen(CHAT_SERVER_PREFIX);
+	char *text = arena_alloc(&cx->arena, prefix + len);
+	if (!text) return;
+	memcpy(text, CHAT_SERVER_PREFIX, prefix);
+	memcpy(text + prefix, body, len);
+	cx->srv->ops->notify(cx, NULL, 0, text, prefix + len, CHAT_NOTICE, 0, CHAT_SENDER_SERVER, chat_server_next_seq(cx->srv), body, len, -1);
+}
+
+int chat_server_closing(struct ChatContext *cx) {
+	return cx->srv->ops->notify(cx, NULL, 0, CHAT_SERVER_CLOSING, strlen(CHAT_SERVER_CLOSING), CHAT_CLOSING, 0, CHAT_SENDER_SERVER,
+		chat_server_next_seq(cx->srv), NULL, 0, -1);
+}
+
+/**
+ * @brief Print all registered clients
+ * @param server
+ * @return void
+ */
+static void list_clients(struct ChatServer *s) {
+	char peer[TRANSPORT_NAME_LEN];
+	pthread_rwlock_rdlock(&s->lock);
+	for (uint32_t k = 0; k < s->clients.count; k++) {
+		struct ChatServerClient *c = registry_at(&s->clients, CHAT_CLIENT_INFO, k);
+		int id = registry_handle_at(&s->clients, k);
+		LOG_INFO("Client %d: %s at %s, %lu messages, %lu dropped by the rate limit", id, c->name,
+			s->transport->format(registry_at(&s->clients, CHAT_CLIENT_ADDR, k), peer, sizeof(peer)), c->messages, c->limited);
+		if (s->ops->list) s->ops->list(s, id);
+	}
+	pthread_rwlock_unlock(&s->lock);
+}
+
+/**
+ * @brief Handle of a client by its name, the registry lock must be held
+ * @param server
+ * @param zero terminated name
+ * @return handle or -1 if no client has that name
+ */
+static int find_name(struct ChatServer *s, const char *name) {
+	for (uint32_t k = 0; k < s->clients.count; k++) {
+		if (strcmp(((struct ChatServerClient *)registry_at(&s->clients, CHAT_CLIENT_INFO, k))->name, name) == 0)
+			return registry_handle_at(&s->clients, k);
+	}
+	return -1;
+}
+
+/**
+ * @brief Remove a client from the server and tell it and all others
+ * @param context whose socket is used
+ * @param client as named on the console
+ * @return void
+ */
+static void kick_client(struct ChatContext *cx, const char *arg) {
+	struct ChatServer *s = cx->srv;
+	struct sockaddr_storage kicked;
+	char name[CHAT_CLIENT_NAME_LEN + 1];
+	bool binary = false;
+	pthread_rwlock_wrlock(&s->lock);
+	int pos = s->ops->named ? s->ops->named(cx, arg) : find_name(s, arg);
+	if (pos >= 0) {
+		memcpy(&kicked, chat_server_addr(s, pos), s->transport->addrlen);
+		memcpy(name, chat_server_client(s, pos)->name, chat_server_client(s, pos)->name_len + 1);
+		binary = chat_server_state(s, pos) & CHAT_CLIENT_BINARY;
+		chat_server_remove(s, pos);
+	}
+	pthread_rwlock_unlock(&s->lock);
+	if (pos < 0) {
+		LOG_INFO("No client %s", arg);
+		return;
+	}
+
+	/* the client is gone from the registry, so it is told outside of a stream */
+	const char *notice = "You have been kicked from the server";
+	if (binary) {
+		send_frame(cx, &kicked, s->transport->addrlen, CHAT_NOTICE, 0, CHAT_SENDER_SERVER, chat_server_next_seq(s), notice, strlen(notice));
+		send_frame(cx, &kicked, s->transport->addrlen, CHAT_CLOSING, 0, CHAT_SENDER_SERVER, chat_server_next_seq(s), NULL, 0);
+	} else {
+		char text[CHAT_SERVER_DATAGRAM_LEN];
+		snprintf(text, sizeof(text), CHAT_SERVER_PREFIX "%s", notice);
+		send_datagram(cx, &kicked, s->transport->addrlen, text, strlen(text));
+		send_datagram(cx, &kicked, s->transport->addrlen, CHAT_SERVER_CLOSING, strlen(CHAT_SERVER_CLOSING));
+	}
+
+	char kick[CHAT_SERVER_DATAGRAM_LEN];
+	snprintf(kick, sizeof(kick), "\"%s\" was kicked from the server", name);
+	chat_server_notice(cx, kick, strlen(kick));
+	LOG_INFO("Client %s was kicked", name);
+	admit_waiting(cx);
+}
+
+void chat_server_command(struct ChatContext *cx, char *line) {
+	char *arg = strchr(line, ' ');
+	if (arg) *arg++ = '\0';
+
+	if (strcmp(line, "list") == 0) {
+		list_clients(cx->srv);
+	} else if (strcmp(line, "kick") == 0 && arg) {
+		kick_client(cx, arg);
+	} else if (strcmp(line, "broadcast") == 0 && arg) {
+		chat_server_notice(cx, arg, strlen(arg));
+	} else if (strcmp(line, "stats") == 0) {
+		chat_server_print_stats(cx->srv);
+	} else if (line[0] != '\0') {
+		LOG_INFO("Commands: list, kick <name>, broadcast <message>, stats");
+	}
+}
+
+void chat_server_print_stats(struct ChatServer *s) {
+	pthread_rwlock_rdlock(&s->lock);
+	struct Registry r = s->clients;
+	int n_rooms = s->rooms.max_rooms - s->rooms.n_free;
+	unsigned long memberships = s->rooms.memberships;
+	unsigned long expired = s->idle_expired;
+	pthread_rwlock_unlock(&s->lock);
+	if (r.limit)
+		LOG_INFO("%u of %u clients registered", r.count, r.limit);
+	else
+		LOG_INFO("%u clients registered", r.count);
+	LOG_INFO("Client table holds %u entries, peak %u clients", r.capacity, r.peak);
+	LOG_INFO("%d rooms with %lu memberships", n_rooms, memberships);
+	if (s->idle_timeout)
+		LOG_INFO("Idle timeout %d seconds, %lu idle clients removed", s->idle_timeout, expired);
+	if (s->ops->stats) s->ops->stats(s);
+	print_rate_stats(s);
+	pthread_rwlock_rdlock(&s->lock);
+	admission_print_stats(&s->admission);
+	pthread_rwlock_unlock(&s->lock);
+	history_print_stats(&s->history);
+	metrics_print_stats();
+	LOG_INFO("Logger dropped %lu messages", log_dropped());
+}
+
+void chat_server_gauges(FILE *out) {
+	struct ChatServer *s = key_server;
+	pthread_rwlock_rdlock(&s->lock);
+	uint32_t count = s->clients.count;
+	int n_rooms = s->rooms.max_rooms - s->rooms.n_free;
+	unsigned long memberships = s->rooms.memberships;
+	pthread_rwlock_unlock(&s->lock);
+	chat_gauges(out, count, n_rooms, memberships);
+}
@@ -0,0 +1,498 @@
+/**
+ * @file chat_server.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Clients, registration, expiry and request handlers shared by the chat servers of every transport
+ */
+
+#ifndef CHAT_SERVER_H
+#define CHAT_SERVER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include "admission.h"
+#include "arena.h"
+#include "broadcast.h"
+#include "chat_engine.h"
+#include "client_index.h"
+#include "event_loop.h"
+#include "history.h"
+#include "recv_ring.h"
+#include "registry.h"
+#include "rooms.h"
+#include "timer_wheel.h"
+#include "token_bucket.h"
+#include "transport.h"
+
+#define CHAT_SERVER_DATAGRAM_LEN 4096 /* longest datagram the servers receive */
+#define CHAT_SERVER_ARENA_PER_DATAGRAM (CHAT_SERVER_DATAGRAM_LEN + 64) /* room for one formatted message per datagram */
+#define CHAT_SERVER_FANOUT_PREFETCH 8 /* room members whose address is prefetched ahead of the fan-out */
+#define CHAT_SERVER_PREFIX "[SERVER] " /* text clients get server notices with this prefix */
+#define CHAT_SERVER_CLOSING "--" /* text clients are told with this that the server closes or kicked them */
+#define CHAT_CLIENT_NAME_LEN 160 /* the name a client sent or its socket name with the login of its user */
+#define CHAT_IDLE_TICK_MS 100 /* resolution of the idle timers and of the last seen times */
+#define CHAT_IDLE_DEFAULT_TIMEOUT 30 /* seconds, three missed heartbeats */
+#define CHAT_IDLE_MAX_EXPIRED 64 /* idle clients removed per tick */
+#define CHAT_RATE_BURST_SECONDS 1 /* a full bucket holds the messages of this many seconds */
+
+/* Command line options every server takes, a server adds its own in front of the usage */
+#define CHAT_SERVER_OPTIONS "db:r:s:ui:H:n:l:L:m:q:z:"
+#define CHAT_SERVER_USAGE "(-d Debug) (-b Batch size) (-r Ring depth) (-s Stats interval) (-u io_uring) " \
+	"(-i Idle timeout in seconds, 0 to keep idle clients) (-H History directory) (-n Messages replayed to new clients) " \
+	"(-l Messages per second of a client) (-L Messages per second of all clients) (-m Metrics port on localhost or socket file) " \
+	"(-q Clients waiting for a place, 0 to reject them) (-z Shortest payload sent compressed, 0 to never compress)"
+
+/* The fan-out only reads the address and the state of a client, so both are
+ * columns of their own in the client registry. The rest of a client is only
+ * read when a single client is handled. */
+enum {
+	CHAT_CLIENT_ADDR, /* peer address of the transport */
+	CHAT_CLIENT_STATE, /* uint8_t, CHAT_CLIENT_ flags */
+	CHAT_CLIENT_SEEN, /* uint64_t, coarse time of the last datagram, written for every message */
+	CHAT_CLIENT_BUCKET, /* uint64_t, token bucket of the messages which fan out */
+	CHAT_CLIENT_INFO, /* struct ChatServerClient */
+	CHAT_CLIENT_EXT, /* part only the server knows, e.g. a reliable stream */
+	CHAT_CLIENT_COLUMNS
+};
+
+/* State of a registered client, set from the flags of its REGISTER frame as
+ * far as the server offers them */
+#define CHAT_CLIENT_BINARY 0x01 /* registered with the binary protocol */
+#define CHAT_CLIENT_RELIABLE 0x02 /* has a reliable stream */
+#define CHAT_CLIENT_COALESCE 0x04 /* gets several frames per datagram */
+#define CHAT_CLIENT_SHARED 0x08 /* reads the frames to all clients from a shared memory ring */
+#define CHAT_CLIENT_COMPRESS 0x10 /* takes compressed payloads */
+
+/* Timers are linked into the wheel, so they live outside of the registry whose entries move */
+struct ChatIdleTimer {
+	struct TimerEntry timer;
+	int id; /* client handle */
+};
+
+/* Counters and token bucket shared by several clients, e.g. by all clients of one user */
+struct ChatAccount {
+	uint64_t bucket;
+	unsigned long messages;
+	unsigned long limited; /* messages dropped by the rate limit */
+};
+
+struct ChatServerClient {
+	char name[CHAT_CLIENT_NAME_LEN + 1]; /* shown to the other clients */
+	size_t name_len;
+	size_t tag_len; /* leading part of the name a text client writes in front of its messages */
+	struct ChatAccount *account; /* rate limit shared with other clients or NULL */
+	struct ChatIdleTimer *idle; /* idle expiry or NULL if idle clients are kept */
+	unsigned long messages; /* chat and room messages sent by the client */
+	unsigned long limited; /* messages dropped by the rate limit of the client */
+};
+
+/* A REGISTER request, received or taken from the admission queue */
+struct ChatRegistration {
+	const char *name; /* not zero terminated */
+	size_t name_len;
+	bool binary;
+	int flags; /* flags of the REGISTER frame */
+	uint32_t seq; /* seq of the REGISTER frame, a reliable stream starts there */
+	void *addr;
+	socklen_t addrlen;
+	const struct ucred *cred; /* process which registered or NULL if the transport has no credentials */
+};
+
+/* Payload of the current broadcast compressed for the clients which asked for it */
+struct ChatCompress {
+	char buf[CHAT_SERVER_DATAGRAM_LEN];
+	unsigned long payloads, skipped; /* compressed and too short to get smaller */
+	uint64_t plain_bytes, compressed_bytes;
+};
+
+struct ChatServer;
+
+/* What one thread handling requests brings along, e.g. a worker. Outgoing
+ * messages of one batch are formatted into the arena, a fan-out collects its
+ * recipients in the broadcast vector. */
+struct ChatContext {
+	struct ChatServer *srv;
+	int sock; /* socket the answers go out on */
+	struct Arena arena;
+	struct Broadcast bcast;
+	uint64_t recv_ns; /* read once per receive batch, start of the fan-out latency */
+	uint64_t now_us; /* the same time for the rate limits */
+	const struct ucred *cred; /* sender of the datagram being handled, NULL if the transport has no credentials */
+	uint64_t ingress; /* token bucket of the share of the context in the server limit */
+	unsigned long limited_client, limited_ingress;
+	struct ChatCompress z;
+	struct ChatContext *next; /* all contexts of the server */
+};
+
+/* The parts only a server knows, everything else is done the same for every
+ * transport. The registry lock is never held while notify or flush run. */
+struct ChatServerOps {
+	/* Send a text to the text clients and a frame to the binary clients of a room, except one.
+	 * room is NULL for all clients, text NULL leaves out the text clients. Returns the clients reached. */
+	int (*notify)(struct ChatContext *cx, const char *room, size_t room_len, const char *text, size_t text_len,
+		int type, int flags, uint32_t sender, uint32_t seq, const char *payload, size_t len, int except);
+	/* Send a frame to one client in its own stream, the registry lock is held. Returns false
+	 * to have it sent as a single datagram. NULL for a server without streams. */
+	bool (*unicast)(struct ChatContext *cx, int id, int type, int flags, uint32_t sender, const char *payload, size_t len);
+	/* Send the frames held back for the current audience before it changes, or NULL */
+	void (*flush)(struct ChatContext *cx);
+	/* Set up the server part of a client which just got a place and may rename it, the registry lock is
+	 * held exclusively. Returns -1 to turn the client away like on a full server. NULL for none. */
+	int (*attach)(struct ChatContext *cx, int id, const struct ChatRegistration *reg);
+	/* Release the server part of a client which is removed, the registry lock is held exclusively, or NULL */
+	void (*detach)(struct ChatServer *s, int id);
+	/* false if the datagram being handled, see cred of the context, does not come from the client at its address, or NULL */
+	bool (*verify)(struct ChatContext *cx, int id);
+	/* Flags and sequence number of the WELCOME of a client, e.g. its position in a shared ring, or NULL */
+	void (*welcome)(struct ChatContext *cx, int id, int *flags, uint32_t *seq);
+	/* Take a frame before it is dispatched, e.g. an ack or a frame of a reliable stream, or NULL */
+	bool (*frame)(struct ChatContext *cx, const struct ChatRequest *r, void *addr, socklen_t addrlen);
+	/* Client named on the console, the registry lock is held. NULL finds clients by their name. */
+	int (*named)(struct ChatContext *cx, const char *name);
+	/* Log the server part of a client for the list command, the registry lock is held, or NULL */
+	void (*list)(struct ChatServer *s, int id);
+	/* Log the statistics of the server parts for the stats command, or NULL */
+	void (*stats)(struct ChatServer *s);
+	/* Send what the requests of one batch left behind, e.g. wake the readers of a shared ring, or NULL */
+	void (*batch_end)(struct ChatContext *cx);
+};
+
+/* Registered clients packed without gaps, a client is addressed by its handle.
+ * The settings are given before chat_server_init. */
+struct ChatServer {
+	/* settings, chat_server_defaults fills them */
+	int max_clients; /* 0 for no limit */
+	int idle_timeout; /* seconds, 0 keeps idle clients */
+	const char *history_dir; /* message log, only kept if given */
+	int history_replay;
+	unsigned long client_limit, ingress_limit; /* messages per second, 0 for no limit */
+	int admission_len; /* clients waiting for a place, 0 rejects them */
+	int compress_min; /* shortest payload compressed, 0 never compresses */
+	uint8_t features; /* CHAT_CLIENT_RELIABLE, CHAT_CLIENT_COALESCE and CHAT_CLIENT_SHARED if the server offers them */
+	bool formatted_text; /* text without command character is a message which starts with the name of its sender */
+	bool verified; /* the transport vouches for the senders, the server writes the name in front of a text */
+	int batch, ring_depth; /* datagrams per receive and slots of a receive ring */
+	int stats_interval; /* seconds between logged statistics, 0 for none */
+	int backend; /* EVENT_BACKEND_ of the event loop */
+	const char *metrics_where; /* port or socket file of the metrics endpoint, only served if given */
+
+	const struct ChatTransport *transport;
+	const struct ChatServerOps *ops;
+	/* Guards clients, index, rooms and admission, lookups share it, register, disconnect, join and leave take it exclusively */
+	pthread_rwlock_t lock;
+	struct Registry clients;
+	struct ClientIndex index;
+	struct Rooms rooms;
+	/* Clients waiting for a place while the server is full */
+	struct AdmissionQueue admission;
+	/* Guards the idle timers, always taken after the registry lock */
+	pthread_mutex_t idle_lock;
+	struct TimerWheel idle_wheel;
+	/* Monotonic milliseconds, advanced by the idle tick, so a message stores its
+	 * last seen time without reading the clock */
+	uint64_t coarse_ms;
+	unsigned long idle_expired;
+	/* Messages which fan out, per client and for the whole server, split evenly over the contexts */
+	struct TokenRate client_rate, ingress_rate;
+	struct History history;
+	uint32_t seq; /* sequence number of the frames sent by the server */
+	uint32_t compress_clients; /* registered clients which take compressed payloads */
+	struct ChatContext *contexts;
+	/* Console, timers and signals run on the main thread, their requests go through the admin context */
+	struct EventLoop loop;
+	struct ChatContext *admin;
+	bool failed; /* shut down by an error, not by a signal */
+};
+
+/* Requests the servers answer, the context of a handler is a struct ChatContext */
+extern const chat_handler chat_server_handlers[CHAT_TYPES];
+
+/**
+ * @brief Fill the settings of a server with their defaults
+ * @param server
+ * @return void
+ */
+void chat_server_defaults(struct ChatServer *s);
+
+/**
+ * @brief Take one of the CHAT_SERVER_OPTIONS
+ * @param server
+ * @param option character returned by getopt
+ * @param argument of the option
+ * @return 0 if the option was taken, -1 if it is none of the common options
+ */
+int chat_server_option(struct ChatServer *s, int opt, const char *arg);
+
+/**
+ * @brief Take the client limit from the first argument after the options
+ * @param server
+ * @param number of arguments
+ * @param list of arguments
+ * @return 0 on success, -1 if the limit is missing
+ */
+int chat_server_limit(struct ChatServer *s, int argc, char *argv[]);
+
+/**
+ * @brief Create the event loop, watch SIGINT and SIGTERM, allocate the client table, index, rooms and admission queue,
+ * start the idle timer and open the history. The signals are blocked here, so call it before any thread starts.
+ * Only one server per process, the metrics gauges and the key lookups find it.
+ * @param server with its settings
+ * @param transport of the client addresses
+ * @param hooks of the server
+ * @param size of the server part of a client, the CHAT_CLIENT_EXT column
+ * @param number of contexts the server limit is split over
+ * @return 0 on success, -1 on failure, which is logged
+ */
+int chat_server_init(struct ChatServer *s, const struct ChatTransport *t, const struct ChatServerOps *ops, size_t ext_size, int n_contexts);
+
+/**
+ * @brief Watch the console, start the statistics timer and serve the metrics
+ * @param server
+ * @param context of the main thread the console, timers and signals use
+ * @return 0 on success, -1 if the metrics cant be served, which is logged
+ */
+int chat_server_start(struct ChatServer *s, struct ChatContext *admin);
+
+/**
+ * @brief Run the event loop of the main thread until SIGINT or SIGTERM
+ * @param server
+ * @return 0 or -1 on error or after chat_server_shutdown
+ */
+int chat_server_run(struct ChatServer *s);
+
+/**
+ * @brief Shut the server down like on SIGINT after an error, from any thread
+ * @param server
+ * @return void
+ */
+void chat_server_shutdown(struct ChatServer *s);
+
+/**
+ * @brief Log the statistics of the server and close the history and the metrics endpoint
+ * @param server
+ * @return void
+ */
+void chat_server_close(struct ChatServer *s);
+
+/**
+ * @brief Set up a context of a server, after chat_server_init
+ * @param context
+ * @param server
+ * @param socket the answers go out on
+ * @param arena size in bytes
+ * @return 0 on success, -1 if out of memory
+ */
+int chat_context_init(struct ChatContext *cx, struct ChatServer *s, int sock, size_t arena_bytes);
+
+/**
+ * @brief Receive one batch of datagrams on the socket of a context and handle every request
+ * @param context
+ * @param receive ring of the socket
+ * @return number of datagrams handled, 0 if a nonblocking socket is empty or -1 on error
+ */
+int chat_context_receive(struct ChatContext *cx, struct RecvRing *ring);
+
+/**
+ * @brief Finish a batch of requests, sends what the server held back and frees the formatted messages
+ * @param context
+ * @return void
+ */
+void chat_context_done(struct ChatContext *cx);
+
+/**
+ * @brief Log the arena and compression statistics of a context
+ * @param context
+ * @return void
+ */
+void chat_context_print_stats(const struct ChatContext *cx);
+
+/**
+ * @brief Compress the payload of a broadcast once for all clients which asked for it
+ * @param context, gets the compressed payload in z.buf
+ * @param payload
+ * @param payload length
+ * @return compressed length or 0 if the payload is sent as it is
+ */
+size_t chat_context_compress(struct ChatContext *cx, const char *payload, size_t len);
+
+/**
+ * @brief Registered client of a handle, the registry lock must be held
+ * @param server
+ * @param client handle
+ * @return client or NULL if the handle is not in use
+ */
+struct ChatServerClient *chat_server_client(struct ChatServer *s, int id);
+
+/**
+ * @brief Address of a registered client, the registry lock must be held
+ * @param server
+ * @param client handle
+ * @return address
+ */
+void *chat_server_addr(struct ChatServer *s, int id);
+
+/**
+ * @brief State of a registered client, the registry lock must be held
+ * @param server
+ * @param client handle
+ * @return CHAT_CLIENT_ flags
+ */
+uint8_t chat_server_state(struct ChatServer *s, int id);
+
+/**
+ * @brief Server part of a registered client, the registry lock must be held
+ * @param server
+ * @param client handle
+ * @return CHAT_CLIENT_EXT column of the client
+ */
+void *chat_server_ext(struct ChatServer *s, int id);
+
+/**
+ * @brief Note that a registered client sent something, the registry lock must be held
+ * @param server
+ * @param client handle
+ * @return void
+ */
+void chat_server_seen(struct ChatServer *s, int id);
+
+/**
+ * @brief Handle of the client which sent the datagram being handled, the registry lock must be held
+ * @param context
+ * @param address of the sender
+ * @return handle or -1 if the sender is not registered or not the registered client
+ */
+int chat_server_find(struct ChatContext *cx, const void *addr);
+
+/**
+ * @brief Number of clients a message goes to, the registry lock must be held
+ * @param server
+ * @param room name or NULL for all clients
+ * @param room name length
+ * @param room id or -1 for all clients
+ * @return number of clients to walk
+ */
+int chat_server_audience(struct ChatServer *s, const char *room, size_t room_len, int *room_id);
+
+/**
+ * @brief Registry position of the k-th client of an audience, the registry lock must be held
+ * @param server
+ * @param room id or -1 for all clients
+ * @param entry of the audience
+ * @param client handle
+ * @return position in the client registry
+ */
+int chat_server_audience_pos(struct ChatServer *s, int room_id, int k, int *id);
+
+/**
+ * @brief Send the broadcast prepared in the context to every registered client of one protocol or of one room except one
+ * @param context whose socket and broadcast vector are used
+ * @param CHAT_CLIENT_ flags of the recipients, 0 for text clients
+ * @param CHAT_CLIENT_ flags compared
+ * @param client handle to leave out or -1
+ * @param room name or NULL for all clients
+ * @param room name length
+ * @return number of clients the message was sent to
+ */
+int chat_server_fanout(struct ChatContext *cx, uint8_t want, uint8_t mask, int except, const char *room, size_t room_len);
+
+/**
+ * @brief Grow a broadcast vector for an audience, the registry lock must be held
+ * @param broadcast vector
+ * @param number of clients of the audience
+ * @return 0 on success, -1 if it cant grow, recipients beyond its capacity are left out
+ */
+int chat_server_reserve(struct Broadcast *b, int count);
+
+/**
+ * @brief Send a broadcast vector filled by a walk of the server, count it and report failed clients
+ * @param context whose socket is used
+ * @param broadcast vector
+ * @return number of clients the message was sent to
+ */
+int chat_server_broadcast(struct ChatContext *cx, struct Broadcast *b);
+
+/**
+ * @brief Next sequence number of a frame of the server
+ * @param server
+ * @return sequence number
+ */
+uint32_t chat_server_next_seq(struct ChatServer *s);
+
+/**
+ * @brief Decode one received datagram and call its handler
+ * @param context which received the datagram
+ * @param zero terminated datagram
+ * @param datagram length
+ * @param address of the sender
+ * @param address length
+ * @return void
+ */
+void chat_server_handle(struct ChatContext *cx, const char *buffer, size_t nbytes, void *addr, socklen_t addrlen);
+
+/**
+ * @brief Remove a client from the registry, the registry lock must be held exclusively
+ * @param server
+ * @param client handle
+ * @return void
+ */
+void chat_server_remove(struct ChatServer *s, int id);
+
+/**
+ * @brief Tell every client that a client is gone and give its place to a waiting client
+ * @param context whose socket is used
+ * @param former handle of the client
+ * @param zero terminated name
+ * @param name length
+ * @return void
+ */
+void chat_server_left(struct ChatContext *cx, int id, const char *name, size_t name_len);
+
+/**
+ * @brief Send a server notice to every client
+ * @param context whose socket is used
+ * @param notice text without the server prefix
+ * @param text length
+ * @return void
+ */
+void chat_server_notice(struct ChatContext *cx, const char *body, size_t len);
+
+/**
+ * @brief Tell every client that the server closes
+ * @param context whose socket is used
+ * @return number of clients told
+ */
+int chat_server_closing(struct ChatContext *cx);
+
+/**
+ * @brief Advance the coarse clock and remove the clients which sent nothing for the idle timeout
+ * @param context whose socket is used
+ * @return void
+ */
+void chat_server_idle_tick(struct ChatContext *cx);
+
+/**
+ * @brief Run one command typed on the server console: list, kick, broadcast and stats
+ * @param context whose socket is used
+ * @param zero terminated command line
+ * @return void
+ */
+void chat_server_command(struct ChatContext *cx, char *line);
+
+/**
+ * @brief Log the clients, rooms, rate limits, admission queue, history and metrics
+ * @param server
+ * @return void
+ */
+void chat_server_print_stats(struct ChatServer *s);
+
+/**
+ * @brief Write the number of clients and rooms to a metrics snapshot, called on the metrics thread
+ * @param output
+ * @return void
+ */
+void chat_server_gauges(FILE *out);
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file client_index.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Hash index from client address to client handle
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "client_index.h"
+
+/**
+ * @brief FNV-1a hash of the key, never 0 since 0 marks empty buckets
+ * @param key bytes
+ * @param key length
+ * @return hash
+ */
+static uint64_t hash_key(const void *key, size_t len) {
+	const unsigned char *p = key;
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h ? h : 1;
+}
+
+/**
+ * @brief Find the bucket of a key
+ * @param index
+ * @param key bytes
+ * @param key length
+ * @param hash of the key
+ * @return bucket or the empty bucket where the key would be inserted
+ */
+static unsigned find_bucket(const struct ClientIndex *ix, const void *key, size_t len, uint64_t h) {
+	unsigned b = h & ix->mask;
+	while (ix->hashes[b]) {
+		if (ix->hashes[b] == h) {
+			size_t klen;
+			const void *k = ix->key_of(ix->ids[b], &klen);
+			if (klen == len && memcmp(k, key, len) == 0)
+				return b;
+		}
+		b = (b + 1) & ix->mask;
+	}
+	return b;
+}
+
+/**
+ * @brief Allocate the buckets of an empty table
+ * @param index
+ * @param number of buckets, a power of two
+ * @return 0 on success, -1 if out of memory
+ */
+static int alloc_buckets(struct ClientIndex *ix, unsigned buckets) {
+	uint64_t *hashes = calloc(buckets, sizeof(uint64_t));
+	int *ids = calloc(buckets, sizeof(int));
+	if (!hashes || !ids) {
+		free(hashes);
+		free(ids);
+		return -1;
+	}
+	ix->hashes = hashes;
+	ix->ids = ids;
+	ix->mask = buckets - 1;
+	return 0;
+}
+
+/**
+ * @brief Double the table and rehash all entries
+ * @param index
+ * @return 0 on success, -1 if out of memory
+ */
+static int grow(struct ClientIndex *ix) {
+	uint64_t *hashes = ix->hashes;
+	int *ids = ix->ids;
+	unsigned buckets = ix->mask + 1;
+	if (alloc_buckets(ix, buckets * 2) < 0) return -1;
+
+	for (unsigned i = 0; i < buckets; i++) {
+		if (!hashes[i]) continue;
+		unsigned b = hashes[i] & ix->mask;
+		while (ix->hashes[b]) b = (b + 1) & ix->mask;
+		ix->hashes[b] = hashes[i];
+		ix->ids[b] = ids[i];
+	}
+	free(hashes);
+	free(ids);
+	return 0;
+}
+
+int client_index_init(struct ClientIndex *ix, int capacity, client_key_fn key_of) {
+	memset(ix, 0, sizeof(*ix));
+	/* keep the load factor at or below 50% */
+	unsigned buckets = 16;
+	while (buckets < 2u * (unsigned)capacity) buckets <<= 1;
+
+	if (alloc_buckets(ix, buckets) < 0) return -1;
+	ix->key_of = key_of;
+	return 0;
+}
+
+void client_index_free(struct ClientIndex *ix) {
+	free(ix->hashes);
+	free(ix->ids);
+	memset(ix, 0, sizeof(*ix));
+}
+
+int client_index_find(const struct ClientIndex *ix, const void *key, size_t len) {
+	unsigned b = find_bucket(ix, key, len, hash_key(key, len));
+	return ix->hashes[b] ? ix->ids[b] : -1;
+}
+
+int client_index_insert(struct ClientIndex *ix, const void *key, size_t len, int id) {
+	if (2 * (ix->count + 1) > ix->mask + 1 && grow(ix) < 0) return -1;
+	uint64_t h = hash_key(key, len);
+	unsigned b = h & ix->mask;
+	while (ix->hashes[b]) b = (b + 1) & ix->mask;
+
+	ix->hashes[b] = h;
+	ix->ids[b] = id;
+	ix->count++;
+	return 0;
+}
+
+int client_index_remove(struct ClientIndex *ix, const void *key, size_t len) {
+	unsigned b = find_bucket(ix, key, len, hash_key(key, len));
+	if (!ix->hashes[b]) return -1;
+	int id = ix->ids[b];
+
+	/* backward shift: move every following entry of the probe run into the
+	 * hole unless its home bucket lies cyclically between hole and entry */
+	unsigned hole = b, next = (b + 1) & ix->mask;
+	while (ix->hashes[next]) {
+		unsigned home = ix->hashes[next] & ix->mask;
+		if (((next - home) & ix->mask) >= ((next - hole) & ix->mask)) {
+			ix->hashes[hole] = ix->hashes[next];
+			ix->ids[hole] = ix->ids[next];
+			hole = next;
+		}
+		next = (next + 1) & ix->mask;
+	}
+	ix->hashes[hole] = 0;
+	ix->count--;
+	return id;
+}
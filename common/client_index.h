@@ -0,0 +1,74 @@
+/**
+ * @file client_index.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Hash index from client address to client handle
+ */
+
+#ifndef CLIENT_INDEX_H
+#define CLIENT_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returns the key bytes of a registered client, used to resolve hash collisions */
+typedef const void *(*client_key_fn)(int id, size_t *len);
+
+/* Open addressing with linear probing. Every bucket holds the full 64 bit hash
+ * of its key and the client handle, hash 0 marks an empty bucket. Removal
+ * shifts the following entries back, so there are no tombstones and lookups
+ * never degrade. The table doubles whenever it would become more than half
+ * full; the stored hashes are enough to rehash. */
+struct ClientIndex {
+	uint64_t *hashes;
+	int *ids;
+	unsigned mask;
+	unsigned count;
+	client_key_fn key_of;
+};
+
+/**
+ * @brief Allocate an index
+ * @param index
+ * @param number of clients to size the table for, it grows beyond that
+ * @param key lookup for registered slots
+ * @return 0 on success, -1 if out of memory
+ */
+int client_index_init(struct ClientIndex *ix, int capacity, client_key_fn key_of);
+
+/**
+ * @brief Free the index
+ * @param index
+ * @return void
+ */
+void client_index_free(struct ClientIndex *ix);
+
+/**
+ * @brief Find the handle of a client
+ * @param index
+ * @param key bytes
+ * @param key length
+ * @return handle or -1 if not present
+ */
+int client_index_find(const struct ClientIndex *ix, const void *key, size_t len);
+
+/**
+ * @brief Index a handle under key, key must not be present
+ * @param index
+ * @param key bytes
+ * @param key length
+ * @param handle
+ * @return 0 on success, -1 if out of memory
+ */
+int client_index_insert(struct ClientIndex *ix, const void *key, size_t len, int id);
+
+/**
+ * @brief Remove a client
+ * @param index
+ * @param key bytes
+ * @param key length
+ * @return former handle or -1 if not present
+ */
+int client_index_remove(struct ClientIndex *ix, const void *key, size_t len);
+
+#endif
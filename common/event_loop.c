@@ -0,0 +1,285 @@
+/**
+ * @file event_loop.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Event loop over sockets, stdin, timers and signals with epoll or io_uring
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <linux/io_uring.h>
+#include "event_loop.h"
+
+#define SOURCE_FD 0
+#define SOURCE_TIMER 1
+#define SOURCE_SIGNAL 2
+
+#define URING_ENTRIES 64
+
+/**
+ * @brief Map the submission and completion rings of a new io_uring instance
+ * @param io_uring state
+ * @return 0 on success, -1 if io_uring is not available
+ */
+static int uring_setup(struct EventUring *u) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	memset(u, 0, sizeof(*u));
+	u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (u->fd < 0) return -1;
+
+	u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_size > u->sq_size) u->sq_size = u->cq_size;
+		u->cq_size = u->sq_size;
+	}
+	u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_ptr == MAP_FAILED) goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_ptr = u->sq_ptr;
+	} else {
+		u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_ptr == MAP_FAILED) goto fail;
+	}
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) goto fail;
+
+	u->sq_head = (unsigned *)((char *)u->sq_ptr + p.sq_off.head);
+	u->sq_tail = (unsigned *)((char *)u->sq_ptr + p.sq_off.tail);
+	u->sq_mask = (unsigned *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)((char *)u->sq_ptr + p.sq_off.array);
+	u->cq_head = (unsigned *)((char *)u->cq_ptr + p.cq_off.head);
+	u->cq_tail = (unsigned *)((char *)u->cq_ptr + p.cq_off.tail);
+	u->cq_mask = (unsigned *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+	return 0;
+
+fail:
+	close(u->fd);
+	u->fd = -1;
+	return -1;
+}
+
+/**
+ * @brief Queue a one shot poll for incoming data on fd
+ * @param io_uring state
+ * @param file descriptor
+ * @param source index returned with the completion
+ * @return void
+ */
+static void uring_poll(struct EventUring *u, int fd, int source) {
+	unsigned tail = *u->sq_tail;
+	unsigned i = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = POLLIN;
+	sqe->user_data = source;
+	u->sq_array[i] = i;
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->queued++;
+}
+
+/**
+ * @brief Add a source to the loop and the backend
+ * @param loop
+ * @param file descriptor
+ * @param source kind
+ * @param callback
+ * @param callback context
+ * @return 0 on success, -1 on error
+ */
+static int add_source(struct EventLoop *loop, int fd, int kind, event_cb cb, void *ctx) {
+	int i;
+	for (i = 0; i < loop->n_sources; i++)
+		if (!loop->sources[i].active && loop->sources[i].fd < 0) break;
+	if (i == loop->n_sources) {
+		if (loop->n_sources == EVENT_MAX_SOURCES) return -1;
+		loop->n_sources++;
+	}
+	struct EventSource *s = &loop->sources[i];
+	s->fd = fd;
+	s->kind = kind;
+	s->cb = cb;
+	s->ctx = ctx;
+	s->active = 1;
+
+	if (loop->backend == EVENT_BACKEND_URING) {
+		uring_poll(&loop->uring, fd, i);
+		return 0;
+	}
+	struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		s->active = 0;
+		s->fd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+int event_loop_init(struct EventLoop *loop, int backend) {
+	memset(loop, 0, sizeof(*loop));
+	loop->epfd = -1;
+	loop->uring.fd = -1;
+	if (backend == EVENT_BACKEND_URING && uring_setup(&loop->uring) == 0) {
+		loop->backend = EVENT_BACKEND_URING;
+		return 0;
+	}
+	loop->backend = EVENT_BACKEND_EPOLL;
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	return loop->epfd < 0 ? -1 : 0;
+}
+
+int event_loop_add(struct EventLoop *loop, int fd, event_cb cb, void *ctx) {
+	return add_source(loop, fd, SOURCE_FD, cb, ctx);
+}
+
+void event_loop_del(struct EventLoop *loop, int fd) {
+	for (int i = 0; i < loop->n_sources; i++) {
+		struct EventSource *s = &loop->sources[i];
+		if (!s->active || s->fd != fd) continue;
+		if (loop->backend == EVENT_BACKEND_EPOLL) {
+			epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+			s->fd = -1;
+		}
+		/* with io_uring the slot stays reserved until its poll completes */
+		s->active = 0;
+	}
+}
+
+int event_loop_add_timer(struct EventLoop *loop, long interval_ms, event_cb cb, void *ctx) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) return -1;
+	struct itimerspec spec = {
+		.it_interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000 },
+		.it_value = { interval_ms / 1000, (interval_ms % 1000) * 1000000 }
+	};
+	if (timerfd_settime(fd, 0, &spec, NULL) < 0 || add_source(loop, fd, SOURCE_TIMER, cb, ctx) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int event_loop_timer_set(int fd, long delay_ms) {
+	/* a zero interval makes it one shot, a zero value stops it */
+	struct itimerspec spec = {
+		.it_value = { delay_ms / 1000, (delay_ms % 1000) * 1000000 }
+	};
+	return timerfd_settime(fd, 0, &spec, NULL);
+}
+
+int event_loop_add_signals(struct EventLoop *loop, const int *signals, int n, event_cb cb, void *ctx) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	for (int i = 0; i < n; i++) sigaddset(&mask, signals[i]);
+	if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) return -1;
+
+	int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0) return -1;
+	if (add_source(loop, fd, SOURCE_SIGNAL, cb, ctx) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief Read the timer or signal value and run the callback of a ready source
+ * @param loop
+ * @param source index
+ * @return void
+ */
+static void dispatch(struct EventLoop *loop, int i) {
+	struct EventSource *s = &loop->sources[i];
+	if (!s->active) return;
+
+	if (s->kind == SOURCE_TIMER) {
+		uint64_t expirations;
+		if (read(s->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+		s->cb(loop, s->fd, expirations, s->ctx);
+	} else if (s->kind == SOURCE_SIGNAL) {
+		struct signalfd_siginfo info;
+		while (read(s->fd, &info, sizeof(info)) == sizeof(info))
+			s->cb(loop, s->fd, info.ssi_signo, s->ctx);
+	} else {
+		s->cb(loop, s->fd, 0, s->ctx);
+	}
+}
+
+/**
+ * @brief Wait for and dispatch one round of events with epoll
+ * @param loop
+ * @return 0 on success, -1 on error
+ */
+static int run_epoll(struct EventLoop *loop) {
+	struct epoll_event events[EVENT_MAX_SOURCES];
+	int n = epoll_wait(loop->epfd, events, EVENT_MAX_SOURCES, -1);
+	if (n < 0) return errno == EINTR ? 0 : -1;
+	for (int k = 0; k < n && loop->running; k++)
+		dispatch(loop, events[k].data.u32);
+	return 0;
+}
+
+/**
+ * @brief Submit queued polls, wait for and dispatch completions with io_uring
+ * @param loop
+ * @return 0 on success, -1 on error
+ */
+static int run_uring(struct EventLoop *loop) {
+	struct EventUring *u = &loop->uring;
+	int ret = syscall(__NR_io_uring_enter, u->fd, u->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	if (ret < 0) return errno == EINTR ? 0 : -1;
+	u->queued -= ret;
+
+	unsigned head = *u->cq_head;
+	while (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+		int i = cqe->user_data;
+		head++;
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+		struct EventSource *s = &loop->sources[i];
+		if (!s->active) {
+			/* removed while the poll was pending, free the slot */
+			s->fd = -1;
+			continue;
+		}
+		if (loop->running) dispatch(loop, i);
+		/* polls are one shot, arm again unless the callback removed the source */
+		if (s->active) uring_poll(u, s->fd, i);
+		else s->fd = -1;
+	}
+	return 0;
+}
+
+int event_loop_run(struct EventLoop *loop) {
+	loop->running = 1;
+	while (loop->running) {
+		int ret = loop->backend == EVENT_BACKEND_URING ? run_uring(loop) : run_epoll(loop);
+		if (ret < 0) return -1;
+	}
+	return 0;
+}
+
+void event_loop_stop(struct EventLoop *loop) {
+	loop->running = 0;
+}
+
+const char *event_loop_backend(const struct EventLoop *loop) {
+	return loop->backend == EVENT_BACKEND_URING ? "io_uring" : "epoll";
+}
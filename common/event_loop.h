@@ -0,0 +1,131 @@
+/**
+ * @file event_loop.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Event loop over sockets, stdin, timers and signals with epoll or io_uring
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+
+#define EVENT_MAX_SOURCES 64
+
+#define EVENT_BACKEND_EPOLL 0
+#define EVENT_BACKEND_URING 1
+
+struct EventLoop;
+
+/* Called when fd is readable. Sockets and stdin have to be read by the
+ * callback, timerfd and signalfd are read by the loop before the call and
+ * value holds the number of expirations or the signal number. */
+typedef void (*event_cb)(struct EventLoop *loop, int fd, unsigned long value, void *ctx);
+
+struct EventSource {
+	int fd;
+	int kind;
+	bool active;
+	event_cb cb;
+	void *ctx;
+};
+
+/* Raw io_uring state, only used by the io_uring backend */
+struct EventUring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	unsigned long sq_size, cq_size, sqes_size;
+	unsigned queued;
+};
+
+struct EventLoop {
+	int backend;
+	int epfd;
+	struct EventUring uring;
+	struct EventSource sources[EVENT_MAX_SOURCES];
+	int n_sources;
+	bool running;
+};
+
+/**
+ * @brief Create the event loop
+ * @param loop
+ * @param EVENT_BACKEND_EPOLL or EVENT_BACKEND_URING, falls back to epoll if io_uring is not available
+ * @return 0 on success, -1 on error
+ */
+int event_loop_init(struct EventLoop *loop, int backend);
+
+/**
+ * @brief Watch a file descriptor for incoming data
+ * @param loop
+ * @param file descriptor
+ * @param callback
+ * @param callback context
+ * @return 0 on success, -1 on error
+ */
+int event_loop_add(struct EventLoop *loop, int fd, event_cb cb, void *ctx);
+
+/**
+ * @brief Stop watching a file descriptor, the descriptor is not closed
+ * @param loop
+ * @param file descriptor
+ * @return void
+ */
+void event_loop_del(struct EventLoop *loop, int fd);
+
+/**
+ * @brief Call cb periodically
+ * @param loop
+ * @param interval in milliseconds, 0 adds a stopped timer for event_loop_timer_set
+ * @param callback
+ * @param callback context
+ * @return timerfd or -1 on error
+ */
+int event_loop_add_timer(struct EventLoop *loop, long interval_ms, event_cb cb, void *ctx);
+
+/**
+ * @brief Let a timer of the loop expire once, e.g. at the next deadline of a protocol
+ * @param timerfd returned by event_loop_add_timer
+ * @param delay in milliseconds, 0 stops the timer
+ * @return 0 on success, -1 on error
+ */
+int event_loop_timer_set(int fd, long delay_ms);
+
+/**
+ * @brief Deliver signals through the loop instead of a signal handler. The
+ * signals are blocked for the calling thread and all threads it starts later.
+ * @param loop
+ * @param signal numbers
+ * @param number of signals
+ * @param callback
+ * @param callback context
+ * @return signalfd or -1 on error
+ */
+int event_loop_add_signals(struct EventLoop *loop, const int *signals, int n, event_cb cb, void *ctx);
+
+/**
+ * @brief Dispatch events until event_loop_stop is called
+ * @param loop
+ * @return 0 after stop, -1 on error
+ */
+int event_loop_run(struct EventLoop *loop);
+
+/**
+ * @brief Let event_loop_run return after the current callback
+ * @param loop
+ * @return void
+ */
+void event_loop_stop(struct EventLoop *loop);
+
+/**
+ * @brief Name of the backend in use
+ * @param loop
+ * @return "epoll" or "io_uring"
+ */
+const char *event_loop_backend(const struct EventLoop *loop);
+
+#endif
@@ -0,0 +1,448 @@
+/**
+ * @file history.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Append-only message history in memory mapped segment files
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "chat_proto.h"
+#include "history.h"
+#include "log.h"
+
+#define RECORD_ALIGN 8
+
+/**
+ * @brief Size of a record with its padding
+ * @param name length
+ * @param room name length
+ * @param text length
+ * @return record length
+ */
+static size_t record_size(size_t name_len, size_t room_len, size_t text_len) {
+	return (sizeof(struct HistoryRecord) + name_len + room_len + text_len + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+/**
+ * @brief Checksum of a record, covers everything after the sum
+ * @param record with valid lengths
+ * @return FNV-1a hash
+ */
+static uint32_t record_sum(const struct HistoryRecord *r) {
+	const uint8_t *p = (const uint8_t *)&r->time_ms;
+	const uint8_t *end = (const uint8_t *)r->data + r->name_len + r->room_len + r->text_len;
+	uint32_t sum = 2166136261u;
+	for (; p < end; p++) sum = (sum ^ *p) * 16777619u;
+	return sum;
+}
+
+/**
+ * @brief Path of a segment file
+ * @param history
+ * @param segment number
+ * @param output buffer of PATH_MAX bytes
+ * @return void
+ */
+static void segment_path(const struct History *h, unsigned long number, char *path) {
+	snprintf(path, PATH_MAX, "%s/history-%010lu.log", h->dir, number);
+}
+
+/**
+ * @brief Create a segment at full size and map it for appending
+ * @param history
+ * @param segment number
+ * @param segment
+ * @return 0 on success, -1 on error
+ */
+static int segment_create(const struct History *h, unsigned long number, struct HistorySegment *s) {
+	char path[PATH_MAX];
+	segment_path(h, number, path);
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, HISTORY_SEGMENT_BYTES) < 0) {
+		LOG_ERROR("Cant create history segment %s: %s", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	char *base = mmap(NULL, HISTORY_SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		LOG_ERROR("Cant map history segment %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	*s = (struct HistorySegment){ .number = number, .fd = fd, .base = base, .size = HISTORY_SEGMENT_BYTES, .writable = true };
+	return 0;
+}
+
+/**
+ * @brief Map a segment written before the start for reading, its valid records are counted as synced
+ * @param history
+ * @param segment number
+ * @param segment
+ * @return 0 on success, -1 if the segment is missing or empty
+ */
+static int segment_load(const struct History *h, unsigned long number, struct HistorySegment *s) {
+	char path[PATH_MAX];
+	struct stat st;
+	segment_path(h, number, path);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct HistoryRecord)) {
+		close(fd);
+		return -1;
+	}
+	size_t size = st.st_size < (off_t)HISTORY_SEGMENT_BYTES ? (size_t)st.st_size : HISTORY_SEGMENT_BYTES;
+	char *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	/* a segment of a crashed server ends at its first torn record */
+	size_t off = 0;
+	while (off + sizeof(struct HistoryRecord) <= size) {
+		const struct HistoryRecord *r = (const struct HistoryRecord *)(base + off);
+		if (!r->len || r->len != record_size(r->name_len, r->room_len, r->text_len) || off + r->len > size || r->sum != record_sum(r))
+			break;
+		off += r->len;
+	}
+	*s = (struct HistorySegment){ .number = number, .fd = fd, .base = base, .size = size, .used = off, .synced = off };
+	return 0;
+}
+
+/**
+ * @brief Unmap a segment and close its file, nothing is synced
+ * @param segment
+ * @return void
+ */
+static void segment_unmap(struct HistorySegment *s) {
+	if (!s->number) return;
+	munmap(s->base, s->size);
+	close(s->fd);
+	memset(s, 0, sizeof(*s));
+}
+
+/**
+ * @brief Sync a segment and close it, the file is cut to its records and removed if it has none
+ * @param history
+ * @param segment
+ * @return void
+ */
+static void segment_close(const struct History *h, struct HistorySegment *s) {
+	if (!s->number) return;
+	if (s->writable) {
+		char path[PATH_MAX];
+		if (s->used > s->synced) msync(s->base, s->used, MS_SYNC);
+		segment_path(h, s->number, path);
+		if (!s->used) unlink(path);
+		else if (ftruncate(s->fd, s->used) < 0) LOG_ERROR("Cant truncate history segment %s: %s", path, strerror(errno));
+	}
+	segment_unmap(s);
+}
+
+/**
+ * @brief Remember a message to all clients for replay, the lock must be held
+ * @param history
+ * @param record in a mapped segment
+ * @return void
+ */
+static void index_push(struct History *h, const struct HistoryRecord *r) {
+	if (h->head - h->tail == (unsigned long)h->replay) h->tail++;
+	h->index[h->head % h->replay] = r;
+	h->head++;
+}
+
+/**
+ * @brief Forget the indexed records of a segment which is about to be unmapped, the lock must be held
+ * @param history
+ * @param segment
+ * @return void
+ */
+static void index_evict(struct History *h, const struct HistorySegment *s) {
+	/* the index is in append order, records of an older segment are at its tail */
+	while (h->tail != h->head) {
+		const char *r = (const char *)h->index[h->tail % h->replay];
+		if (r < s->base || r >= s->base + s->size) break;
+		h->tail++;
+	}
+}
+
+/**
+ * @brief Index the messages to all clients of a loaded segment
+ * @param history
+ * @param segment
+ * @return void
+ */
+static void index_segment(struct History *h, const struct HistorySegment *s) {
+	for (size_t off = 0; off < s->used; ) {
+		const struct HistoryRecord *r = (const struct HistoryRecord *)(s->base + off);
+		if (!r->room_len) index_push(h, r);
+		off += r->len;
+	}
+}
+
+/**
+ * @brief Continue with the next segment, the lock must be held
+ * @param history
+ * @return 0 on success, -1 if no segment can be opened
+ */
+static int rotate(struct History *h) {
+	if (!h->spare.number) {
+		/* the writer did not keep up, the receive loop has to create the file */
+		if (segment_create(h, h->cur.number + 1, &h->spare) < 0) return -1;
+		h->inline_opens++;
+	}
+	if (h->retired.number) {
+		if (h->retired.number == h->syncing[0] || h->retired.number == h->syncing[1]) return -1;
+		segment_close(h, &h->retired);
+	}
+	index_evict(h, &h->prev);
+	h->retired = h->prev;
+	h->prev = h->cur;
+	h->cur = h->spare;
+	memset(&h->spare, 0, sizeof(h->spare));
+	h->rotations++;
+	return 0;
+}
+
+/**
+ * @brief One round of the writer thread: sync, create the next segment, close the retired one
+ * @param history
+ * @return void
+ */
+static void writer_round(struct History *h) {
+	struct HistorySegment retired, spare;
+	struct { unsigned long number; char *base; size_t from, to; } work[2];
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned long next = 0;
+
+	pthread_mutex_lock(&h->lock);
+	retired = h->retired;
+	memset(&h->retired, 0, sizeof(h->retired));
+	struct HistorySegment *segs[2] = { &h->prev, &h->cur };
+	for (int k = 0; k < 2; k++) {
+		struct HistorySegment *s = segs[k];
+		work[k].number = s->writable && s->used > s->synced ? s->number : 0;
+		work[k].base = s->base;
+		work[k].from = s->synced & ~(size_t)(page - 1);
+		work[k].to = s->used;
+		h->syncing[k] = work[k].number;
+	}
+	if (!h->spare.number) next = h->cur.number + 1;
+	pthread_mutex_unlock(&h->lock);
+
+	/* all records appended since the last round go to disk together */
+	for (int k = 0; k < 2; k++) {
+		if (work[k].number) msync(work[k].base + work[k].from, work[k].to - work[k].from, MS_SYNC);
+	}
+	segment_close(h, &retired);
+	if (next && segment_create(h, next, &spare) < 0) next = 0;
+
+	pthread_mutex_lock(&h->lock);
+	for (int k = 0; k < 2; k++) {
+		if (!work[k].number) continue;
+		h->syncs++;
+		/* the segment may have moved on in the meantime */
+		struct HistorySegment *s = h->cur.number == work[k].number ? &h->cur : h->prev.number == work[k].number ? &h->prev :
+			h->retired.number == work[k].number ? &h->retired : NULL;
+		if (s && s->synced < work[k].to) s->synced = work[k].to;
+		h->syncing[k] = 0;
+	}
+	if (next && !h->spare.number && h->cur.number + 1 == next) {
+		h->spare = spare;
+		next = 0;
+	}
+	pthread_mutex_unlock(&h->lock);
+	/* the receive loop created the segment itself, it is mapped twice now */
+	if (next) segment_unmap(&spare);
+}
+
+/**
+ * @brief Writer thread, runs a round every HISTORY_SYNC_MS until history_close
+ * @param history
+ * @return void*
+ */
+static void *writer_thread(void *arg) {
+	struct History *h = arg;
+	struct timespec interval = { HISTORY_SYNC_MS / 1000, (HISTORY_SYNC_MS % 1000) * 1000000L };
+	/* signals are handled by the server, never by the writer */
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+	while (!__atomic_load_n(&h->stop, __ATOMIC_ACQUIRE)) {
+		writer_round(h);
+		nanosleep(&interval, NULL);
+	}
+	return NULL;
+}
+
+int history_open(struct History *h, const char *dir, int replay) {
+	memset(h, 0, sizeof(*h));
+	if (strlen(dir) >= sizeof(h->dir)) return -1;
+	strcpy(h->dir, dir);
+	h->replay = replay < 1 ? 1 : replay > HISTORY_MAX_REPLAY ? HISTORY_MAX_REPLAY : replay;
+	if (!(h->index = calloc(h->replay, sizeof(*h->index)))) return -1;
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		LOG_ERROR("Cant create history directory %s: %s", dir, strerror(errno));
+		free(h->index);
+		return -1;
+	}
+
+	/* the newest segment is the one with the highest number */
+	unsigned long last = 0, number;
+	DIR *d = opendir(dir);
+	struct dirent *e;
+	while (d && (e = readdir(d))) {
+		char tail[8];
+		if (sscanf(e->d_name, "history-%lu%7s", &number, tail) == 2 && strcmp(tail, ".log") == 0 && number > last) last = number;
+	}
+	if (d) closedir(d);
+
+	/* segments of an earlier run are only read, appending starts in a new one.
+	 * A crashed run may have left the segment the writer created ahead empty. */
+	for (number = last; number > 0 && number + 2 > last; number--) {
+		if (segment_load(h, number, &h->prev) < 0) continue;
+		if (h->prev.used) break;
+		segment_unmap(&h->prev);
+	}
+	if (h->prev.number) index_segment(h, &h->prev);
+	if (segment_create(h, last + 1, &h->cur) < 0) {
+		segment_unmap(&h->prev);
+		free(h->index);
+		return -1;
+	}
+	pthread_mutex_init(&h->lock, NULL);
+	if (pthread_create(&h->writer, NULL, writer_thread, h) != 0) {
+		history_close(h);
+		return -1;
+	}
+	h->writer_running = true;
+	LOG_INFO("History in %s, segment %lu, %lu messages to replay", dir, h->cur.number, h->head - h->tail);
+	return 0;
+}
+
+void history_close(struct History *h) {
+	if (!h->cur.number) return;
+	if (h->writer_running) {
+		__atomic_store_n(&h->stop, 1, __ATOMIC_RELEASE);
+		pthread_join(h->writer, NULL);
+		h->writer_running = false;
+	}
+	/* workers of a server may still append while it exits, they find it closed */
+	pthread_mutex_lock(&h->lock);
+	segment_close(h, &h->retired);
+	segment_close(h, &h->prev);
+	segment_close(h, &h->cur);
+	segment_close(h, &h->spare);
+	h->head = h->tail = 0;
+	free(h->index);
+	h->index = NULL;
+	pthread_mutex_unlock(&h->lock);
+}
+
+int history_append(struct History *h, uint32_t sender, const char *name, size_t name_len, const char *room, size_t room_len,
+		const char *text, size_t text_len) {
+	struct timespec ts;
+	if (!room) room_len = 0;
+	size_t size = record_size(name_len, room_len, text_len);
+	if (name_len > UINT8_MAX || room_len > UINT8_MAX || text_len > UINT16_MAX) {
+		__atomic_add_fetch(&h->dropped, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	pthread_mutex_lock(&h->lock);
+	if (!h->cur.number || (h->cur.used + size > h->cur.size && rotate(h) < 0)) {
+		h->dropped++;
+		pthread_mutex_unlock(&h->lock);
+		return -1;
+	}
+	struct HistoryRecord *r = (struct HistoryRecord *)(h->cur.base + h->cur.used);
+	r->time_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	r->sender = sender;
+	r->text_len = text_len;
+	r->name_len = name_len;
+	r->room_len = room_len;
+	memcpy(r->data, name, name_len);
+	if (room_len) memcpy(r->data + name_len, room, room_len);
+	memcpy(r->data + name_len + room_len, text, text_len);
+	r->sum = record_sum(r);
+	/* the length makes the record valid, it is stored last */
+	__atomic_store_n(&r->len, size, __ATOMIC_RELEASE);
+	h->cur.used += size;
+	h->appended++;
+	if (!room_len) index_push(h, r);
+	pthread_mutex_unlock(&h->lock);
+	return 0;
+}
+
+char *history_tail(struct History *h, int n, size_t *len, int *count) {
+	char *buf = NULL;
+	*len = 0;
+	*count = 0;
+	if (n < 1) return NULL;
+	pthread_mutex_lock(&h->lock);
+	unsigned long first = h->head - h->tail > (unsigned long)n ? h->head - n : h->tail;
+	for (unsigned long k = first; k != h->head; k++)
+		*len += h->index[k % h->replay]->len;
+	if (*len && (buf = malloc(*len))) {
+		size_t off = 0;
+		for (unsigned long k = first; k != h->head; k++) {
+			const struct HistoryRecord *r = h->index[k % h->replay];
+			memcpy(buf + off, r, r->len);
+			off += r->len;
+		}
+		*count = h->head - first;
+	}
+	pthread_mutex_unlock(&h->lock);
+	if (!buf) *len = 0;
+	return buf;
+}
+
+int history_render(const char *tail, size_t len, bool binary, size_t pack, char *out, struct iovec *iov) {
+	int n = 0;
+	size_t o = 0;
+	for (size_t off = 0; off < len; ) {
+		const struct HistoryRecord *r = (const struct HistoryRecord *)(tail + off);
+		const char *text = r->data + r->name_len + r->room_len;
+		size_t prefix = r->name_len ? r->name_len + 3 : 0, text_len = prefix + r->text_len;
+		off += r->len;
+		if (text_len > UINT16_MAX) continue;
+
+		/* "[name] text" as a text client shows a message, always shorter than the record */
+		char *p = out + o, *t = binary ? p + CHAT_HEADER_LEN : p;
+		if (prefix) {
+			t[0] = '[';
+			memcpy(t + 1, r->data, r->name_len);
+			memcpy(t + 1 + r->name_len, "] ", 2);
+		}
+		memcpy(t + prefix, text, r->text_len);
+		size_t dlen = text_len;
+		if (binary) dlen += chat_pack(p, CHAT_MESSAGE, CHAT_FLAG_FORMATTED | CHAT_FLAG_HISTORY, r->sender, 0, text_len);
+		o += dlen;
+
+		if (binary && pack && n && iov[n - 1].iov_len + dlen <= pack) {
+			iov[n - 1].iov_len += dlen;
+		} else {
+			iov[n].iov_base = p;
+			iov[n].iov_len = dlen;
+			n++;
+		}
+	}
+	return n;
+}
+
+void history_print_stats(struct History *h) {
+	if (!h->cur.number) return;
+	LOG_INFO("History: %lu messages appended, %lu dropped, %lu syncs, %lu segments rotated (%lu opened by the receive loop)",
+		h->appended, h->dropped, h->syncs, h->rotations, h->inline_opens);
+}
@@ -0,0 +1,135 @@
+/**
+ * @file history.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Append-only message history in memory mapped segment files
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#define HISTORY_SEGMENT_BYTES (4ul << 20) /* size of one segment file */
+#define HISTORY_SYNC_MS 200 /* the writer thread syncs the appended records this often */
+#define HISTORY_DEFAULT_REPLAY 50 /* messages sent to a new client */
+#define HISTORY_MAX_REPLAY 1000
+#define HISTORY_PATH_LEN 256
+
+/* Record as stored in a segment, in host byte order and 8 byte aligned.
+ * data holds the sender name, the room name and the text without gaps, an
+ * empty room is a message to all clients, a record without a name holds a
+ * text which already starts with the sender. len is written last, a record
+ * whose len is 0 or whose sum does not match ends the segment, so a record
+ * torn by a crash is never replayed. */
+struct HistoryRecord {
+	uint32_t len; /* whole record with padding */
+	uint32_t sum; /* FNV-1a of everything after it */
+	uint64_t time_ms; /* wall clock */
+	uint32_t sender; /* handle of the sender at that time */
+	uint16_t text_len;
+	uint8_t name_len;
+	uint8_t room_len;
+	char data[];
+};
+
+struct HistorySegment {
+	unsigned long number; /* 0 if not open */
+	int fd;
+	char *base;
+	size_t size; /* mapped bytes */
+	size_t used; /* appended bytes */
+	size_t synced; /* bytes known to be on disk */
+	bool writable; /* created by this run, segments of an earlier run are only read */
+};
+
+/* Segments are files history-NUMBER.log, created at full size and mapped
+ * shared, so appending a record is a copy into the mapping under a short
+ * lock and no system call. The writer thread syncs everything appended since
+ * its last round with one msync, creates the next segment ahead of time and
+ * closes the retired one, so the receive loop only touches files if it fills
+ * a segment faster than the writer keeps up. The last messages to all clients
+ * are found through a ring of pointers into the current and the previous
+ * segment, both stay mapped. A closed segment is cut to its records. On
+ * open the newest segment of the last run is mapped read only as the previous
+ * segment and the index is rebuilt from it, appending starts in a new one. */
+struct History {
+	char dir[HISTORY_PATH_LEN];
+	pthread_mutex_t lock;
+	struct HistorySegment cur, prev, spare, retired;
+	const struct HistoryRecord **index;
+	int replay; /* capacity of the index */
+	unsigned long head, tail; /* records in the index, head - tail <= replay */
+	pthread_t writer;
+	bool writer_running;
+	int stop;
+	unsigned long syncing[2]; /* segments the writer is syncing outside of the lock */
+	unsigned long appended, dropped, syncs, rotations, inline_opens;
+};
+
+/**
+ * @brief Open the history in a directory, recover the index and start the writer thread
+ * @param history
+ * @param directory, created if missing
+ * @param number of messages kept for replay, at most HISTORY_MAX_REPLAY
+ * @return 0 on success, -1 if the directory or a segment cant be opened
+ */
+int history_open(struct History *h, const char *dir, int replay);
+
+/**
+ * @brief Sync all records, stop the writer thread and unmap all segments
+ * @param history
+ * @return void
+ */
+void history_close(struct History *h);
+
+/**
+ * @brief Append one message, never blocks on the disk unless a segment has to be created
+ * @param history
+ * @param sender handle
+ * @param sender name, not zero terminated
+ * @param name length, at most 255, 0 if the text already starts with the sender
+ * @param room name or NULL for a message to all clients
+ * @param room name length, at most 255
+ * @param text
+ * @param text length
+ * @return 0 on success, -1 if the record is dropped
+ */
+int history_append(struct History *h, uint32_t sender, const char *name, size_t name_len, const char *room, size_t room_len,
+	const char *text, size_t text_len);
+
+/**
+ * @brief Copy the last messages to all clients, oldest first
+ * @param history
+ * @param maximum number of messages
+ * @param length of the copy
+ * @param number of copied records
+ * @return malloced records, to be freed by the caller, or NULL if there are none
+ */
+char *history_tail(struct History *h, int n, size_t *len, int *count);
+
+/**
+ * @brief Render copied records as datagrams for one client, a MESSAGE frame with the
+ * flags CHAT_FLAG_FORMATTED and CHAT_FLAG_HISTORY or a text line per record
+ * @param records from history_tail
+ * @param length of the records
+ * @param true for frames, false for the text protocol
+ * @param frames are packed into datagrams up to this size, 0 for one frame per datagram
+ * @param output buffer, at least as long as the records
+ * @param one iovec per datagram, at least one per record
+ * @return number of datagrams
+ */
+int history_render(const char *tail, size_t len, bool binary, size_t pack, char *out, struct iovec *iov);
+
+/**
+ * @brief Log the counters of the history
+ * @param history
+ * @return void
+ */
+void history_print_stats(struct History *h);
+
+#endif
@@ -0,0 +1,182 @@
+/**
+ * @file log.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Asynchronous logging through per thread rings and a writer thread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "log.h"
+
+struct LogRecord {
+	time_t t;
+	int level;
+	char text[LOG_LINE_LEN];
+};
+
+/* Single producer single consumer ring. The owning thread only writes head,
+ * the writer thread only writes tail, both are accessed atomically. */
+struct LogRing {
+	struct LogRing *next;
+	unsigned long head;
+	unsigned long tail;
+	unsigned long dropped;
+	struct LogRecord records[LOG_RING_SLOTS];
+};
+
+bool log_debug = 0;
+
+static struct LogRing *rings;
+static __thread struct LogRing *own_ring;
+static pthread_t writer;
+static bool writer_running;
+static int stop;
+/* futex word of the writer, bumped after every queued message, and whether
+ * the writer sleeps on it, so a message only costs a wake up when it does */
+static uint32_t wakeup;
+static int sleeping;
+
+static const char *level_tag[] = { "DEBUG", "SERVER", "ERROR" };
+
+/**
+ * @brief Bump the futex word and wake the writer if it sleeps
+ * @param void
+ * @return void
+ */
+static void wake_writer(void) {
+	__atomic_add_fetch(&wakeup, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST))
+		syscall(SYS_futex, &wakeup, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+ * @brief Get the ring of the calling thread, register it on first use
+ * @param void
+ * @return ring or NULL if out of memory
+ */
+static struct LogRing *thread_ring(void) {
+	if (own_ring) return own_ring;
+	struct LogRing *r = calloc(1, sizeof(*r));
+	if (!r) return NULL;
+	/* lock free push onto the list the writer walks */
+	r->next = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+	own_ring = r;
+	return r;
+}
+
+void log_write(int level, const char *fmt, ...) {
+	struct LogRing *r = thread_ring();
+	if (!r) return;
+
+	unsigned long head = r->head;
+	if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS) {
+		__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	struct LogRecord *rec = &r->records[head % LOG_RING_SLOTS];
+	rec->t = time(NULL);
+	rec->level = level;
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(rec->text, sizeof(rec->text), fmt, ap);
+	va_end(ap);
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	wake_writer();
+}
+
+/**
+ * @brief Format a timestamp, the string is only rebuilt once per second
+ * @param time
+ * @return time string
+ */
+static const char *timestamp(time_t t) {
+	static time_t cached_t = -1;
+	static char t_str[16];
+	if (t != cached_t) {
+		struct tm tmp;
+		localtime_r(&t, &tmp);
+		strftime(t_str, sizeof(t_str), "%Y%m%d_%H%M%S", &tmp);
+		cached_t = t;
+	}
+	return t_str;
+}
+
+/**
+ * @brief Write all queued messages of all rings to stdout
+ * @param void
+ * @return number of written messages
+ */
+static int drain(void) {
+	int written = 0;
+	for (struct LogRing *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+		unsigned long tail = r->tail;
+		unsigned long head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		for (; tail != head; tail++) {
+			struct LogRecord *rec = &r->records[tail % LOG_RING_SLOTS];
+			fprintf(stdout, "%s:%s: %s\n", timestamp(rec->t), level_tag[rec->level], rec->text);
+			written++;
+		}
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+	if (written) fflush(stdout);
+	return written;
+}
+
+/**
+ * @brief Writer thread, drains the rings until log_shutdown
+ * @param unused
+ * @return void*
+ */
+static void *writer_thread(void *arg) {
+	/* signals are handled by the server, never by the writer */
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+	while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+		if (drain()) continue;
+		/* read the futex word before the last look at the rings, a message
+		 * queued in between changes the word and the wait returns at once */
+		uint32_t seen = __atomic_load_n(&wakeup, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&sleeping, 1, __ATOMIC_SEQ_CST);
+		if (!drain() && !__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+			syscall(SYS_futex, &wakeup, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+		__atomic_store_n(&sleeping, 0, __ATOMIC_RELAXED);
+	}
+	drain();
+	return NULL;
+}
+
+int log_init(void) {
+	if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) return -1;
+	writer_running = 1;
+	return 0;
+}
+
+void log_shutdown(void) {
+	if (writer_running && !pthread_equal(pthread_self(), writer)) {
+		__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+		wake_writer();
+		pthread_join(writer, NULL);
+		writer_running = 0;
+	} else {
+		drain();
+	}
+}
+
+unsigned long log_dropped(void) {
+	unsigned long dropped = 0;
+	for (struct LogRing *r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next)
+		dropped += __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+	return dropped;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file log.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Asynchronous logging through per thread rings and a writer thread
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+
+#define LOG_LVL_DEBUG 0
+#define LOG_LVL_INFO 1
+#define LOG_LVL_ERROR 2
+
+/* Levels below LOG_MIN_LEVEL are removed by the compiler,
+ * e.g. make LOG_MIN_LEVEL=1 drops all debug messages */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LVL_DEBUG
+#endif
+
+#define LOG_RING_SLOTS 1024 /* messages buffered per thread */
+#define LOG_LINE_LEN 256 /* longer messages are truncated */
+
+/* Debug messages are only written if this is set, e.g. by -d */
+extern bool log_debug;
+
+/* Guard for work which is only needed by debug messages */
+#define LOG_DEBUG_ENABLED (LOG_LVL_DEBUG >= LOG_MIN_LEVEL && log_debug)
+
+#define LOG_DEBUG(...) do { \
+	if (LOG_DEBUG_ENABLED) log_write(LOG_LVL_DEBUG, __VA_ARGS__); \
+} while (0)
+#define LOG_INFO(...) do { \
+	if (LOG_LVL_INFO >= LOG_MIN_LEVEL) log_write(LOG_LVL_INFO, __VA_ARGS__); \
+} while (0)
+#define LOG_ERROR(...) do { \
+	if (LOG_LVL_ERROR >= LOG_MIN_LEVEL) log_write(LOG_LVL_ERROR, __VA_ARGS__); \
+} while (0)
+
+/**
+ * @brief Start the writer thread
+ * @param void
+ * @return 0 on success, -1 if the thread cant be started
+ */
+int log_init(void);
+
+/**
+ * @brief Queue one message in the ring of the calling thread, never blocks.
+ * If the ring is full the message is dropped and counted.
+ * @param level
+ * @param printf format
+ * @return void
+ */
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Write all queued messages and stop the writer thread
+ * @param void
+ * @return void
+ */
+void log_shutdown(void);
+
+/**
+ * @brief Number of messages dropped because a ring was full
+ * @param void
+ * @return dropped messages of all threads
+ */
+unsigned long log_dropped(void);
+
+#endif
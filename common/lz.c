@@ -0,0 +1,166 @@
+/**
+ * @file lz.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Byte oriented LZ77 compression of single payloads in the LZ4 block format
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5 /* a block ends with at least this many literals */
+#define LZ_MATCH_LIMIT 12 /* no match starts closer to the end of the input */
+#define LZ_HASH_BITS 12 /* 8 KB match table on the stack */
+
+/**
+ * @brief Unaligned 4 byte load
+ * @param position
+ * @return value
+ */
+static uint32_t read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/**
+ * @brief Slot of 4 bytes in the match table
+ * @param 4 bytes
+ * @return slot
+ */
+static uint32_t hash(uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * @brief Write the rest of a length which did not fit into its nibble
+ * @param output
+ * @param length minus 15
+ * @return output behind the length
+ */
+static uint8_t *put_length(uint8_t *op, size_t len) {
+	for (; len >= 255; len -= 255) *op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/**
+ * @brief Write one sequence, the caller checked that it fits
+ * @param output
+ * @param literals
+ * @param number of literals
+ * @param match offset, 0 for the last sequence which has no match
+ * @param match length minus LZ_MIN_MATCH
+ * @return output behind the sequence
+ */
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *lit, size_t lit_len, size_t offset, size_t match) {
+	uint8_t *token = op++;
+	*token = (lit_len < 15 ? lit_len : 15) << 4;
+	if (lit_len >= 15) op = put_length(op, lit_len - 15);
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+	if (!offset) return op;
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	*token |= match < 15 ? match : 15;
+	if (match >= 15) op = put_length(op, match - 15);
+	return op;
+}
+
+/**
+ * @brief Worst case size of a sequence
+ * @param number of literals
+ * @param match length minus LZ_MIN_MATCH
+ * @return bytes
+ */
+static size_t sequence_bound(size_t lit_len, size_t match) {
+	return 1 + lit_len / 255 + 1 + lit_len + 2 + match / 255 + 1;
+}
+
+size_t lz_compress(const void *src, size_t n, void *dst, size_t size) {
+	const uint8_t *in = src, *ip = in, *anchor = in, *end = in + n;
+	uint8_t *op = dst;
+	/* positions of the last 4 bytes with each hash, 0 is checked like any other candidate */
+	uint16_t table[1 << LZ_HASH_BITS] = { 0 };
+
+	if (n > LZ_MAX_INPUT) return 0;
+	if (n > LZ_MATCH_LIMIT) {
+		const uint8_t *limit = end - LZ_MATCH_LIMIT, *match_end = end - LZ_LAST_LITERALS;
+		while (ip < limit) {
+			uint32_t seq = read32(ip), h = hash(seq);
+			const uint8_t *ref = in + table[h];
+			table[h] = ip - in;
+			if (ref >= ip || read32(ref) != seq) {
+				ip++;
+				continue;
+			}
+			/* the match may start before the 4 bytes which were found */
+			while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+			size_t offset = ip - ref;
+			const uint8_t *mend = ip + LZ_MIN_MATCH;
+			while (mend < match_end && *mend == mend[-offset]) mend++;
+
+			size_t lit_len = ip - anchor, match = mend - ip - LZ_MIN_MATCH;
+			if (sequence_bound(lit_len, match) > size - (op - (uint8_t *)dst)) return 0;
+			op = put_sequence(op, anchor, lit_len, offset, match);
+			anchor = ip = mend;
+			/* the end of a match is the likely start of the next one */
+			table[hash(read32(mend - 2))] = mend - 2 - in;
+		}
+	}
+	size_t lit_len = end - anchor;
+	if (sequence_bound(lit_len, 0) - 3 > size - (op - (uint8_t *)dst)) return 0;
+	op = put_sequence(op, anchor, lit_len, 0, 0);
+	return op - (uint8_t *)dst;
+}
+
+/**
+ * @brief Read the rest of a length which filled its nibble
+ * @param input position, advanced
+ * @param end of the input
+ * @param length so far
+ * @return length or SIZE_MAX if the input ends inside the length
+ */
+static size_t get_length(const uint8_t **ip, const uint8_t *end, size_t len) {
+	uint8_t b;
+	do {
+		if (*ip >= end) return SIZE_MAX;
+		b = *(*ip)++;
+		len += b;
+	} while (b == 255);
+	return len;
+}
+
+int lz_decompress(const void *src, size_t n, void *dst, size_t size) {
+	const uint8_t *ip = src, *end = ip + n;
+	uint8_t *out = dst, *op = out;
+
+	while (ip < end) {
+		unsigned token = *ip++;
+		size_t lit_len = token >> 4;
+		if (lit_len == 15 && (lit_len = get_length(&ip, end, lit_len)) == SIZE_MAX) return -1;
+		if (lit_len > (size_t)(end - ip) || lit_len > size - (op - out)) return -1;
+		memcpy(op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+		/* the last sequence has no match */
+		if (ip == end) break;
+
+		if (end - ip < 2) return -1;
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - out)) return -1;
+		size_t match = token & 15;
+		if (match == 15 && (match = get_length(&ip, end, match)) == SIZE_MAX) return -1;
+		match += LZ_MIN_MATCH;
+		if (match > size - (op - out)) return -1;
+		/* byte by byte, a match may overlap the bytes it writes */
+		for (const uint8_t *ref = op - offset; match; match--) *op++ = *ref++;
+	}
+	return op - out;
+}
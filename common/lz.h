@@ -0,0 +1,43 @@
+/**
+ * @file lz.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Byte oriented LZ77 compression of single payloads in the LZ4 block format
+ */
+
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+/* Matches point at most this far back, so a payload up to this size is
+ * compressed with a match table of 16 bit positions */
+#define LZ_MAX_INPUT 65535
+
+/* A block is a list of sequences. Every sequence starts with a token byte,
+ * the high nibble is the number of literals, the low nibble the match length
+ * minus 4, 15 in either continues with bytes of 255 and a last smaller byte.
+ * The literals follow, then the match offset as 2 bytes little endian and the
+ * rest of the match length. The last sequence has only literals. */
+
+/**
+ * @brief Compress a payload, greedy with a single hash probe per position
+ * @param input
+ * @param input length, at most LZ_MAX_INPUT
+ * @param output
+ * @param output size
+ * @return compressed length or 0 if it does not fit into the output
+ */
+size_t lz_compress(const void *src, size_t n, void *dst, size_t size);
+
+/**
+ * @brief Decompress a block, every length and offset is checked against both buffers
+ * @param compressed block
+ * @param block length
+ * @param output
+ * @param output size
+ * @return decompressed length or -1 if the block is invalid or does not fit into the output
+ */
+int lz_decompress(const void *src, size_t n, void *dst, size_t size);
+
+#endif
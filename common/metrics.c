@@ -0,0 +1,353 @@
+/**
+ * @file metrics.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Per thread counters and latency histograms, served in the Prometheus text format
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics.h"
+#include "log.h"
+
+#define METRICS_REQUEST_LEN 1024 /* the rest of a longer request is not read */
+#define METRICS_READ_TIMEOUT_S 1 /* a scraper which sends nothing gets the snapshot after this long */
+#define METRICS_CACHE_LINE 64
+
+/* Counters and histogram of one thread. Only the owning thread writes, so an
+ * update is a relaxed load and store without a locked instruction and never
+ * waits for anything; the snapshot reads every value atomically, a snapshot
+ * taken during an update may miss it. Shards are cache line aligned, so the
+ * workers dont share lines. */
+struct MetricsShard {
+	struct MetricsShard *next;
+	uint64_t counters[METRIC_COUNTERS];
+	uint64_t sum_ns;
+	uint64_t buckets[METRICS_BUCKETS];
+} __attribute__((aligned(METRICS_CACHE_LINE)));
+
+/* Sum of all shards */
+struct MetricsTotals {
+	uint64_t counters[METRIC_COUNTERS];
+	uint64_t sum_ns;
+	uint64_t count;
+	uint64_t buckets[METRICS_BUCKETS];
+};
+
+static struct MetricsShard *shards;
+static __thread struct MetricsShard *own_shard;
+static int listen_fd = -1;
+static char unix_path[METRICS_PATH_LEN];
+static metrics_gauges_cb server_gauges;
+static pthread_t server;
+
+static const char *counter_name[METRIC_COUNTERS] = {
+	"uchat_rx_datagrams_total",
+	"uchat_rx_bytes_total",
+	"uchat_tx_datagrams_total",
+	"uchat_tx_bytes_total",
+	"uchat_registrations_total",
+	"uchat_rejects_total",
+	"uchat_disconnects_total",
+	"uchat_send_errors_total",
+	"uchat_drops_total"
+};
+
+static const char *counter_help[METRIC_COUNTERS] = {
+	"Datagrams received",
+	"Bytes received",
+	"Datagrams sent",
+	"Bytes sent",
+	"Clients registered",
+	"Registrations refused because the server is full",
+	"Clients removed, on request, kicked or timed out",
+	"Datagrams which could not be sent",
+	"Received datagrams dropped, invalid or over a rate limit"
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+/**
+ * @brief Get the shard of the calling thread, register it on first use
+ * @param void
+ * @return shard or NULL if out of memory
+ */
+static struct MetricsShard *thread_shard(void) {
+	if (own_shard) return own_shard;
+	void *mem;
+	if (posix_memalign(&mem, METRICS_CACHE_LINE, sizeof(struct MetricsShard)) != 0) return NULL;
+	struct MetricsShard *s = memset(mem, 0, sizeof(struct MetricsShard));
+	/* lock free push onto the list the snapshot walks */
+	s->next = __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(&shards, &s->next, s, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+	own_shard = s;
+	return s;
+}
+
+/**
+ * @brief Add to a value only the calling thread writes
+ * @param value
+ * @param amount
+ * @return void
+ */
+static inline void bump(uint64_t *v, uint64_t n) {
+	__atomic_store_n(v, __atomic_load_n(v, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Histogram bucket of a latency
+ * @param latency in nanoseconds
+ * @return bucket index
+ */
+static int bucket_of(uint64_t ns) {
+	if (ns < METRICS_SUB_BUCKETS) return ns;
+	int e = 63 - __builtin_clzll(ns);
+	if (e > METRICS_MAX_EXP) return METRICS_BUCKETS - 1;
+	return (e - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS + ((ns >> (e - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief Smallest latency of a bucket
+ * @param bucket index
+ * @return nanoseconds
+ */
+static uint64_t bucket_lower(int i) {
+	if (i < METRICS_SUB_BUCKETS) return i;
+	return (uint64_t)(METRICS_SUB_BUCKETS + i % METRICS_SUB_BUCKETS) << (i / METRICS_SUB_BUCKETS - 1);
+}
+
+void metrics_add(int counter, uint64_t n) {
+	struct MetricsShard *s = thread_shard();
+	if (s) bump(&s->counters[counter], n);
+}
+
+void metrics_sent(ssize_t result) {
+	struct MetricsShard *s = thread_shard();
+	if (!s) return;
+	if (result < 0) {
+		bump(&s->counters[METRIC_SEND_ERRORS], 1);
+		return;
+	}
+	bump(&s->counters[METRIC_TX_DATAGRAMS], 1);
+	bump(&s->counters[METRIC_TX_BYTES], result);
+}
+
+void metrics_latency(uint64_t ns) {
+	struct MetricsShard *s = thread_shard();
+	if (!s) return;
+	bump(&s->buckets[bucket_of(ns)], 1);
+	bump(&s->sum_ns, ns);
+}
+
+/**
+ * @brief Sum up the shards of all threads
+ * @param totals
+ * @return void
+ */
+static void collect(struct MetricsTotals *t) {
+	memset(t, 0, sizeof(*t));
+	for (struct MetricsShard *s = __atomic_load_n(&shards, __ATOMIC_ACQUIRE); s; s = s->next) {
+		for (int c = 0; c < METRIC_COUNTERS; c++)
+			t->counters[c] += __atomic_load_n(&s->counters[c], __ATOMIC_RELAXED);
+		for (int i = 0; i < METRICS_BUCKETS; i++)
+			t->buckets[i] += __atomic_load_n(&s->buckets[i], __ATOMIC_RELAXED);
+		t->sum_ns += __atomic_load_n(&s->sum_ns, __ATOMIC_RELAXED);
+	}
+	for (int i = 0; i < METRICS_BUCKETS; i++)
+		t->count += t->buckets[i];
+}
+
+/**
+ * @brief Latency below which a share of the recorded latencies lies
+ * @param totals
+ * @param share between 0 and 1
+ * @return highest latency of the bucket holding the percentile in nanoseconds
+ */
+static uint64_t percentile(const struct MetricsTotals *t, double q) {
+	uint64_t rank = (uint64_t)(q * t->count + 0.5), seen = 0;
+	if (rank < 1) rank = 1;
+	for (int i = 0; i < METRICS_BUCKETS - 1; i++) {
+		if ((seen += t->buckets[i]) >= rank) return bucket_lower(i + 1) - 1;
+	}
+	return bucket_lower(METRICS_BUCKETS - 1);
+}
+
+void metrics_snapshot(FILE *out) {
+	struct MetricsTotals t;
+	collect(&t);
+	for (int c = 0; c < METRIC_COUNTERS; c++) {
+		fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", counter_name[c], counter_help[c], counter_name[c], counter_name[c],
+			(unsigned long long)t.counters[c]);
+	}
+
+	/* the fine buckets are exported at every power of two, where their bounds line up */
+	fprintf(out, "# HELP uchat_fanout_latency_seconds Time from receiving a message until its fan-out is sent\n"
+		"# TYPE uchat_fanout_latency_seconds histogram\n");
+	uint64_t below = 0;
+	int i = 0;
+	for (int e = METRICS_MIN_LE_EXP; e <= METRICS_MAX_EXP; e++) {
+		for (int end = bucket_of(1ull << e); i < end; i++)
+			below += t.buckets[i];
+		fprintf(out, "uchat_fanout_latency_seconds_bucket{le=\"%.12g\"} %llu\n", (double)(1ull << e) / 1e9, (unsigned long long)below);
+	}
+	fprintf(out, "uchat_fanout_latency_seconds_bucket{le=\"+Inf\"} %llu\n", (unsigned long long)t.count);
+	fprintf(out, "uchat_fanout_latency_seconds_sum %.9f\n", (double)t.sum_ns / 1e9);
+	fprintf(out, "uchat_fanout_latency_seconds_count %llu\n", (unsigned long long)t.count);
+
+	fprintf(out, "# HELP uchat_fanout_latency_quantile_seconds Percentiles of the fan-out latency since the start\n"
+		"# TYPE uchat_fanout_latency_quantile_seconds gauge\n");
+	for (size_t k = 0; t.count && k < sizeof(quantiles) / sizeof(quantiles[0]); k++) {
+		fprintf(out, "uchat_fanout_latency_quantile_seconds{quantile=\"%g\"} %.9f\n", quantiles[k],
+			(double)percentile(&t, quantiles[k]) / 1e9);
+	}
+	if (server_gauges) server_gauges(out);
+}
+
+void metrics_print_stats(void) {
+	struct MetricsTotals t;
+	collect(&t);
+	LOG_INFO("Received %llu datagrams, sent %llu, %llu send errors, %llu dropped", (unsigned long long)t.counters[METRIC_RX_DATAGRAMS],
+		(unsigned long long)t.counters[METRIC_TX_DATAGRAMS], (unsigned long long)t.counters[METRIC_SEND_ERRORS],
+		(unsigned long long)t.counters[METRIC_DROPS]);
+	if (!t.count) return;
+	LOG_INFO("Fan-out latency of %llu messages: p50 %.1f us, p99 %.1f us, p99.9 %.1f us", (unsigned long long)t.count,
+		percentile(&t, 0.5) / 1e3, percentile(&t, 0.99) / 1e3, percentile(&t, 0.999) / 1e3);
+}
+
+/**
+ * @brief Write a whole buffer to a connection
+ * @param connection
+ * @param data
+ * @param length
+ * @return 0 on success, -1 if the scraper went away
+ */
+static int write_all(int conn, const char *data, size_t len) {
+	while (len) {
+		/* a scraper closing early must not raise SIGPIPE */
+		ssize_t n = send(conn, data, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * @brief Read the request of a scraper and answer with a snapshot, any request gets the snapshot
+ * @param connection
+ * @return void
+ */
+static void answer(int conn) {
+	char request[METRICS_REQUEST_LEN + 1];
+	size_t used = 0;
+	struct timeval timeout = { METRICS_READ_TIMEOUT_S, 0 };
+	setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	/* the request has to be read, closing with unread data resets the connection */
+	while (used < METRICS_REQUEST_LEN) {
+		ssize_t n = recv(conn, request + used, METRICS_REQUEST_LEN - used, 0);
+		if (n <= 0) break;
+		used += n;
+		request[used] = '\0';
+		if (strstr(request, "\r\n\r\n")) break;
+	}
+
+	char *body = NULL;
+	size_t body_len = 0;
+	FILE *out = open_memstream(&body, &body_len);
+	if (!out) return;
+	metrics_snapshot(out);
+	fclose(out);
+	char header[128];
+	int header_len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %zu\r\n\r\n", body_len);
+	if (write_all(conn, header, header_len) == 0) write_all(conn, body, body_len);
+	free(body);
+}
+
+/**
+ * @brief Metrics thread, answers one scraper after the other
+ * @param unused
+ * @return void*
+ */
+static void *serve_thread(void *arg) {
+	/* signals are handled by the server, never by the metrics thread */
+	sigset_t all;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, NULL);
+	while (1) {
+		int conn = accept(listen_fd, NULL, NULL);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			LOG_ERROR("Metrics endpoint stopped: %s", strerror(errno));
+			return NULL;
+		}
+		answer(conn);
+		close(conn);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Open the listening socket, a number is a port on 127.0.0.1, anything else a socket file
+ * @param port number or path
+ * @return socket or -1 on error
+ */
+static int open_endpoint(const char *where) {
+	const char *p = where;
+	while (isdigit((unsigned char)*p)) p++;
+	if (*where && !*p) {
+		struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(atoi(where)), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+		int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+		if (fd < 0) return -1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_LOCAL };
+	if (strlen(where) >= sizeof(addr.sun_path)) return -1;
+	strcpy(addr.sun_path, where);
+	int fd = socket(AF_LOCAL, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	unlink(where);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+		close(fd);
+		return -1;
+	}
+	snprintf(unix_path, sizeof(unix_path), "%s", where);
+	return fd;
+}
+
+int metrics_serve(const char *where, metrics_gauges_cb gauges) {
+	if ((listen_fd = open_endpoint(where)) < 0) return -1;
+	server_gauges = gauges;
+	if (pthread_create(&server, NULL, serve_thread, NULL) != 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		metrics_close();
+		return -1;
+	}
+	pthread_detach(server);
+	return 0;
+}
+
+void metrics_close(void) {
+	if (unix_path[0]) unlink(unix_path);
+	unix_path[0] = '\0';
+}
@@ -0,0 +1,93 @@
+/**
+ * @file metrics.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Per thread counters and latency histograms, served in the Prometheus text format
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/* Latencies are kept in nanoseconds in log-linear buckets as in an HDR
+ * histogram: every power of two is split into METRICS_SUB_BUCKETS buckets of
+ * equal width, so a recorded value is off by at most 1/16. Latencies of
+ * 2^METRICS_MAX_EXP ns (about a minute) and more share the last bucket. */
+#define METRICS_SUB_BITS 4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_EXP 35
+#define METRICS_BUCKETS ((METRICS_MAX_EXP - METRICS_SUB_BITS + 2) * METRICS_SUB_BUCKETS)
+#define METRICS_MIN_LE_EXP 10 /* the exported histogram starts at 2^10 ns, about 1 us */
+#define METRICS_PATH_LEN 108 /* sun_path */
+
+enum {
+	METRIC_RX_DATAGRAMS,
+	METRIC_RX_BYTES,
+	METRIC_TX_DATAGRAMS,
+	METRIC_TX_BYTES,
+	METRIC_REGISTRATIONS,
+	METRIC_REJECTS, /* registrations refused because the server is full */
+	METRIC_DISCONNECTS, /* clients removed for any reason */
+	METRIC_SEND_ERRORS,
+	METRIC_DROPS, /* received datagrams thrown away, invalid or over a rate limit */
+	METRIC_COUNTERS
+};
+
+/* Writes the gauges of the server to a snapshot, called on the metrics thread */
+typedef void (*metrics_gauges_cb)(FILE *out);
+
+/**
+ * @brief Add to a counter of the calling thread, wait-free
+ * @param METRIC_ counter
+ * @param amount
+ * @return void
+ */
+void metrics_add(int counter, uint64_t n);
+
+/**
+ * @brief Count the result of sending one datagram as sent bytes or as a send error
+ * @param return value of sendto or sendmsg
+ * @return void
+ */
+void metrics_sent(ssize_t result);
+
+/**
+ * @brief Record one receive to fan-out complete latency in the histogram of the calling thread, wait-free
+ * @param latency in nanoseconds
+ * @return void
+ */
+void metrics_latency(uint64_t ns);
+
+/**
+ * @brief Answer scrapes on a localhost port or a unix stream socket in a thread of its own
+ * @param port number or path of the socket file
+ * @param callback writing the gauges of the server or NULL
+ * @return 0 on success, -1 if the socket cant be opened or the thread cant be started
+ */
+int metrics_serve(const char *where, metrics_gauges_cb gauges);
+
+/**
+ * @brief Write a snapshot of all threads in the Prometheus text format
+ * @param output
+ * @return void
+ */
+void metrics_snapshot(FILE *out);
+
+/**
+ * @brief Log the latency percentiles
+ * @param void
+ * @return void
+ */
+void metrics_print_stats(void);
+
+/**
+ * @brief Remove the socket file of the endpoint
+ * @param void
+ * @return void
+ */
+void metrics_close(void);
+
+#endif
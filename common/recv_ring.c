@@ -0,0 +1,123 @@
+/**
+ * @file recv_ring.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Batched receive of datagrams into a preallocated ring through the receive of a transport
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "recv_ring.h"
+#include "log.h"
+
+int recv_ring_init(struct RecvRing *r, int depth, int batch, size_t slot_size) {
+	memset(r, 0, sizeof(*r));
+	if (depth < 1) depth = 1;
+	if (batch < 1) batch = 1;
+	if (batch > depth) batch = depth;
+
+	r->slots = calloc(depth, sizeof(struct RecvSlot));
+	r->msgs = calloc(depth, sizeof(struct mmsghdr));
+	r->iov = calloc(depth, sizeof(struct iovec));
+	/* one extra byte per slot for the terminating zero */
+	r->data = malloc((size_t)depth * (slot_size + 1));
+	r->histogram = calloc(batch + 1, sizeof(unsigned long));
+	if (!r->slots || !r->msgs || !r->iov || !r->data || !r->histogram) {
+		recv_ring_free(r);
+		return -1;
+	}
+	r->depth = depth;
+	r->batch = batch;
+	r->slot_size = slot_size;
+
+	for (int i = 0; i < depth; i++) {
+		r->slots[i].buf = r->data + (size_t)i * (slot_size + 1);
+		r->iov[i].iov_base = r->slots[i].buf;
+		r->iov[i].iov_len = slot_size;
+		r->msgs[i].msg_hdr.msg_iov = &r->iov[i];
+		r->msgs[i].msg_hdr.msg_iovlen = 1;
+		r->msgs[i].msg_hdr.msg_name = &r->slots[i].addr;
+	}
+	return 0;
+}
+
+int recv_ring_pass_creds(struct RecvRing *r) {
+	r->control = calloc(r->depth, CMSG_SPACE(sizeof(struct ucred)));
+	if (!r->control) return -1;
+	for (int i = 0; i < r->depth; i++)
+		r->msgs[i].msg_hdr.msg_control = r->control + (size_t)i * CMSG_SPACE(sizeof(struct ucred));
+	return 0;
+}
+
+/**
+ * @brief Take the credentials of a received datagram out of its ancillary data
+ * @param received message
+ * @param slot
+ * @return void
+ */
+static void read_creds(struct msghdr *msg, struct RecvSlot *slot) {
+	memset(&slot->cred, 0, sizeof(slot->cred));
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_CREDENTIALS) {
+			memcpy(&slot->cred, CMSG_DATA(c), sizeof(slot->cred));
+			return;
+		}
+	}
+}
+
+void recv_ring_free(struct RecvRing *r) {
+	free(r->slots);
+	free(r->msgs);
+	free(r->iov);
+	free(r->data);
+	free(r->control);
+	free(r->histogram);
+	memset(r, 0, sizeof(*r));
+}
+
+int recv_ring_fill(struct RecvRing *r, const struct ChatTransport *t, int sock, int *first) {
+	/* never wrap inside one call, the mmsghdr vector has to be contiguous */
+	if (r->head + r->batch > r->depth) r->head = 0;
+	int start = r->head;
+
+	for (int i = start; i < start + r->batch; i++) {
+		r->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		r->msgs[i].msg_hdr.msg_flags = 0;
+		if (r->control) r->msgs[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(struct ucred));
+	}
+
+	int n;
+	do {
+		n = t->recv(sock, &r->msgs[start], r->batch);
+	} while (n < 0 && errno == EINTR);
+	/* a nonblocking socket driven by an event loop may be drained already */
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+	if (n < 0) return -1;
+	/* a socket shut down for reading returns an empty datagram without sender */
+	if (n > 0 && r->msgs[start].msg_len == 0 && r->msgs[start].msg_hdr.msg_namelen == 0) return 0;
+
+	for (int i = start; i < start + n; i++) {
+		r->slots[i].len = r->msgs[i].msg_len;
+		r->slots[i].addrlen = r->msgs[i].msg_hdr.msg_namelen;
+		r->slots[i].buf[r->slots[i].len] = '\0';
+		if (r->control) read_creds(&r->msgs[i].msg_hdr, &r->slots[i]);
+	}
+
+	r->head = start + n;
+	r->wakeups++;
+	r->datagrams += n;
+	r->histogram[n]++;
+	*first = start;
+	return n;
+}
+
+void recv_ring_print_stats(const struct RecvRing *r) {
+	LOG_INFO("Received %lu datagrams in %lu wakeups (%.2f per wakeup, batch %d, ring %d)",
+		r->datagrams, r->wakeups,
+		r->wakeups ? (double)r->datagrams / r->wakeups : 0.0, r->batch, r->depth);
+	for (int n = 1; n <= r->batch; n++) {
+		if (r->histogram[n])
+			LOG_INFO("  %3d datagrams per wakeup: %lu times", n, r->histogram[n]);
+	}
+}
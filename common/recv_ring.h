@@ -0,0 +1,87 @@
+/**
+ * @file recv_ring.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Batched receive of datagrams into a preallocated ring through the receive of a transport
+ */
+
+#ifndef RECV_RING_H
+#define RECV_RING_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "transport.h"
+
+#define RECV_RING_DEFAULT_DEPTH 256
+#define RECV_RING_DEFAULT_BATCH 32
+
+/* One received datagram. buf is always zero terminated behind len bytes. */
+struct RecvSlot {
+	char *buf;
+	ssize_t len;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	struct ucred cred; /* sender process, only with recv_ring_pass_creds, pid 0 if there were none */
+};
+
+/* depth slots are allocated once, every wakeup receives up to batch datagrams
+ * into the slots following the previous wakeup. histogram[n] counts the
+ * wakeups which picked up n datagrams. */
+struct RecvRing {
+	struct RecvSlot *slots;
+	struct mmsghdr *msgs;
+	struct iovec *iov;
+	char *data;
+	char *control; /* ancillary data of every slot, NULL without credentials */
+	size_t slot_size;
+	int depth;
+	int batch;
+	int head;
+	unsigned long wakeups;
+	unsigned long datagrams;
+	unsigned long *histogram;
+};
+
+/**
+ * @brief Allocate the ring and all slot buffers
+ * @param ring
+ * @param number of slots
+ * @param maximum number of datagrams per syscall, clamped to depth
+ * @param maximum datagram size
+ * @return 0 on success, -1 if out of memory
+ */
+int recv_ring_init(struct RecvRing *r, int depth, int batch, size_t slot_size);
+
+/**
+ * @brief Receive the credentials of the sender with every datagram, the socket needs SO_PASSCRED
+ * @param ring
+ * @return 0 on success, -1 if out of memory
+ */
+int recv_ring_pass_creds(struct RecvRing *r);
+
+/**
+ * @brief Free the ring and all slot buffers
+ * @param ring
+ * @return void
+ */
+void recv_ring_free(struct RecvRing *r);
+
+/**
+ * @brief Wait for at least one datagram and drain up to batch datagrams
+ * @param ring
+ * @param transport of the socket
+ * @param socket to receive from
+ * @param index of the first filled slot
+ * @return number of filled slots, starting at first, 0 if a nonblocking socket is empty or the socket was shut down, -1 on error
+ */
+int recv_ring_fill(struct RecvRing *r, const struct ChatTransport *t, int sock, int *first);
+
+/**
+ * @brief Log the datagrams per wakeup statistic
+ * @param ring
+ * @return void
+ */
+void recv_ring_print_stats(const struct RecvRing *r);
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * @file registry.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Growable table of live entries with stable handles
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "registry.h"
+
+/**
+ * @brief Resize all columns, every column keeps its alignment
+ * @param registry
+ * @param new capacity, a multiple of REGISTRY_CHUNK and at least count
+ * @return 0 on success, -1 if out of memory
+ */
+static int resize(struct Registry *r, uint32_t capacity) {
+	char *columns[REGISTRY_COLUMNS];
+	size_t n = capacity;
+	for (int c = 0; c < r->n_columns; c++) {
+		void *p;
+		if (posix_memalign(&p, REGISTRY_ALIGN, n * r->sizes[c]) != 0) {
+			while (c--) free(columns[c]);
+			return -1;
+		}
+		columns[c] = p;
+	}
+	uint32_t *handles = realloc(r->handles, n * sizeof(uint32_t));
+	if (!handles) {
+		for (int c = 0; c < r->n_columns; c++) free(columns[c]);
+		return -1;
+	}
+	r->handles = handles;
+	for (int c = 0; c < r->n_columns; c++) {
+		memcpy(columns[c], r->columns[c], r->count * r->sizes[c]);
+		free(r->columns[c]);
+		r->columns[c] = columns[c];
+	}
+	r->capacity = capacity;
+	return 0;
+}
+
+/**
+ * @brief Entries to grow by, half the table but at least one chunk, so
+ * filling the table copies every entry only a constant number of times
+ * @param current capacity
+ * @return number of entries, a multiple of REGISTRY_CHUNK
+ */
+static uint32_t grow_step(uint32_t capacity) {
+	uint32_t half = capacity / 2 / REGISTRY_CHUNK * REGISTRY_CHUNK;
+	return half > REGISTRY_CHUNK ? half : REGISTRY_CHUNK;
+}
+
+/**
+ * @brief Take a free handle or make a new one
+ * @param registry
+ * @return handle or -1 if out of memory
+ */
+static int take_handle(struct Registry *r) {
+	if (r->n_free) return r->free_handles[--r->n_free];
+	if (r->n_handles % REGISTRY_CHUNK == 0) {
+		uint32_t n = r->n_handles + REGISTRY_CHUNK;
+		uint32_t *slots = realloc(r->slots, n * sizeof(uint32_t));
+		if (!slots) return -1;
+		r->slots = slots;
+		uint32_t *free_handles = realloc(r->free_handles, n * sizeof(uint32_t));
+		if (!free_handles) return -1;
+		r->free_handles = free_handles;
+	}
+	return r->n_handles++;
+}
+
+void registry_init(struct Registry *r, const size_t *sizes, int n_columns, uint32_t limit) {
+	memset(r, 0, sizeof(*r));
+	if (n_columns > REGISTRY_COLUMNS) n_columns = REGISTRY_COLUMNS;
+	for (int c = 0; c < n_columns; c++)
+		r->sizes[c] = sizes[c];
+	r->n_columns = n_columns;
+	r->limit = limit;
+}
+
+void registry_free(struct Registry *r) {
+	for (int c = 0; c < r->n_columns; c++)
+		free(r->columns[c]);
+	free(r->handles);
+	free(r->slots);
+	free(r->free_handles);
+	memset(r, 0, sizeof(*r));
+}
+
+int registry_add(struct Registry *r) {
+	if (r->limit && r->count >= r->limit) return -1;
+	if (r->count == r->capacity && resize(r, r->capacity + grow_step(r->capacity)) < 0) return -1;
+	int handle = take_handle(r);
+	if (handle < 0) return -1;
+
+	uint32_t pos = r->count++;
+	for (int c = 0; c < r->n_columns; c++)
+		memset(r->columns[c] + pos * r->sizes[c], 0, r->sizes[c]);
+	r->handles[pos] = handle;
+	r->slots[handle] = pos;
+	if (r->count > r->peak) r->peak = r->count;
+	return handle;
+}
+
+void registry_remove(struct Registry *r, int handle) {
+	int pos = registry_pos(r, handle);
+	if (pos < 0) return;
+	uint32_t last = --r->count;
+	if ((uint32_t)pos != last) {
+		for (int c = 0; c < r->n_columns; c++)
+			memcpy(r->columns[c] + pos * r->sizes[c], r->columns[c] + last * r->sizes[c], r->sizes[c]);
+		r->handles[pos] = r->handles[last];
+		r->slots[r->handles[pos]] = pos;
+	}
+	r->slots[handle] = REGISTRY_FREE;
+	r->free_handles[r->n_free++] = handle;
+	/* halve a table which is only a quarter full, so a client coming and going
+	 * at the edge does not resize every time */
+	if (r->capacity > REGISTRY_CHUNK && r->count <= r->capacity / 4) {
+		uint32_t half = (r->capacity / 2 + REGISTRY_CHUNK - 1) / REGISTRY_CHUNK * REGISTRY_CHUNK;
+		resize(r, half);
+	}
+}
+
+int registry_pos(const struct Registry *r, int handle) {
+	if (handle < 0 || (uint32_t)handle >= r->n_handles || r->slots[handle] == REGISTRY_FREE) return -1;
+	return r->slots[handle];
+}
+
+void *registry_column(const struct Registry *r, int column) {
+	return r->columns[column];
+}
+
+void *registry_get(const struct Registry *r, int column, int handle) {
+	int pos = registry_pos(r, handle);
+	return pos < 0 ? NULL : r->columns[column] + pos * r->sizes[column];
+}
+
+void *registry_at(const struct Registry *r, int column, uint32_t pos) {
+	return r->columns[column] + pos * r->sizes[column];
+}
+
+int registry_handle_at(const struct Registry *r, uint32_t pos) {
+	return r->handles[pos];
+}
@@ -0,0 +1,120 @@
+/**
+ * @file registry.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Growable table of live entries with stable handles
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REGISTRY_CHUNK 64 /* the table is sized in multiples of this */
+#define REGISTRY_FREE UINT32_MAX
+#define REGISTRY_COLUMNS 8
+#define REGISTRY_ALIGN 64 /* cache line, every column starts on one */
+
+/* Live entries are packed at the front of the table, so walking all entries
+ * never visits a free slot. Removing an entry moves the last one into the
+ * hole. Entries are addressed by handles, small numbers which stay the same
+ * while the entry lives no matter where it is moved; a handle table maps
+ * them to the position of the entry and freed handles are reused. The table
+ * is sized in multiples of REGISTRY_CHUNK entries, grows by half when it is
+ * full and is halved when only a quarter is used. Pointers to entries are
+ * only valid until the next add or remove.
+ *
+ * An entry is split into up to REGISTRY_COLUMNS parts, every part is stored
+ * in its own array. Loops which need one part of every entry walk one dense
+ * array and never load the other parts into the cache. */
+struct Registry {
+	char *columns[REGISTRY_COLUMNS];
+	size_t sizes[REGISTRY_COLUMNS];
+	int n_columns;
+	uint32_t *handles; /* handle of the entry at every position */
+	uint32_t *slots; /* position of the entry of every handle, REGISTRY_FREE if unused */
+	uint32_t *free_handles;
+	uint32_t count;
+	uint32_t capacity;
+	uint32_t n_handles;
+	uint32_t n_free;
+	uint32_t limit; /* most entries at once, 0 for no limit */
+	uint32_t peak;
+};
+
+/**
+ * @brief Initialize an empty registry
+ * @param registry
+ * @param size of every column of an entry
+ * @param number of columns, at most REGISTRY_COLUMNS
+ * @param most entries at once, 0 for no limit
+ * @return void
+ */
+void registry_init(struct Registry *r, const size_t *sizes, int n_columns, uint32_t limit);
+
+/**
+ * @brief Free all entries
+ * @param registry
+ * @return void
+ */
+void registry_free(struct Registry *r);
+
+/**
+ * @brief Add an entry with all columns zeroed
+ * @param registry
+ * @return handle or -1 if the limit is reached or out of memory
+ */
+int registry_add(struct Registry *r);
+
+/**
+ * @brief Remove an entry, the last entry moves into its position
+ * @param registry
+ * @param handle
+ * @return void
+ */
+void registry_remove(struct Registry *r, int handle);
+
+/**
+ * @brief Position of the entry of a handle
+ * @param registry
+ * @param handle
+ * @return position or -1 if the handle is not in use
+ */
+int registry_pos(const struct Registry *r, int handle);
+
+/**
+ * @brief Array of one column of all entries, indexed by position
+ * @param registry
+ * @param column
+ * @return array aligned to REGISTRY_ALIGN
+ */
+void *registry_column(const struct Registry *r, int column);
+
+/**
+ * @brief One column of the entry of a handle
+ * @param registry
+ * @param column
+ * @param handle
+ * @return column of the entry or NULL if the handle is not in use
+ */
+void *registry_get(const struct Registry *r, int column, int handle);
+
+/**
+ * @brief One column of the entry at a position, 0 <= pos < count
+ * @param registry
+ * @param column
+ * @param position
+ * @return column of the entry
+ */
+void *registry_at(const struct Registry *r, int column, uint32_t pos);
+
+/**
+ * @brief Handle of the entry at a position, 0 <= pos < count
+ * @param registry
+ * @param position
+ * @return handle
+ */
+int registry_handle_at(const struct Registry *r, uint32_t pos);
+
+#endif
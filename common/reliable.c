@@ -0,0 +1,225 @@
+/**
+ * @file reliable.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Ordered, lossless delivery of chat frames over datagrams
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "reliable.h"
+
+struct RelStats rel_stats;
+static struct RelBlob *blob_pool;
+
+#define COUNT(field, n) __atomic_add_fetch(&rel_stats.field, (n), __ATOMIC_RELAXED)
+
+struct RelBlob *rel_blob_get(const char *payload, size_t len) {
+	if (len > REL_BLOB_SIZE) return NULL;
+	struct RelBlob *b = blob_pool;
+	if (b) blob_pool = b->next_free;
+	else if (!(b = malloc(sizeof(*b)))) return NULL;
+	b->next_free = NULL;
+	b->refs = 1;
+	b->len = len;
+	memcpy(b->data, payload, len);
+	return b;
+}
+
+void rel_blob_put(struct RelBlob *b) {
+	if (!b || --b->refs > 0) return;
+	b->next_free = blob_pool;
+	blob_pool = b;
+}
+
+void rel_peer_init(struct RelPeer *p, uint32_t first_send, uint32_t first_expected) {
+	memset(p, 0, sizeof(*p));
+	p->base = p->next_seq = first_send;
+	p->expected = first_expected;
+	p->rto_ms = REL_RTO_INIT_MS;
+}
+
+void rel_peer_free(struct RelPeer *p) {
+	for (uint32_t seq = p->base; seq != p->next_seq; seq++) {
+		struct RelFrame *f = &p->queue[seq & (REL_QUEUE - 1)];
+		rel_blob_put(f->blob);
+		f->blob = NULL;
+	}
+	p->base = p->next_seq;
+	for (int i = 0; i < REL_WINDOW; i++) {
+		rel_blob_put(p->ooo[i]);
+		p->ooo[i] = NULL;
+	}
+}
+
+int64_t rel_queue(struct RelPeer *p, int type, int flags, uint32_t sender, struct RelBlob *blob) {
+	if (p->next_seq - p->base >= REL_QUEUE) {
+		COUNT(overflows, 1);
+		return -1;
+	}
+	struct RelFrame *f = &p->queue[p->next_seq & (REL_QUEUE - 1)];
+	memset(f, 0, sizeof(*f));
+	f->type = type;
+	f->flags = flags | CHAT_FLAG_RELIABLE;
+	f->sender = sender;
+	f->blob = blob;
+	blob->refs++;
+	return p->next_seq++;
+}
+
+static void transmit(struct RelPeer *p, uint32_t seq, struct RelFrame *f, rel_send_fn send, void *ctx) {
+	char header[CHAT_HEADER_LEN];
+	chat_pack(header, f->type, f->flags, f->sender, seq, f->blob->len);
+	send(p, header, f->blob->data, f->blob->len, ctx);
+}
+
+uint64_t rel_poll(struct RelPeer *p, uint64_t now_ms, rel_send_fn send, void *ctx) {
+	uint64_t deadline = UINT64_MAX;
+	bool backed_off = false;
+
+	for (uint32_t seq = p->base; seq != p->next_seq && seq - p->base < REL_WINDOW; seq++) {
+		struct RelFrame *f = &p->queue[seq & (REL_QUEUE - 1)];
+		if (f->acked) continue;
+		if (!f->sent) {
+			transmit(p, seq, f, send, ctx);
+			f->sent = true;
+			f->sent_ms = now_ms;
+			COUNT(transmits, 1);
+		} else if (now_ms >= f->sent_ms + p->rto_ms) {
+			if (f->retries >= REL_MAX_RETRIES) {
+				COUNT(dead_peers, 1);
+				return 0;
+			}
+			transmit(p, seq, f, send, ctx);
+			f->retries++;
+			f->sent_ms = now_ms;
+			COUNT(transmits, 1);
+			COUNT(retransmits, 1);
+			/* one loss event doubles the timeout once, not once per lost frame */
+			if (!backed_off) {
+				p->rto_ms = p->rto_ms * 2 > REL_RTO_MAX_MS ? REL_RTO_MAX_MS : p->rto_ms * 2;
+				backed_off = true;
+			}
+		}
+		if (f->sent_ms + p->rto_ms < deadline) deadline = f->sent_ms + p->rto_ms;
+	}
+	return deadline;
+}
+
+static void rtt_sample(struct RelPeer *p, uint32_t r) {
+	if (!p->rtt_valid) {
+		p->srtt_ms = r;
+		p->rttvar_ms = r / 2;
+		p->rtt_valid = true;
+	} else {
+		uint32_t diff = p->srtt_ms > r ? p->srtt_ms - r : r - p->srtt_ms;
+		p->rttvar_ms = (3 * p->rttvar_ms + diff) / 4;
+		p->srtt_ms = (7 * p->srtt_ms + r) / 8;
+	}
+	uint32_t rto = p->srtt_ms + (4 * p->rttvar_ms > 1 ? 4 * p->rttvar_ms : 1);
+	if (rto < REL_RTO_MIN_MS) rto = REL_RTO_MIN_MS;
+	if (rto > REL_RTO_MAX_MS) rto = REL_RTO_MAX_MS;
+	p->rto_ms = rto;
+}
+
+/* Karn: only frames sent exactly once give an unambiguous round trip time */
+static void ack_frame(struct RelPeer *p, uint32_t seq, uint64_t now_ms, int64_t *rtt) {
+	struct RelFrame *f = &p->queue[seq & (REL_QUEUE - 1)];
+	if (f->acked || !f->sent) return;
+	f->acked = true;
+	if (!f->retries) *rtt = now_ms - f->sent_ms;
+}
+
+void rel_on_ack(struct RelPeer *p, const struct ChatHeader *h, const char *payload, uint64_t now_ms) {
+	uint32_t cum = h->seq;
+	uint32_t in_flight = p->next_seq - p->base;
+	int64_t rtt = -1;
+
+	/* a stale or bogus ack acknowledges nothing */
+	if (cum - p->base > in_flight) return;
+	for (uint32_t seq = p->base; seq != cum; seq++)
+		ack_frame(p, seq, now_ms, &rtt);
+	if (h->len >= 8) {
+		const uint8_t *s = (const uint8_t *)payload;
+		for (int k = 0; k < 64; k++) {
+			uint32_t seq = cum + 1 + k;
+			if (seq - p->base >= in_flight) break;
+			if (s[k / 8] & (0x80 >> (k % 8))) ack_frame(p, seq, now_ms, &rtt);
+		}
+	}
+	if (rtt >= 0) rtt_sample(p, rtt);
+
+	while (p->base != p->next_seq) {
+		struct RelFrame *f = &p->queue[p->base & (REL_QUEUE - 1)];
+		if (!f->acked) break;
+		rel_blob_put(f->blob);
+		f->blob = NULL;
+		p->base++;
+	}
+}
+
+void rel_on_data(struct RelPeer *p, const struct ChatHeader *h, const char *payload, rel_deliver_fn deliver, void *ctx) {
+	int32_t d = h->seq - p->expected;
+
+	if (d < 0) {
+		COUNT(duplicates, 1);
+		return;
+	}
+	if (d > 0) {
+		if (d >= REL_WINDOW) return;
+		int slot = h->seq & (REL_WINDOW - 1);
+		if (p->ooo[slot]) {
+			COUNT(duplicates, 1);
+			return;
+		}
+		/* keep it until the gap in front of it is filled */
+		struct RelBlob *b = rel_blob_get(payload, h->len);
+		if (!b) return;
+		p->ooo[slot] = b;
+		p->ooo_header[slot] = *h;
+		return;
+	}
+
+	deliver(p, h, payload, ctx);
+	p->expected++;
+	for (;;) {
+		int slot = p->expected & (REL_WINDOW - 1);
+		struct RelBlob *b = p->ooo[slot];
+		if (!b) break;
+		p->ooo[slot] = NULL;
+		deliver(p, &p->ooo_header[slot], b->data, ctx);
+		rel_blob_put(b);
+		p->expected++;
+	}
+}
+
+size_t rel_ack(struct RelPeer *p, uint32_t sender, char *buf) {
+	size_t n = chat_pack(buf, CHAT_ACK, 0, sender, p->expected, 8);
+	uint8_t *s = (uint8_t *)buf + n;
+	memset(s, 0, 8);
+	for (int k = 0; k < REL_WINDOW - 1; k++) {
+		uint32_t seq = p->expected + 1 + k;
+		int slot = seq & (REL_WINDOW - 1);
+		if (p->ooo[slot] && p->ooo_header[slot].seq == seq) s[k / 8] |= 0x80 >> (k % 8);
+	}
+	COUNT(acks_sent, 1);
+	return n + 8;
+}
+
+bool rel_dead(const struct RelPeer *p) {
+	for (uint32_t seq = p->base; seq != p->next_seq && seq - p->base < REL_WINDOW; seq++) {
+		const struct RelFrame *f = &p->queue[seq & (REL_QUEUE - 1)];
+		if (f->sent && !f->acked && f->retries >= REL_MAX_RETRIES) return true;
+	}
+	return false;
+}
+
+uint32_t rel_outstanding(const struct RelPeer *p) {
+	return p->next_seq - p->base;
+}
+
+double rel_retransmit_rate() {
+	unsigned long tx = __atomic_load_n(&rel_stats.transmits, __ATOMIC_RELAXED);
+	unsigned long re = __atomic_load_n(&rel_stats.retransmits, __ATOMIC_RELAXED);
+	return tx ? 100.0 * re / tx : 0.0;
+}
@@ -0,0 +1,191 @@
+/**
+ * @file reliable.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Ordered, lossless delivery of chat frames over datagrams
+ */
+
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "chat_proto.h"
+#include "timer_wheel.h"
+
+#define REL_WINDOW 64 /* frames in flight, also the range of the selective ack */
+#define REL_QUEUE 256 /* frames queued per peer, the window included, power of two */
+#define REL_BLOB_SIZE 4096 /* largest payload */
+#define REL_RTO_INIT_MS 200
+#define REL_RTO_MIN_MS 20
+#define REL_RTO_MAX_MS 4000
+#define REL_MAX_RETRIES 12 /* a peer which misses that many retransmits is dead */
+#define REL_ACK_LEN (CHAT_HEADER_LEN + 8)
+
+/* Payloads are shared by all peers a frame is queued for and kept until the
+ * last peer acked it. Freed blobs are recycled, so a steady stream does not
+ * allocate. */
+struct RelBlob {
+	struct RelBlob *next_free;
+	int refs;
+	uint16_t len;
+	char data[REL_BLOB_SIZE];
+};
+
+struct RelFrame {
+	uint8_t type;
+	uint8_t flags;
+	uint32_t sender;
+	struct RelBlob *blob;
+	uint64_t sent_ms;
+	int retries;
+	bool sent;
+	bool acked;
+};
+
+/* Both directions of one reliable stream. Every data frame carries its stream
+ * position in seq. The receiver answers with an ACK whose seq is the next
+ * expected position (all before arrived) and whose 8 byte payload is a bitmap
+ * of the following 64 positions which arrived out of order. The sender keeps
+ * REL_WINDOW frames in flight and retransmits a frame once its RTO, estimated
+ * from the acks as in RFC 6298, passed. */
+struct RelPeer {
+	/* send side, frames base .. next_seq-1 are queued at seq % REL_QUEUE */
+	struct RelFrame queue[REL_QUEUE];
+	uint32_t base;
+	uint32_t next_seq;
+	uint32_t srtt_ms, rttvar_ms, rto_ms;
+	bool rtt_valid;
+	/* receive side, out of order frames are kept at seq % REL_WINDOW */
+	uint32_t expected;
+	struct ChatHeader ooo_header[REL_WINDOW];
+	struct RelBlob *ooo[REL_WINDOW];
+	/* owner data */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int id;
+	struct TimerEntry timer;
+};
+
+/* Totals of all peers, updated atomically */
+struct RelStats {
+	unsigned long transmits;
+	unsigned long retransmits;
+	unsigned long acks_sent;
+	unsigned long duplicates;
+	unsigned long overflows;
+	unsigned long dead_peers;
+};
+
+extern struct RelStats rel_stats;
+
+/* Sends one data frame of a peer, the header is already packed in front of the payload */
+typedef void (*rel_send_fn)(struct RelPeer *p, const char *header, const char *payload, size_t len, void *ctx);
+/* Called for every received data frame in stream order, the peer must stay valid until rel_on_data returns */
+typedef void (*rel_deliver_fn)(struct RelPeer *p, const struct ChatHeader *h, const char *payload, void *ctx);
+
+/**
+ * @brief Take a blob from the pool and fill it, callers serialize all rel calls
+ * @param payload
+ * @param payload length, at most REL_BLOB_SIZE
+ * @return blob with one reference or NULL if out of memory
+ */
+struct RelBlob *rel_blob_get(const char *payload, size_t len);
+
+/**
+ * @brief Drop one reference, the last one returns the blob to the pool
+ * @param blob
+ * @return void
+ */
+void rel_blob_put(struct RelBlob *b);
+
+/**
+ * @brief Initialize a peer
+ * @param peer
+ * @param first sequence number sent
+ * @param first sequence number expected
+ * @return void
+ */
+void rel_peer_init(struct RelPeer *p, uint32_t first_send, uint32_t first_expected);
+
+/**
+ * @brief Release all queued and buffered frames of a peer
+ * @param peer
+ * @return void
+ */
+void rel_peer_free(struct RelPeer *p);
+
+/**
+ * @brief Queue a data frame, it is sent by the next rel_poll
+ * @param peer
+ * @param frame type
+ * @param frame flags, CHAT_FLAG_RELIABLE is added
+ * @param sender id
+ * @param payload blob, a reference is taken
+ * @return sequence number or -1 if the queue is full
+ */
+int64_t rel_queue(struct RelPeer *p, int type, int flags, uint32_t sender, struct RelBlob *blob);
+
+/**
+ * @brief Send queued frames which fit into the window and retransmit timed out frames
+ * @param peer
+ * @param current time in milliseconds
+ * @param send callback
+ * @param callback context
+ * @return time of the next retransmit, UINT64_MAX if nothing is in flight, 0 if the peer is dead
+ */
+uint64_t rel_poll(struct RelPeer *p, uint64_t now_ms, rel_send_fn send, void *ctx);
+
+/**
+ * @brief Process a received ACK
+ * @param peer
+ * @param ack header
+ * @param ack payload
+ * @param current time in milliseconds
+ * @return void
+ */
+void rel_on_ack(struct RelPeer *p, const struct ChatHeader *h, const char *payload, uint64_t now_ms);
+
+/**
+ * @brief Process a received data frame, delivers it and all buffered successors in order
+ * @param peer
+ * @param frame header
+ * @param payload
+ * @param deliver callback
+ * @param callback context
+ * @return void
+ */
+void rel_on_data(struct RelPeer *p, const struct ChatHeader *h, const char *payload, rel_deliver_fn deliver, void *ctx);
+
+/**
+ * @brief Build the ACK for the current receive state
+ * @param peer
+ * @param sender id put into the header
+ * @param buffer of REL_ACK_LEN bytes
+ * @return REL_ACK_LEN
+ */
+size_t rel_ack(struct RelPeer *p, uint32_t sender, char *buf);
+
+/**
+ * @brief Check if a frame in flight ran out of retransmits, as when rel_poll returned 0
+ * @param peer
+ * @return true if the peer is dead
+ */
+bool rel_dead(const struct RelPeer *p);
+
+/**
+ * @brief Number of frames queued or in flight
+ * @param peer
+ * @return frames
+ */
+uint32_t rel_outstanding(const struct RelPeer *p);
+
+/**
+ * @brief Share of transmissions which were retransmissions
+ * @param void
+ * @return percentage
+ */
+double rel_retransmit_rate();
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * @file rooms.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Chat rooms with a contiguous subscriber list per room
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "rooms.h"
+
+#define ROOMS_MIN_CAPACITY 4
+
+/* The client index resolves collisions through a key callback without context */
+static struct Rooms *key_rooms;
+
+/**
+ * @brief Key bytes of a room, its name
+ * @param room id
+ * @param key length
+ * @return key bytes
+ */
+static const void *room_key(int id, size_t *len) {
+	*len = key_rooms->rooms[id].name_len;
+	return key_rooms->rooms[id].name;
+}
+
+/**
+ * @brief Make room for one more entry, doubling the array
+ * @param array
+ * @param capacity in entries
+ * @param entries in use
+ * @param entry size
+ * @return 0 on success, -1 if out of memory
+ */
+static int grow(void **array, uint32_t *capacity, uint32_t count, size_t size) {
+	if (count < *capacity) return 0;
+	uint32_t capacity_new = *capacity ? *capacity * 2 : ROOMS_MIN_CAPACITY;
+	void *p = realloc(*array, (size_t)capacity_new * size);
+	if (!p) return -1;
+	*array = p;
+	*capacity = capacity_new;
+	return 0;
+}
+
+int rooms_init(struct Rooms *r, int max_rooms, unsigned long max_memberships, int n_clients) {
+	memset(r, 0, sizeof(*r));
+	r->rooms = calloc(max_rooms > 0 ? max_rooms : 1, sizeof(struct Room));
+	r->free_rooms = calloc(max_rooms > 0 ? max_rooms : 1, sizeof(int));
+	r->clients = calloc(n_clients > 0 ? n_clients : 1, sizeof(struct RoomClient));
+	if (!r->rooms || !r->free_rooms || !r->clients || client_index_init(&r->index, 0, room_key) < 0) {
+		free(r->rooms);
+		free(r->free_rooms);
+		free(r->clients);
+		return -1;
+	}
+	/* lowest id on top, so rooms are handed out in order */
+	for (int i = 0; i < max_rooms; i++)
+		r->free_rooms[i] = max_rooms - 1 - i;
+	r->n_free = max_rooms;
+	r->max_rooms = max_rooms;
+	r->n_clients = n_clients;
+	r->max_memberships = max_memberships;
+	key_rooms = r;
+	return 0;
+}
+
+void rooms_free(struct Rooms *r) {
+	for (int i = 0; i < r->max_rooms; i++)
+		free(r->rooms[i].members);
+	for (int i = 0; i < r->n_clients; i++)
+		free(r->clients[i].rooms);
+	free(r->rooms);
+	free(r->free_rooms);
+	free(r->clients);
+	client_index_free(&r->index);
+	memset(r, 0, sizeof(*r));
+}
+
+int rooms_find(const struct Rooms *r, const char *name, size_t len) {
+	if (len == 0 || len > ROOM_NAME_LEN) return -1;
+	return client_index_find(&r->index, name, len);
+}
+
+int rooms_is_member(const struct Rooms *r, int client, int room) {
+	if (client < 0 || client >= r->n_clients) return 0;
+	const struct RoomClient *c = &r->clients[client];
+	for (uint32_t k = 0; k < c->count; k++)
+		if (c->rooms[k].room == (uint32_t)room) return 1;
+	return 0;
+}
+
+/**
+ * @brief Make sure a client handle has a room list
+ * @param rooms
+ * @param client handle
+ * @return 0 on success, -1 if out of memory
+ */
+static int reserve_client(struct Rooms *r, int client) {
+	if (client < r->n_clients) return 0;
+	int n = r->n_clients ? r->n_clients : ROOMS_MIN_CAPACITY;
+	while (n <= client) n *= 2;
+	struct RoomClient *clients = realloc(r->clients, (size_t)n * sizeof(struct RoomClient));
+	if (!clients) return -1;
+	memset(clients + r->n_clients, 0, (size_t)(n - r->n_clients) * sizeof(struct RoomClient));
+	r->clients = clients;
+	r->n_clients = n;
+	return 0;
+}
+
+int rooms_join(struct Rooms *r, int client, const char *name, size_t len) {
+	if (client < 0 || len == 0 || len > ROOM_NAME_LEN || reserve_client(r, client) < 0) return -1;
+	int id = rooms_find(r, name, len);
+	if (id >= 0 && rooms_is_member(r, client, id)) return id;
+	if (r->memberships >= r->max_memberships) return -1;
+
+	struct RoomClient *c = &r->clients[client];
+	if (grow((void **)&c->rooms, &c->capacity, c->count, sizeof(struct RoomRef)) < 0) return -1;
+	if (id < 0) {
+		if (!r->n_free) return -1;
+		id = r->free_rooms[r->n_free - 1];
+		memcpy(r->rooms[id].name, name, len);
+		r->rooms[id].name[len] = '\0';
+		r->rooms[id].name_len = len;
+		if (client_index_insert(&r->index, name, len, id) < 0) return -1;
+		r->n_free--;
+	}
+	struct Room *room = &r->rooms[id];
+	if (grow((void **)&room->members, &room->capacity, room->count, sizeof(struct RoomMember)) < 0) {
+		if (!room->count) {
+			client_index_remove(&r->index, name, len);
+			r->free_rooms[r->n_free++] = id;
+		}
+		return -1;
+	}
+
+	room->members[room->count] = (struct RoomMember){ client, c->count };
+	c->rooms[c->count] = (struct RoomRef){ id, room->count };
+	room->count++;
+	c->count++;
+	r->memberships++;
+	return id;
+}
+
+/**
+ * @brief Remove one membership, both lists fill the hole with their last entry
+ * @param rooms
+ * @param client handle
+ * @param position of the room in the list of the client
+ * @return void
+ */
+static void remove_membership(struct Rooms *r, int client, uint32_t slot) {
+	struct RoomClient *c = &r->clients[client];
+	struct RoomRef ref = c->rooms[slot];
+	struct Room *room = &r->rooms[ref.room];
+
+	struct RoomMember last = room->members[--room->count];
+	if (ref.pos != room->count) {
+		room->members[ref.pos] = last;
+		r->clients[last.client].rooms[last.slot].pos = ref.pos;
+	}
+	struct RoomRef last_ref = c->rooms[--c->count];
+	if (slot != c->count) {
+		c->rooms[slot] = last_ref;
+		r->rooms[last_ref.room].members[last_ref.pos].slot = slot;
+	}
+	r->memberships--;
+
+	if (!room->count) {
+		client_index_remove(&r->index, room->name, room->name_len);
+		r->free_rooms[r->n_free++] = ref.room;
+		free(room->members);
+		room->members = NULL;
+		room->capacity = 0;
+	}
+}
+
+int rooms_leave(struct Rooms *r, int client, const char *name, size_t len) {
+	if (client < 0 || client >= r->n_clients) return -1;
+	int id = rooms_find(r, name, len);
+	if (id < 0) return -1;
+	struct RoomClient *c = &r->clients[client];
+	for (uint32_t k = 0; k < c->count; k++) {
+		if (c->rooms[k].room == (uint32_t)id) {
+			remove_membership(r, client, k);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void rooms_leave_all(struct Rooms *r, int client) {
+	if (client < 0 || client >= r->n_clients) return;
+	while (r->clients[client].count)
+		remove_membership(r, client, r->clients[client].count - 1);
+}
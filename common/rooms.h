@@ -0,0 +1,126 @@
+/**
+ * @file rooms.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Chat rooms with a contiguous subscriber list per room
+ */
+
+#ifndef ROOMS_H
+#define ROOMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "client_index.h"
+
+#define ROOMS_DEFAULT_MAX 100000
+#define ROOMS_DEFAULT_MEMBERSHIPS (1UL << 20)
+#define ROOM_NAME_LEN 32
+
+/* Every room keeps its subscribers in one array, so publishing walks
+ * count entries of 8 bytes and never touches clients outside the room.
+ * Each client keeps the list of its rooms, and both sides remember the
+ * position of the matching entry on the other side. Joining and leaving
+ * swap the last entry into the hole and are O(1), a disconnect leaves all
+ * rooms of the client without scanning any room. Room names are found by
+ * a client index keyed by the name, an empty room is removed and its id goes
+ * back to a free stack. The per client lists grow with the client handles. */
+struct RoomMember {
+	int client;
+	uint32_t slot; /* position of the room in the list of the client */
+};
+
+struct Room {
+	struct RoomMember *members;
+	uint32_t count;
+	uint32_t capacity;
+	uint8_t name_len;
+	char name[ROOM_NAME_LEN + 1];
+};
+
+struct RoomRef {
+	uint32_t room;
+	uint32_t pos; /* position of the client in the member list of the room */
+};
+
+struct RoomClient {
+	struct RoomRef *rooms;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+struct Rooms {
+	struct ClientIndex index;
+	struct Room *rooms;
+	int max_rooms;
+	int *free_rooms;
+	int n_free;
+	struct RoomClient *clients;
+	int n_clients;
+	unsigned long memberships;
+	unsigned long max_memberships;
+};
+
+/**
+ * @brief Allocate the room index, only one room set can exist per process
+ * @param rooms
+ * @param maximum number of rooms
+ * @param maximum number of memberships of all clients
+ * @param number of client handles to allocate up front
+ * @return 0 on success, -1 if out of memory
+ */
+int rooms_init(struct Rooms *r, int max_rooms, unsigned long max_memberships, int n_clients);
+
+/**
+ * @brief Free all rooms
+ * @param rooms
+ * @return void
+ */
+void rooms_free(struct Rooms *r);
+
+/**
+ * @brief Find a room by name
+ * @param rooms
+ * @param name, not zero terminated
+ * @param name length
+ * @return room id or -1 if nobody is in the room
+ */
+int rooms_find(const struct Rooms *r, const char *name, size_t len);
+
+/**
+ * @brief Add a client to a room, the room is created on the first join
+ * @param rooms
+ * @param client handle
+ * @param name, not zero terminated
+ * @param name length, at most ROOM_NAME_LEN
+ * @return room id, also if the client already is in the room, -1 if all rooms or memberships are used
+ */
+int rooms_join(struct Rooms *r, int client, const char *name, size_t len);
+
+/**
+ * @brief Remove a client from a room
+ * @param rooms
+ * @param client handle
+ * @param name, not zero terminated
+ * @param name length
+ * @return 0 on success, -1 if the client is not in the room
+ */
+int rooms_leave(struct Rooms *r, int client, const char *name, size_t len);
+
+/**
+ * @brief Remove a client from all its rooms
+ * @param rooms
+ * @param client handle
+ * @return void
+ */
+void rooms_leave_all(struct Rooms *r, int client);
+
+/**
+ * @brief Check if a client is in a room
+ * @param rooms
+ * @param client handle
+ * @param room id
+ * @return 1 if it is a member
+ */
+int rooms_is_member(const struct Rooms *r, int client, int room);
+
+#endif
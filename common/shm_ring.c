@@ -0,0 +1,196 @@
+/**
+ * @file shm_ring.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Single producer, many consumer broadcast ring in shared memory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shm_ring.h"
+#include "log.h"
+
+/**
+ * @brief Slot of a sequence number
+ * @param start of the slots
+ * @param number of slots
+ * @param sequence number
+ * @return slot
+ */
+static struct ShmSlot *slot_at(const char *slots, uint32_t n, uint64_t seq) {
+	return (struct ShmSlot *)(slots + (seq % n) * SHM_RING_SLOT_BYTES);
+}
+
+int shm_ring_create(struct ShmRing *r, const char *name, uint32_t slots) {
+	memset(r, 0, sizeof(*r));
+	if (slots < 1 || strlen(name) >= sizeof(r->name)) return -1;
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	r->size = sizeof(struct ShmRingHeader) + (size_t)slots * SHM_RING_SLOT_BYTES;
+
+	/* clients of an earlier server still map the old object, they see it closed */
+	shm_unlink(name);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) return -1;
+	if (ftruncate(fd, r->size) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+	void *base = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		shm_unlink(name);
+		return -1;
+	}
+	r->hdr = base;
+	r->slots = (char *)base + sizeof(struct ShmRingHeader);
+	r->hdr->slots = slots;
+	r->hdr->slot_bytes = SHM_RING_SLOT_BYTES;
+	__atomic_store_n(&r->hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * @brief Wake every reader sleeping on the futex of the ring
+ * @param ring
+ * @return void
+ */
+static void wake_all(struct ShmRing *r) {
+	__atomic_add_fetch(&r->hdr->wakeup, 1, __ATOMIC_RELEASE);
+	/* not FUTEX_PRIVATE_FLAG, the readers are other processes */
+	syscall(SYS_futex, &r->hdr->wakeup, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	r->wakeups++;
+}
+
+void shm_ring_destroy(struct ShmRing *r) {
+	if (!r->hdr) return;
+	__atomic_store_n(&r->hdr->closed, 1, __ATOMIC_RELEASE);
+	wake_all(r);
+	munmap(r->hdr, r->size);
+	shm_unlink(r->name);
+	r->hdr = NULL;
+}
+
+int shm_ring_publish(struct ShmRing *r, const void *a, size_t alen, const void *b, size_t blen) {
+	if (sizeof(struct ShmSlot) + alen + blen > SHM_RING_SLOT_BYTES) {
+		r->refused++;
+		return -1;
+	}
+	struct ShmSlot *slot = slot_at(r->slots, r->hdr->slots, r->head);
+	/* readers still on the old record of this slot see it change */
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(slot->data, a, alen);
+	if (blen) memcpy(slot->data + alen, b, blen);
+	slot->len = alen + blen;
+	__atomic_store_n(&slot->seq, r->head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->hdr->head, ++r->head, __ATOMIC_RELEASE);
+	r->pending = true;
+	r->published++;
+	return 0;
+}
+
+void shm_ring_flush(struct ShmRing *r) {
+	if (!r->hdr || !r->pending) return;
+	r->pending = false;
+	wake_all(r);
+}
+
+void shm_ring_print_stats(const struct ShmRing *r) {
+	if (!r->hdr) return;
+	LOG_INFO("Shared memory ring %s published %lu records with %lu wakeups, %lu too long for a slot", r->name,
+		r->published, r->wakeups, r->refused);
+}
+
+int shm_reader_open(struct ShmReader *rd, const char *name) {
+	struct stat st;
+	memset(rd, 0, sizeof(*rd));
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct ShmRingHeader)) {
+		close(fd);
+		return -1;
+	}
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) return -1;
+	rd->hdr = base;
+	rd->size = st.st_size;
+	if (__atomic_load_n(&rd->hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC || rd->hdr->slot_bytes != SHM_RING_SLOT_BYTES ||
+			sizeof(struct ShmRingHeader) + (size_t)rd->hdr->slots * SHM_RING_SLOT_BYTES > rd->size) {
+		shm_reader_close(rd);
+		return -1;
+	}
+	rd->slots = (const char *)base + sizeof(struct ShmRingHeader);
+	rd->pos = __atomic_load_n(&rd->hdr->head, __ATOMIC_ACQUIRE);
+	return 0;
+}
+
+void shm_reader_close(struct ShmReader *rd) {
+	if (rd->hdr) munmap((void *)rd->hdr, rd->size);
+	rd->hdr = NULL;
+}
+
+void shm_reader_seek(struct ShmReader *rd, uint32_t pos) {
+	uint64_t head = __atomic_load_n(&rd->hdr->head, __ATOMIC_ACQUIRE);
+	/* the distance to the head fits into 32 bits, the wrap around drops out */
+	rd->pos = head - (uint32_t)((uint32_t)head - pos);
+}
+
+const char *shm_reader_peek(struct ShmReader *rd, size_t *len) {
+	uint32_t n = rd->hdr->slots;
+	while (1) {
+		uint64_t head = __atomic_load_n(&rd->hdr->head, __ATOMIC_ACQUIRE);
+		if (rd->pos == head) return NULL;
+		/* the server wrote a whole ring since the last read, skip to the oldest record still there */
+		if (head - rd->pos > n) {
+			rd->lost += head - rd->pos - n;
+			rd->pos = head - n;
+		}
+		const struct ShmSlot *slot = slot_at(rd->slots, n, rd->pos);
+		rd->seen = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (rd->seen == rd->pos + 1) {
+			*len = slot->len;
+			if (*len > SHM_RING_SLOT_BYTES - sizeof(struct ShmSlot)) *len = SHM_RING_SLOT_BYTES - sizeof(struct ShmSlot);
+			return slot->data;
+		}
+		/* overwritten or just being overwritten */
+		rd->lost++;
+		rd->pos++;
+	}
+}
+
+bool shm_reader_done(struct ShmReader *rd) {
+	const struct ShmSlot *slot = slot_at(rd->slots, rd->hdr->slots, rd->pos);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	bool intact = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == rd->seen;
+	if (!intact) rd->lost++;
+	rd->pos++;
+	return intact;
+}
+
+int shm_reader_wait(struct ShmReader *rd, int timeout_ms) {
+	struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+	/* read the futex word before the head, a flush in between changes the word and the wait returns at once */
+	uint32_t wakeup = __atomic_load_n(&rd->hdr->wakeup, __ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&rd->hdr->closed, __ATOMIC_ACQUIRE)) return -1;
+	if (__atomic_load_n(&rd->hdr->head, __ATOMIC_ACQUIRE) != rd->pos) return 0;
+	syscall(SYS_futex, &rd->hdr->wakeup, FUTEX_WAIT, wakeup, &timeout, NULL, 0);
+	return __atomic_load_n(&rd->hdr->closed, __ATOMIC_ACQUIRE) ? -1 : 0;
+}
+
+void shm_reader_wake(struct ShmReader *rd) {
+	/* the mapping is read only, the word cant be bumped, so the
+	 * waiters of all processes are woken and check their ring */
+	syscall(SYS_futex, &rd->hdr->wakeup, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
@@ -0,0 +1,160 @@
+/**
+ * @file shm_ring.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Single producer, many consumer broadcast ring in shared memory
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_RING_MAGIC 0x55524e47u
+#define SHM_RING_DEFAULT_SLOTS 1024
+#define SHM_RING_SLOT_BYTES 1024 /* one record with its slot header, longer records are refused */
+#define SHM_RING_NAME_LEN 64
+#define SHM_RING_CACHE_LINE 64
+
+/* Start of the segment. The server is the only writer, clients map the
+ * segment read only and keep their own position, so a slow or broken client
+ * can neither hold up the server nor disturb the other clients. */
+struct ShmRingHeader {
+	uint32_t magic; /* written last, a reader never sees a half initialized ring */
+	uint32_t slots;
+	uint32_t slot_bytes;
+	uint32_t closed; /* set when the server goes away */
+	uint64_t head __attribute__((aligned(SHM_RING_CACHE_LINE))); /* sequence number of the next record */
+	uint32_t wakeup __attribute__((aligned(SHM_RING_CACHE_LINE))); /* futex word, bumped once per flush */
+};
+
+/* A record is written like a seqlock: seq is 0 while the server writes the
+ * slot and the sequence number plus one once the record is complete. A reader
+ * checks seq before and after reading, a changed seq means the server lapped
+ * it and the record is lost. */
+struct ShmSlot {
+	uint64_t seq;
+	uint32_t len;
+	uint32_t reserved;
+	char data[];
+};
+
+/* Writer side, owned by the server */
+struct ShmRing {
+	char name[SHM_RING_NAME_LEN];
+	struct ShmRingHeader *hdr;
+	char *slots;
+	size_t size;
+	uint64_t head;
+	bool pending; /* records published since the last flush */
+	unsigned long published, wakeups, refused;
+};
+
+/* Reader side, one per client */
+struct ShmReader {
+	const struct ShmRingHeader *hdr;
+	const char *slots;
+	size_t size;
+	uint64_t pos; /* sequence number of the next record to read */
+	uint64_t seen; /* seq of the record handed out by shm_reader_peek */
+	unsigned long lost;
+};
+
+/**
+ * @brief Create the ring as a POSIX shared memory object, a left over object of the same name is replaced
+ * @param ring
+ * @param name, starting with a slash
+ * @param number of slots
+ * @return 0 on success, -1 on error
+ */
+int shm_ring_create(struct ShmRing *r, const char *name, uint32_t slots);
+
+/**
+ * @brief Mark the ring closed, wake all readers and remove the shared memory object
+ * @param ring
+ * @return void
+ */
+void shm_ring_destroy(struct ShmRing *r);
+
+/**
+ * @brief Publish one record made of two parts, e.g. a frame header and its payload, readers are woken by the next flush
+ * @param ring
+ * @param first part
+ * @param first part length
+ * @param second part or NULL
+ * @param second part length
+ * @return 0 on success, -1 if the record does not fit into a slot
+ */
+int shm_ring_publish(struct ShmRing *r, const void *a, size_t alen, const void *b, size_t blen);
+
+/**
+ * @brief Wake the waiting readers if records were published since the last flush, one system call for all of them
+ * @param ring
+ * @return void
+ */
+void shm_ring_flush(struct ShmRing *r);
+
+/**
+ * @brief Log the counters of the ring
+ * @param ring
+ * @return void
+ */
+void shm_ring_print_stats(const struct ShmRing *r);
+
+/**
+ * @brief Map a ring read only, reading starts with the next published record
+ * @param reader
+ * @param name of the ring
+ * @return 0 on success, -1 if there is no ring of that name
+ */
+int shm_reader_open(struct ShmReader *rd, const char *name);
+
+/**
+ * @brief Unmap the ring
+ * @param reader
+ * @return void
+ */
+void shm_reader_close(struct ShmReader *rd);
+
+/**
+ * @brief Read on at a position, e.g. one the server told the client
+ * @param reader
+ * @param low 32 bits of the position, the position lies at most 2^32 records behind the head
+ * @return void
+ */
+void shm_reader_seek(struct ShmReader *rd, uint32_t pos);
+
+/**
+ * @brief Next record, read in place in the shared segment. Records the reader was lapped on are counted as lost.
+ * @param reader
+ * @param record length
+ * @return record or NULL if there is no new record
+ */
+const char *shm_reader_peek(struct ShmReader *rd, size_t *len);
+
+/**
+ * @brief Finish the record of the last peek and move on
+ * @param reader
+ * @return true if the record stayed intact while it was read, false if it was overwritten and must be discarded
+ */
+bool shm_reader_done(struct ShmReader *rd);
+
+/**
+ * @brief Sleep on the futex of the ring until a record is published
+ * @param reader
+ * @param timeout in milliseconds
+ * @return 0 if there may be new records, -1 if the ring is closed
+ */
+int shm_reader_wait(struct ShmReader *rd, int timeout_ms);
+
+/**
+ * @brief Wake a thread of this process sleeping in shm_reader_wait, e.g. to stop it.
+ * Readers of other processes wake up too and sleep again.
+ * @param reader
+ * @return void
+ */
+void shm_reader_wake(struct ShmReader *rd);
+
+#endif
@@ -0,0 +1,129 @@
+/**
+ * @file timer_wheel.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Hierarchical timing wheel for many per client timers
+ */
+
+#include <string.h>
+#include "timer_wheel.h"
+
+/**
+ * @brief Link a timer into the slot of the lowest level that reaches its tick
+ * @param wheel
+ * @param timer
+ * @param expiry tick, not before the current tick
+ * @return void
+ */
+static void place(struct TimerWheel *w, struct TimerEntry *t, uint64_t tick) {
+	uint64_t delta = tick > w->tick ? tick - w->tick : 0;
+	int level = 0;
+
+	if (delta >= TIMER_WHEEL_SPAN) {
+		/* parked at the end of the top level, placed again when cascaded */
+		tick = w->tick + TIMER_WHEEL_SPAN - 1;
+		level = TIMER_WHEEL_LEVELS - 1;
+	} else {
+		while (delta >= 1ull << (TIMER_WHEEL_BITS * (level + 1))) level++;
+	}
+	struct TimerEntry *head = &w->slots[level][(tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+	t->next = head->next;
+	t->prev = head;
+	head->next->prev = t;
+	head->next = t;
+}
+
+/**
+ * @brief Move all timers of a slot to a list of their own
+ * @param slot
+ * @param list head, empty if the slot was empty
+ * @return void
+ */
+static void take_slot(struct TimerEntry *head, struct TimerEntry *list) {
+	list->next = list->prev = list;
+	if (head->next == head) return;
+	list->next = head->next;
+	list->prev = head->prev;
+	list->next->prev = list;
+	list->prev->next = list;
+	head->next = head->prev = head;
+}
+
+/**
+ * @brief Spread the timers of the current slot of a level over the levels below
+ * @param wheel
+ * @param level, at least 1
+ * @return index of the cascaded slot, 0 if the level wrapped as well
+ */
+static int cascade(struct TimerWheel *w, int level) {
+	int index = (w->tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+	struct TimerEntry list;
+	take_slot(&w->slots[level][index], &list);
+	while (list.next != &list) {
+		struct TimerEntry *t = list.next;
+		t->prev->next = t->next;
+		t->next->prev = t->prev;
+		place(w, t, t->expires / w->tick_ms);
+	}
+	return index;
+}
+
+void timer_wheel_init(struct TimerWheel *w, unsigned tick_ms, uint64_t now_ms) {
+	memset(w, 0, sizeof(*w));
+	w->tick_ms = tick_ms ? tick_ms : 1;
+	w->tick = now_ms / w->tick_ms;
+	for (int l = 0; l < TIMER_WHEEL_LEVELS; l++)
+		for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+			w->slots[l][i].next = w->slots[l][i].prev = &w->slots[l][i];
+}
+
+void timer_wheel_add(struct TimerWheel *w, struct TimerEntry *t, uint64_t expires_ms) {
+	timer_wheel_del(w, t);
+	uint64_t tick = expires_ms / w->tick_ms;
+	/* never schedule into the past, that slot was already visited */
+	if (tick <= w->tick) tick = w->tick + 1;
+	t->expires = expires_ms;
+	place(w, t, tick);
+	t->pending = true;
+	w->pending++;
+}
+
+void timer_wheel_del(struct TimerWheel *w, struct TimerEntry *t) {
+	if (!t->pending) return;
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = t->prev = NULL;
+	t->pending = false;
+	w->pending--;
+}
+
+int timer_wheel_advance(struct TimerWheel *w, uint64_t now_ms, timer_cb cb, void *ctx) {
+	uint64_t target = now_ms / w->tick_ms;
+	int fired = 0;
+
+	while (w->tick < target) {
+		/* nothing to cascade or run, e.g. after a long stall of an idle server */
+		if (!w->pending) {
+			w->tick = target;
+			break;
+		}
+		w->tick++;
+		if (!(w->tick & (TIMER_WHEEL_SLOTS - 1)))
+			for (int l = 1; l < TIMER_WHEEL_LEVELS && !cascade(w, l); l++);
+
+		/* callbacks may add and delete any timer, so the slot is detached first */
+		struct TimerEntry list;
+		take_slot(&w->slots[0][w->tick & (TIMER_WHEEL_SLOTS - 1)], &list);
+		while (list.next != &list) {
+			struct TimerEntry *t = list.next;
+			timer_wheel_del(w, t);
+			if (t->expires / w->tick_ms <= w->tick) {
+				cb(t, ctx);
+				fired++;
+			} else {
+				timer_wheel_add(w, t, t->expires);
+			}
+		}
+	}
+	return fired;
+}
@@ -0,0 +1,79 @@
+/**
+ * @file timer_wheel.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Hierarchical timing wheel for many per client timers
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS) /* slots per level */
+#define TIMER_WHEEL_LEVELS 4
+/* Ticks covered by all levels, later timers wait in the last slot of the top level */
+#define TIMER_WHEEL_SPAN (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+/* Timers are embedded into the object they belong to. Level 0 has one slot
+ * per tick, every slot of level n covers a whole rotation of level n - 1.
+ * When a level wraps, the next slot of the level above is cascaded down, so
+ * a timer moves at most once per level and adding, removing and rearming a
+ * timer are O(1) no matter how many timers are pending or how far ahead they
+ * expire; retransmits a few ticks ahead and idle timeouts of minutes share
+ * one wheel without being visited every rotation. */
+struct TimerEntry {
+	struct TimerEntry *next, *prev;
+	uint64_t expires;
+	bool pending;
+};
+
+struct TimerWheel {
+	struct TimerEntry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	unsigned tick_ms;
+	uint64_t tick;
+	unsigned long pending;
+};
+
+/* Called for every expired timer, the timer is already removed and may be added again */
+typedef void (*timer_cb)(struct TimerEntry *t, void *ctx);
+
+/**
+ * @brief Initialize an empty wheel
+ * @param wheel
+ * @param resolution in milliseconds
+ * @param current time in milliseconds
+ * @return void
+ */
+void timer_wheel_init(struct TimerWheel *w, unsigned tick_ms, uint64_t now_ms);
+
+/**
+ * @brief Start or rearm a timer
+ * @param wheel
+ * @param timer
+ * @param expiry time in milliseconds
+ * @return void
+ */
+void timer_wheel_add(struct TimerWheel *w, struct TimerEntry *t, uint64_t expires_ms);
+
+/**
+ * @brief Stop a timer, does nothing if it is not pending
+ * @param wheel
+ * @param timer
+ * @return void
+ */
+void timer_wheel_del(struct TimerWheel *w, struct TimerEntry *t);
+
+/**
+ * @brief Advance the wheel to the current time and run all expired timers
+ * @param wheel
+ * @param current time in milliseconds
+ * @param callback for expired timers
+ * @param callback context
+ * @return number of expired timers
+ */
+int timer_wheel_advance(struct TimerWheel *w, uint64_t now_ms, timer_cb cb, void *ctx);
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * @file token_bucket.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Token buckets of one word for rate limiting
+ */
+
+#include "token_bucket.h"
+
+void token_rate_init(struct TokenRate *r, unsigned long per_second, unsigned long burst) {
+	if (!per_second) {
+		r->interval_us = 0;
+		r->tolerance_us = 0;
+		return;
+	}
+	r->interval_us = 1000000 / per_second ? 1000000 / per_second : 1;
+	r->tolerance_us = (burst ? burst - 1 : 0) * r->interval_us;
+}
+
+bool token_take(uint64_t *bucket, const struct TokenRate *r, uint64_t now_us) {
+	uint64_t full = *bucket > now_us ? *bucket : now_us;
+	if (full - now_us > r->tolerance_us) return false;
+	*bucket = full + r->interval_us;
+	return true;
+}
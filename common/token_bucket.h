@@ -0,0 +1,42 @@
+/**
+ * @file token_bucket.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Token buckets of one word for rate limiting
+ */
+
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A bucket is the time in microseconds at which it is full again, so it is
+ * one uint64_t which can live in a registry column and a zeroed bucket is
+ * full. Every message moves that time one interval ahead, a message is let
+ * through while the bucket would be full again within burst - 1 intervals.
+ * Refilling needs no timer, taking a token is a compare and an add. */
+struct TokenRate {
+	uint64_t interval_us; /* time one token takes to come back, 0 for no limit */
+	uint64_t tolerance_us; /* burst - 1 intervals */
+};
+
+/**
+ * @brief Set up a rate
+ * @param rate
+ * @param tokens per second, 0 for no limit
+ * @param tokens a full bucket holds, at least 1
+ * @return void
+ */
+void token_rate_init(struct TokenRate *r, unsigned long per_second, unsigned long burst);
+
+/**
+ * @brief Take one token from a bucket
+ * @param bucket
+ * @param rate of the bucket
+ * @param current time in microseconds
+ * @return true if the bucket had a token, false if the message has to be dropped
+ */
+bool token_take(uint64_t *bucket, const struct TokenRate *r, uint64_t now_us);
+
+#endif
@@ -0,0 +1,200 @@
+/**
+ * @file transport.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Address family specific parts of the chat servers behind one interface
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "transport.h"
+
+/**
+ * @brief Key of a udp peer, port and ip are adjacent in sockaddr_in
+ * @param struct sockaddr_in
+ * @param key length
+ * @return key bytes
+ */
+static const void *udp_key(const void *addr, size_t *len) {
+	*len = sizeof(in_port_t) + sizeof(struct in_addr);
+	return &((const struct sockaddr_in *)addr)->sin_port;
+}
+
+/**
+ * @brief Printable udp peer
+ * @param struct sockaddr_in
+ * @param output buffer
+ * @param buffer size
+ * @return ip:port
+ */
+static const char *udp_format(const void *addr, char *buf, size_t size) {
+	char ip_str[INET_ADDRSTRLEN];
+	const struct sockaddr_in *in = addr;
+	inet_ntop(AF_INET, &in->sin_addr, ip_str, sizeof(ip_str));
+	snprintf(buf, size, "%s:%d", ip_str, ntohs(in->sin_port));
+	return buf;
+}
+
+/**
+ * @brief Every udp peer can be answered
+ * @param struct sockaddr_in
+ * @return true
+ */
+static bool udp_reachable(const void *addr) {
+	return true;
+}
+
+/**
+ * @brief Bind the udp server socket
+ * @param struct sockaddr_in
+ * @param true if several sockets share the port
+ * @return socket or -1 on error
+ */
+static int udp_bind(const void *addr, bool shared) {
+	int one = 1;
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) return -1;
+	/* Let the kernel spread the clients over all sockets of the port */
+	if ((shared && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) ||
+			bind(sock, addr, sizeof(struct sockaddr_in)) < 0) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * @brief Send several datagrams in one call, the same on every datagram socket
+ * @param socket
+ * @param messages with their addresses
+ * @param number of messages
+ * @return number sent or -1 if the first one failed
+ */
+static int datagram_send(int sock, struct mmsghdr *msgs, unsigned int n) {
+	return sendmmsg(sock, msgs, n, 0);
+}
+
+/**
+ * @brief Receive several udp datagrams in one call
+ * @param socket
+ * @param messages, msg_namelen holds the room for the address
+ * @param number of messages
+ * @return number received or -1
+ */
+static int udp_recv(int sock, struct mmsghdr *msgs, unsigned int n) {
+	return recvmmsg(sock, msgs, n, MSG_WAITFORONE, NULL);
+}
+
+/**
+ * @brief Key of a unix peer, the path of its socket file or its abstract name with the leading zero byte
+ * @param struct sockaddr_un, zero padded behind the received address
+ * @param key length
+ * @return key bytes
+ */
+static const void *unix_key(const void *addr, size_t *len) {
+	const struct sockaddr_un *un = addr;
+	if (un->sun_path[0])
+		*len = strnlen(un->sun_path, sizeof(un->sun_path));
+	else
+		*len = 1 + strnlen(un->sun_path + 1, sizeof(un->sun_path) - 1);
+	return un->sun_path;
+}
+
+/**
+ * @brief Printable unix peer
+ * @param struct sockaddr_un
+ * @param output buffer
+ * @param buffer size
+ * @return socket file
+ */
+static const char *unix_format(const void *addr, char *buf, size_t size) {
+	const struct sockaddr_un *un = addr;
+	/* abstract names are shown with an @ in place of the zero byte, like ss and netstat do */
+	if (un->sun_path[0])
+		snprintf(buf, size, "%.*s", (int)sizeof(un->sun_path), un->sun_path);
+	else
+		snprintf(buf, size, "@%.*s", (int)sizeof(un->sun_path) - 1, un->sun_path + 1);
+	return buf;
+}
+
+/**
+ * @brief Unbound unix sockets have no path and cant receive anything
+ * @param struct sockaddr_un, zero padded behind the received address
+ * @return true if the peer has a socket file or an abstract name
+ */
+static bool unix_reachable(const void *addr) {
+	const struct sockaddr_un *un = addr;
+	return un->sun_path[0] != '\0' || un->sun_path[1] != '\0';
+}
+
+/**
+ * @brief Bind the unix server socket, a left over socket file is replaced and everybody may write to the new one.
+ * An abstract name has no file, it is gone with the socket and in use while another server runs.
+ * @param struct sockaddr_un
+ * @param unused, a socket file belongs to one socket
+ * @return socket or -1 on error
+ */
+static int unix_bind(const void *addr, bool shared) {
+	const char *path = ((const struct sockaddr_un *)addr)->sun_path;
+	bool abstract = path[0] == '\0';
+	int sock = socket(AF_LOCAL, SOCK_DGRAM, 0);
+	if (sock < 0) return -1;
+	if (!abstract) unlink(path);
+	if (bind(sock, addr, sizeof(struct sockaddr_un)) < 0 || (!abstract && chmod(path, 0777) < 0)) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/**
+ * @brief Receive several unix datagrams in one call. The kernel writes only msg_namelen bytes of an
+ * address, the rest may still hold an earlier sender, e.g. behind an unbound socket, and the key reads up to the zero padding.
+ * @param socket
+ * @param messages, msg_name has room for a struct sockaddr_un
+ * @param number of messages
+ * @return number received or -1
+ */
+static int unix_recv(int sock, struct mmsghdr *msgs, unsigned int n) {
+	int got = recvmmsg(sock, msgs, n, MSG_WAITFORONE, NULL);
+	for (int i = 0; i < got; i++) {
+		socklen_t len = msgs[i].msg_hdr.msg_namelen;
+		if (len < sizeof(struct sockaddr_un)) memset((char *)msgs[i].msg_hdr.msg_name + len, 0, sizeof(struct sockaddr_un) - len);
+	}
+	return got;
+}
+
+void transport_unix_address(struct sockaddr_un *addr, const char *path, bool abstract) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_LOCAL;
+	snprintf(addr->sun_path + abstract, sizeof(addr->sun_path) - abstract, "%s", path);
+}
+
+const struct ChatTransport transport_udp = {
+	.name = "udp",
+	.family = AF_INET,
+	.addrlen = sizeof(struct sockaddr_in),
+	.key = udp_key,
+	.format = udp_format,
+	.reachable = udp_reachable,
+	.bind = udp_bind,
+	.send = datagram_send,
+	.recv = udp_recv
+};
+
+const struct ChatTransport transport_unix = {
+	.name = "unix",
+	.family = AF_LOCAL,
+	.addrlen = sizeof(struct sockaddr_un),
+	.key = unix_key,
+	.format = unix_format,
+	.reachable = unix_reachable,
+	.bind = unix_bind,
+	.send = datagram_send,
+	.recv = unix_recv
+};
@@ -0,0 +1,53 @@
+/**
+ * @file transport.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Address family specific parts of the chat servers behind one interface
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define TRANSPORT_NAME_LEN 128 /* longest printable peer, a socket file with room to spare */
+
+/* Everything the chat engine needs to know about an address family. The chat
+ * server sends and receives through send and recv, several datagrams per
+ * call, so a batched fan-out works the same on every transport. */
+struct ChatTransport {
+	const char *name;
+	int family;
+	socklen_t addrlen; /* size of a peer address, e.g. sizeof(struct sockaddr_in) */
+	/* bytes identifying a peer in the client index, they lie inside the address */
+	const void *(*key)(const void *addr, size_t *len);
+	/* printable peer for the logs and the console */
+	const char *(*format)(const void *addr, char *buf, size_t size);
+	/* false for a peer which cant be answered, e.g. an unbound unix socket */
+	bool (*reachable)(const void *addr);
+	/* datagram socket bound to the server address, shared by several sockets with SO_REUSEPORT if asked for */
+	int (*bind)(const void *addr, bool shared);
+	/* send one datagram per message, returns the number sent or -1 if the first one failed */
+	int (*send)(int sock, struct mmsghdr *msgs, unsigned int n);
+	/* receive up to n datagrams, waits for the first one, the addresses are zero padded to addrlen.
+	 * Returns the number received or -1 */
+	int (*recv)(int sock, struct mmsghdr *msgs, unsigned int n);
+};
+
+extern const struct ChatTransport transport_udp;
+extern const struct ChatTransport transport_unix;
+
+/**
+ * @brief Fill the address of a unix socket. An abstract name is the path behind a zero byte,
+ * padded with zeros to the full sun_path, so it is bound and addressed with sizeof(struct sockaddr_un).
+ * @param output
+ * @param path of the socket
+ * @param true for the abstract namespace, which needs no socket file
+ * @return void
+ */
+void transport_unix_address(struct sockaddr_un *addr, const char *path, bool abstract);
+
+#endif
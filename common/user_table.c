@@ -0,0 +1,71 @@
+/**
+ * @file user_table.c
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Users of the local clients by uid, as the kernel reports them with SCM_CREDENTIALS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pwd.h>
+#include "user_table.h"
+#include "log.h"
+
+int user_table_init(struct UserTable *t, uint32_t capacity) {
+	uint32_t n = 1;
+	while (n < capacity) n <<= 1;
+	memset(t, 0, sizeof(*t));
+	t->users = calloc(n, sizeof(struct User));
+	if (!t->users) return -1;
+	t->capacity = n;
+	return 0;
+}
+
+void user_table_free(struct UserTable *t) {
+	free(t->users);
+	memset(t, 0, sizeof(*t));
+}
+
+/**
+ * @brief Name of a user, the uid as number if it has no entry in the passwd database
+ * @param uid
+ * @param output
+ * @param output size
+ * @return void
+ */
+static void resolve_login(uid_t uid, char *login, size_t size) {
+	struct passwd pw, *found = NULL;
+	char buf[1024];
+	if (getpwuid_r(uid, &pw, buf, sizeof(buf), &found) == 0 && found)
+		snprintf(login, size, "%s", found->pw_name);
+	else
+		snprintf(login, size, "%u", (unsigned)uid);
+}
+
+struct User *user_get(struct UserTable *t, uid_t uid) {
+	uint32_t mask = t->capacity - 1;
+	/* uids are small and dense, a multiplicative hash spreads them over the table */
+	for (uint32_t i = ((uint32_t)uid * 2654435761u) & mask, n = 0; n < t->capacity; i = (i + 1) & mask, n++) {
+		struct User *u = &t->users[i];
+		if (u->used && u->uid == uid) return u;
+		if (u->used) continue;
+		u->used = true;
+		u->uid = uid;
+		resolve_login(uid, u->login, sizeof(u->login));
+		t->count++;
+		return u;
+	}
+	return NULL;
+}
+
+void user_table_print_stats(const struct UserTable *t) {
+	if (!t->users) return;
+	LOG_INFO("%u users seen", t->count);
+	for (uint32_t i = 0; i < t->capacity; i++) {
+		const struct User *u = &t->users[i];
+		if (u->used)
+			LOG_INFO("  User %s (uid %u): %u clients, %lu messages, %lu dropped by the rate limit",
+				u->login, (unsigned)u->uid, u->clients, u->account.messages, u->account.limited);
+	}
+}
@@ -0,0 +1,68 @@
+/**
+ * @file user_table.h
+ * @author agent <agent@local>
+ * @date 17.10.2026
+ * @brief Users of the local clients by uid, as the kernel reports them with SCM_CREDENTIALS
+ */
+
+#ifndef USER_TABLE_H
+#define USER_TABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "chat_server.h"
+
+#define USER_TABLE_DEFAULT_LEN 1024 /* users, a power of two */
+#define USER_LOGIN_LEN 32
+
+/* State shared by all clients of one user. The login is resolved once, when
+ * the user registers the first client, so a message never calls into NSS. */
+struct User {
+	uid_t uid;
+	bool used;
+	char login[USER_LOGIN_LEN + 1]; /* user name or the uid as number */
+	uint32_t clients; /* registered clients of the user */
+	struct ChatAccount account; /* rate limit and counters of all clients of the user */
+};
+
+/* Open addressing with linear probing on the uid. Users are only added, a
+ * user without clients keeps its entry, so a pointer to an entry stays valid
+ * while the table lives. The number of users on one host is small. */
+struct UserTable {
+	struct User *users;
+	uint32_t capacity;
+	uint32_t count;
+};
+
+/**
+ * @brief Allocate the table
+ * @param table
+ * @param number of users, rounded up to a power of two
+ * @return 0 on success, -1 if out of memory
+ */
+int user_table_init(struct UserTable *t, uint32_t capacity);
+
+/**
+ * @brief Free the table
+ * @param table
+ * @return void
+ */
+void user_table_free(struct UserTable *t);
+
+/**
+ * @brief Find a user or add it with its login
+ * @param table
+ * @param uid
+ * @return user or NULL if the table is full
+ */
+struct User *user_get(struct UserTable *t, uid_t uid);
+
+/**
+ * @brief Log the users which registered clients
+ * @param table
+ * @return void
+ */
+void user_table_print_stats(const struct UserTable *t);
+
+#endif
@@ -11,32 +11,32 @@
 
 /* UDPChat Client by Lukas Becker
 UDP Datagram Socket chat 
-Usage: ./client [username] 
+Usage: ./client [username] (server ip) (-t Text protocol) (-R Reliable delivery)
 */
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/socket.h>
-#include <sys/un.h>
 #include <signal.h>
-#include <sys/ioctl.h> 
-#include <sys/stat.h>
 #include <time.h>
 #include <arpa/inet.h>
-#include <sys/select.h>
 #include <stdbool.h>
+#include "chat_proto.h"
+#include "chat_client.h"
+#include "chat_engine.h"
+#include "event_loop.h"
 
-#define STDIN 0
 #define SERVER_PORT  8421
 #define SERVER_IP "127.0.0.1"
-#define BUFFER_LEN 512
-#define REGISTER_CHAR "#"
-#define DISC_CHAR "%"
+#define DISC_FLUSH_MS 2000 /* how long a reliable client waits for the ack of its disconnect */
 
-char* username;
 int sock_cli;
 char ip[INET_ADDRSTRLEN];
+struct ChatRoster roster;
+struct ChatClient client;
+struct EventLoop loop;
+int line = 4;
 
 /**
  * @brief Return current timestamp as format
@@ -60,8 +60,7 @@ char* calctime() {
  * @return void
  */
 void cleanup() {
-	/* Delete client socket file 
-	 * TODO: two clients with the same name will delete the file when on client disconnects */
+	chat_client_free(&client);
 	close(sock_cli);
 	exit(EXIT_SUCCESS);
 }
@@ -72,37 +71,20 @@ void cleanup() {
  * @return void
  */
 void disconnect() {
-	size_t bye_len = strlen(DISC_CHAR) + strlen(username) + 1;
-	char *bye = malloc(bye_len);
-
-	snprintf(bye, bye_len, "%s%s", DISC_CHAR, username);
-
-	/* Static initializers also zero all non-specified fields.
-	 * The previous code had possible garbage in the address. */
-	struct sockaddr_in address_ser = {
-		.sin_family = AF_INET,
-		.sin_port = htons(SERVER_PORT),
-		.sin_addr.s_addr = inet_addr(ip)
-	};
-	memset(address_ser.sin_zero, '\0', sizeof(address_ser.sin_zero));
-	socklen_t addrlen_ser = sizeof(address_ser);
-
-	/* Send disconnect message to server */
-	sendto (sock_cli, bye, strlen(bye), 0, (struct sockaddr *) &address_ser, 
-addrlen_ser);
-	
+	chat_client_disconnect(&client, DISC_FLUSH_MS);
 	printf("\n%s:UCHAT: Disconnected properly\n", calctime());
 	cleanup();
-	
 }
 
 /**
- * @brief Handler for Str+C to close sockets
- * @param signal
+ * @brief Str+C or kill, delivered through the event loop
+ * @param loop
+ * @param signalfd
+ * @param signal number
+ * @param unused
  * @return void
  */
-void exit_handler(int s){
-	/* Disconnect on str+c */
+void on_signal(struct EventLoop *l, int fd, unsigned long signo, void *ctx) {
 	disconnect();
 }
 
@@ -118,8 +100,90 @@ void output_handler(const char buffer[], int line) {//, struct winsize * size) {
 	 * \033[line;rowH specifies cursor position */
 	printf("\033[%d;0H%s %s\n", line-2, calctime(), buffer);
 	printf("\033[%d;0H--------------------------------------------",line-1);
+	fflush(stdout);
+}
+
+/**
+ * @brief Handle one frame of the server
+ * @param client
+ * @param frame header
+ * @param payload
+ * @return void
+ */
+void on_frame(struct ChatClient *c, const struct ChatHeader *h, const char *payload) {
+	char text[CHAT_CLIENT_TEXT_LEN];
+	if (h->type == CHAT_FULL) {
+		printf("\e[1;1H\e[2J");
+		if (h->seq)
+			printf("%s:UCHAT: Server is full, you are number %u in the queue\n", calctime(), h->seq);
+		else
+			printf("%s:UCHAT: Server is full, you are waiting to be registered\n",calctime());
+		chat_client_restart(c);
+	} else if (h->type == CHAT_CLOSING) {
+		printf("\n\n%s:ERROR: Server is closing, you are being disconnected!\n", calctime());
+		cleanup();
+	} else if (chat_render(&roster, h, payload, text, sizeof(text)) >= 0) {
+		output_handler(text, line);
+		line += 1;
+	}
+}
+
+/**
+ * @brief Show a message of a text server
+ * @param client
+ * @param zero terminated message
+ * @param message length
+ * @return void
+ */
+void on_text(struct ChatClient *c, const char *text, size_t len) {
+	output_handler(text, line);
+	line += 1;
+}
+
+/**
+ * @brief Server does not answer
+ * @param client
+ * @return void
+ */
+void on_lost(struct ChatClient *c) {
+	printf("%s:ERROR: Server not available\n", calctime());
+	cleanup();
+}
+
+/**
+ * @brief Send a line typed by the user
+ * @param zero terminated line
+ * @return void
+ */
+void on_line(char *message) {
+	/* Disconnect if a the user writes either exit or quit */
+	if (strcmp(message, "exit") == 0 || strcmp(message, "quit") == 0) disconnect();
+	if (chat_client_input(&client, message) < 0) {
+		printf("%s:ERROR: Communication to the server has failed.\n", calctime());
+		cleanup();
+	}
+}
+
+/**
+ * @brief Console has input
+ * @param loop
+ * @param stdin
+ * @param unused
+ * @param unused
+ * @return void
+ */
+void on_console(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	static struct ChatConsole console;
+	/* end of input leaves the chat like exit */
+	if (chat_console_read(&console, fd, on_line) < 0) disconnect();
 }
 
+const struct ChatClientOps client_ops = {
+	.frame = on_frame,
+	.text = on_text,
+	.lost = on_lost
+};
+
 /**
  * @brief Main function, handles all communication
  * @param number of arguments
@@ -127,35 +191,42 @@ void output_handler(const char buffer[], int line) {//, struct winsize * size) {
  * @return success state
  */
 int main (int argc, char* argv[]) {
-	
-	struct timeval timeout;
-	timeout.tv_sec = 1; 
-    	timeout.tv_usec = 0; 
-    	bool waiting = 1;
-    	//char ip[INET_ADDRSTRLEN];
-    	int nbytes, line = 4, maxfd;
-    	fd_set read_fds;
-    	
-    	signal (SIGINT, exit_handler);
+	bool text_proto = 0; /* talk the old text protocol instead of binary frames */
+	bool reliable = 0; /* acked, retransmitted and ordered frames in both directions */
+	int signals[] = { SIGINT, SIGTERM };
     	
+	int opt;
+	while ((opt = getopt(argc, argv, "tR")) != -1) {
+		if (opt == 't') {
+			text_proto = 1;
+		} else if (opt == 'R') {
+			reliable = 1;
+		} else {
+			printf("%s:UCHAT: Usage %s [name] (server ip) (-t Text protocol) (-R Reliable delivery)\n", calctime(), argv[0]);
+			exit (EXIT_FAILURE);
+		}
+	}
+	if (reliable && text_proto) {
+		printf("%s:UCHAT: Reliable delivery needs the binary protocol, -R is ignored\n", calctime());
+		reliable = 0;
+	}
 	// Check if username was supplied
-	if (argc < 2) {
+	if (optind >= argc) {
 		printf("%s:UCHAT: Please enter your username /uchat [name]\n", calctime());
 		exit (EXIT_FAILURE);
 	}
-	if (argc == 3) {
-		if (strlen(ip) > INET_ADDRSTRLEN) {
+	if (argc - optind == 2) {
+		if (strlen(argv[optind+1]) >= INET_ADDRSTRLEN) {
 			printf("%s:UCHAT: Server IP too long\n", calctime());
 			exit(EXIT_FAILURE);
 		}
-		strcpy(ip, argv[2]);
+		strcpy(ip, argv[optind+1]);
 	} else {
 		strcpy(ip, SERVER_IP);
 	}
-	if (strlen(argv[1]) > 50) {
+	if (strlen(argv[optind]) > CHAT_NAME_LEN) {
 		printf("%s:UCHAT: Your username can only be 50 characters long\n", calctime());
 	}
-	username = strdup(argv[1]);
 	
 	// Initialize the server socket address.
 	struct sockaddr_in address_ser = {
@@ -163,94 +234,40 @@ int main (int argc, char* argv[]) {
 		.sin_port = htons(SERVER_PORT),
 		.sin_addr.s_addr = inet_addr(ip)
 	};
-	memset(address_ser.sin_zero, '\0', sizeof(address_ser.sin_zero));
-	socklen_t addrlen_ser = sizeof(address_ser);
-	
-	FD_ZERO(&read_fds);
-	
-	// Construct message header containing name and parathenses
 	
-	char message_header = '+';
-	printf("%s:UCHAT: Message prefix is %c\n", calctime(), message_header);
-	
-	// Create login message
-	size_t welcome_len = strlen(REGISTER_CHAR) + strlen(argv[1]) + 1;
-	char *welcome = malloc(welcome_len);
-	snprintf(welcome, welcome_len, "%s%s", REGISTER_CHAR, argv[1]);
+	if (text_proto)
+		printf("%s:UCHAT: Message prefix is +\n", calctime());
+	else
+		printf("%s:UCHAT: Using the binary protocol version %d\n", calctime(), CHAT_PROTO_VERSION);
 
 	// Create client socket.
 	if((sock_cli=socket (AF_INET, SOCK_DGRAM, 0)) > 0) {
 		printf("%s:UCHAT: Client socket created\n", calctime());
 	}
-	
-	printf("\e[1;1H\e[2J");
-	maxfd = (sock_cli > STDIN) ? sock_cli:STDIN;
-	while(1) {
-		if(waiting) {
-			nbytes = sendto (sock_cli, welcome, strlen (welcome), 0, (struct sockaddr *) &address_ser, addrlen_ser);
-			if (nbytes < 0) {
-				printf("%s:ERROR: Server not available\n", calctime());
-				cleanup();
-			}
-			// Only problem here, this spams the commandline if a server is not available, if one
-			// is started it will end up in a mess. I can be fixed by acknowledging the connection on the client
-			printf("%s:UCHAT: Reconnecting...Press Ctrl+c to exit\n",calctime());
-			waiting = 1;
-			
-		} 
-		FD_SET(sock_cli,&read_fds);
-		FD_SET(0,&read_fds);
-		size_t bufsize = 100;
-		char *message = malloc(bufsize);
 
-		select(maxfd+1, &read_fds, NULL, NULL, &timeout);
-		
-		if (FD_ISSET(0, &read_fds)) { // STDIN has information
-			
-			int len = getline(&message,&bufsize,stdin);
-		
-			/* Disconnect if a the user writes either exit or quit */
-			if(len > 1 && (strncmp(message,"exit", len-1)  == 0 || strncmp(message,"quit",len-1) == 0)) disconnect();
+	chat_client_init(&client, sock_cli, &address_ser, sizeof(address_ser), argv[optind], &client_ops, NULL);
+	client.text_proto = text_proto;
+	/* the registration tells the server that several frames per datagram are fine */
+	client.register_flags |= CHAT_FLAG_COALESCE;
+	if (reliable && chat_client_reliable(&client) < 0) {
+		printf("%s:ERROR: Out of memory\n", calctime());
+		exit(EXIT_FAILURE);
+	}
 
-			char *linebreak = strchr(message, '\n');
-			if (linebreak) linebreak[0] = '\0';
-			if (strlen(message) != 0) {
-				size_t blen = 1 + strlen(message) + 1;
-				char *buf = malloc(blen);
-				snprintf(buf, blen, "%c%s", message_header, message);
-				nbytes = sendto (sock_cli,buf,strlen(buf), 0, (struct sockaddr *) &address_ser, addrlen_ser);
-				if (nbytes < 0) {
-					printf("%s:ERROR: Communication to the server has failed.\n", calctime());
-					cleanup();
-				}
-				free(buf);
-			}
-		}
-		if (FD_ISSET(sock_cli, &read_fds)) { // Server has new information
-			
-			char *buffer = malloc(BUFFER_LEN);
-			ssize_t nbytes = recv(sock_cli, buffer, BUFFER_LEN, 0);
-			if (nbytes <= 0)
-				break;
-			buffer[nbytes] = '\0';
-			waiting = 0;
-			// React on special characters by the server
-			if (strncmp(buffer,"##", strlen("##")) == 0) {
-				waiting = 1;
-				printf("\e[1;1H\e[2J");
-				sleep(2);
-				printf("%s:UCHAT: Server is full, you are waiting to be registered\n",calctime());
-				continue;
-			}
-			if (strncmp(buffer,"--", strlen("--")) == 0) {
-				printf("\n\n%s:ERROR: Server is closing, you are being disconnected!\n", calctime());
-				cleanup();
-			}
-			output_handler(buffer, line);
-			line += 1;
-		}
-		free(message);
-  	}
-	/* close socket */
-	close (sock_cli); 
+	/* the loop sleeps until the server, the user, a signal or the one timer of the client wakes it */
+	if (event_loop_init(&loop, EVENT_BACKEND_EPOLL) < 0 || event_loop_add_signals(&loop, signals, 2, on_signal, NULL) < 0 ||
+			event_loop_add(&loop, STDIN_FILENO, on_console, NULL) < 0) {
+		printf("%s:ERROR: Could not create the event loop\n", calctime());
+		exit(EXIT_FAILURE);
+	}
+	printf("\e[1;1H\e[2J");
+	printf("%s:UCHAT: Connecting...Press Ctrl+c to exit\n",calctime());
+	fflush(stdout);
+	/* sends the registration, again every second until the server answers */
+	if (chat_client_attach(&client, &loop) < 0) {
+		printf("%s:ERROR: Could not create the event loop\n", calctime());
+		exit(EXIT_FAILURE);
+	}
+	event_loop_run(&loop);
+	cleanup();
 }
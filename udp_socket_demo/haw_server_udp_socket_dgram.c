@@ -11,107 +11,761 @@
 
 /* UDPChat Server by Lukas Becker
 Udp Datagram Socket chat server
-Usage: ./uchat_ser <num clients> (-d Debug)
+Usage: ./uchat_ser <max clients, 0 for no limit> (-d Debug) (-b Batch size) (-r Ring depth) (-w Worker threads)
+	(-s Stats interval) (-u io_uring) (-i Idle timeout) (-c Coalescing window) (-H History directory) (-n Replayed messages)
+	(-l Messages per second of a client) (-L Messages per second of all clients) (-m Metrics port or socket file)
+	(-q Waiting clients) (-z Shortest compressed payload)
 */
 
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <signal.h>
-#include <time.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include "recv_ring.h"
+#include "log.h"
+#include "event_loop.h"
+#include "chat_proto.h"
+#include "reliable.h"
+#include "metrics.h"
+#include "chat_server.h"
 
 #define SERVER_PORT  8421
 #define SERVER_IP "127.0.0.1"
-#define BUFFER_LEN 4096
-#define REGISTER_CHAR '#' /* Character to identify a new client */
-#define DISC_CHAR '%' /* Character to identify a disconnection */
-#define CLOSING_MSG "--" /* Character send to clients on server termination */
-
-struct Client {
-	struct sockaddr_in data;
-	char name[51];
+#define BUFFER_LEN CHAT_SERVER_DATAGRAM_LEN
+#define MAX_WORKERS 64
+#define REL_TICK_MS 10 /* resolution of the retransmit timers */
+#define REL_MAX_EXPIRED 64 /* dead reliable clients removed per tick */
+#define USAGE "<MAX CLIENTS, 0 for no limit> (-w Worker threads) (-c Coalescing window in microseconds) " CHAT_SERVER_USAGE
+
+/* Protocol of a client, a compressed broadcast only splits the clients of one protocol */
+#define CLIENT_PROTOCOL (CHAT_CLIENT_BINARY | CHAT_CLIENT_RELIABLE | CHAT_CLIENT_COALESCE)
+
+/* Broadcast frames held back by a worker to be sent to every recipient in
+ * one datagram. All frames go to the same audience, a frame for another
+ * audience sends the held ones first, so every client gets the frames in
+ * the order the worker handled them. */
+struct Coalesce {
+	char buf[CHAT_COALESCE_MAX];
+	size_t len;
+	int frames;
+	bool room; /* audience is a room, else all clients */
+	char room_name[CHAT_ROOM_LEN];
+	size_t room_len;
+	int except; /* client handle left out or -1 */
+	uint64_t since_us; /* time the first frame was held */
+	unsigned long total_frames, datagrams;
+};
+
+/* What a client gets of a message, filled in one walk over the audience */
+enum Fanout {
+	FANOUT_TEXT,
+	FANOUT_FRAME,
+	FANOUT_COMPRESSED,
+	FANOUT_VECTORS
+};
+
+/* Every worker owns one socket bound to the server port and its receive ring */
+struct Worker {
+	int id;
+	pthread_t thread;
+	struct RecvRing ring;
+	struct Coalesce co;
+	struct ChatContext cx; /* socket, arena, broadcast vector and rate limit share of the worker */
+	struct Broadcast fanout[FANOUT_VECTORS];
 };
 
-bool debug = 0;
-struct Client *clients;
-socklen_t clientlen;
-int sock, n_clients;
+/* Registered clients, rooms, waiting clients and everything else every transport does the same.
+ * The server part of a client is its reliable stream, NULL if it has none. */
+struct ChatServer server;
+int n_workers = 1;
+struct Worker *workers;
+/* Workers whose socket is bound and workers whose thread runs, only those are closed and joined */
+int workers_bound;
+int workers_started;
+bool workers_stop;
+/* Used by the console, timers and signals on the main thread */
+struct Worker admin;
+/* Guards the reliable streams and their timers, always taken after the registry lock */
+pthread_mutex_t rel_lock = PTHREAD_MUTEX_INITIALIZER;
+struct TimerWheel rel_wheel;
+/* How long a worker may hold broadcast frames to pack them, 0 sends every frame at once */
+int coalesce_us;
+
+/* Frames of one reliable stream which became deliverable by one received frame */
+struct Delivery {
+	struct Worker *w;
+	int n;
+	struct ChatHeader h[REL_WINDOW];
+	const char *payload[REL_WINDOW];
+};
+
+/* Reliable clients found dead by one tick of the retransmit timers */
+struct RelTick {
+	uint64_t now;
+	int n_dead;
+	int dead[REL_MAX_EXPIRED];
+	struct RelPeer *peers[REL_MAX_EXPIRED];
+};
+
+void print_reliable_stats();
+void coalesce_print_stats(struct Worker *w);
+void coalesce_flush(struct Worker *w);
 
 /**
- * @brief Return current timestamp as format
+ * @brief Stop the worker threads which were started and wait for them
  * @param void
- * @return time string
+ * @return void
+ */
+void stop_workers() {
+	__atomic_store_n(&workers_stop, true, __ATOMIC_RELEASE);
+	/* wakes a worker blocked in recvmmsg, on an unconnected socket
+	 * this reports ENOTCONN but shuts the socket down all the same */
+	for (int i = 0; i < workers_started; i++)
+		shutdown(workers[i].cx.sock, SHUT_RD);
+	for (int i = 0; i < workers_started; i++)
+		pthread_join(workers[i].thread, NULL);
+	workers_started = 0;
+}
+
+/**
+ * @brief Stop the workers and cleanup sockets after closing or a failed start
+ * @param exit status
+ * @return void
+ */
+void cleanup(int status) {
+	stop_workers();
+	for (int i = 0; i < workers_bound; i++) {
+		if (n_workers > 1) LOG_INFO("Worker %d", i);
+		recv_ring_print_stats(&workers[i].ring);
+		chat_context_print_stats(&workers[i].cx);
+		coalesce_print_stats(&workers[i]);
+		close(workers[i].cx.sock);
+	}
+	print_reliable_stats();
+	chat_server_close(&server);
+	if (status == EXIT_SUCCESS) LOG_INFO("Sucessfully closed server");
+	if (log_dropped()) LOG_INFO("Logger dropped %lu messages", log_dropped());
+	exit(status);
+}
+
+/**
+ * @brief Send one frame of a reliable stream, called by rel_poll
+ * @param reliable stream
+ * @param packed header
+ * @param payload
+ * @param payload length
+ * @param worker whose socket is used
+ * @return void
+ */
+void rel_send(struct RelPeer *p, const char *header, const char *payload, size_t len, void *ctx) {
+	struct Worker *w = ctx;
+	struct iovec iov[2] = {
+		{ (void *)header, CHAT_HEADER_LEN },
+		{ (void *)payload, len }
+	};
+	struct msghdr msg = {
+		.msg_name = &p->addr,
+		.msg_namelen = p->addrlen,
+		.msg_iov = iov,
+		.msg_iovlen = 2
+	};
+	ssize_t sent = sendmsg(w->cx.sock, &msg, 0);
+	metrics_sent(sent);
+	if (sent < 0)
+		LOG_DEBUG("Sending reliable frame to client %d failed: %s", p->id+1, strerror(errno));
+}
+
+/**
+ * @brief Send what the window allows and rearm the retransmit timer, rel_lock must be held
+ * @param worker whose socket is used
+ * @param reliable stream
+ * @param current time in milliseconds
+ * @return void
+ */
+void rel_kick(struct Worker *w, struct RelPeer *p, uint64_t now) {
+	uint64_t deadline = rel_poll(p, now, rel_send, w);
+	/* a dead stream is handed to the next tick which removes the client */
+	if (deadline == 0) timer_wheel_add(&rel_wheel, &p->timer, now);
+	else if (deadline == UINT64_MAX) timer_wheel_del(&rel_wheel, &p->timer);
+	else timer_wheel_add(&rel_wheel, &p->timer, deadline);
+}
+
+/**
+ * @brief Acknowledge the received frames of a reliable stream, rel_lock must be held
+ * @param worker whose socket is used
+ * @param reliable stream
+ * @return void
+ */
+void rel_send_ack(struct Worker *w, struct RelPeer *p) {
+	char ack[REL_ACK_LEN];
+	size_t len = rel_ack(p, CHAT_SENDER_SERVER, ack);
+	metrics_sent(sendto(w->cx.sock, ack, len, 0, (struct sockaddr *)&p->addr, p->addrlen));
+}
+
+/**
+ * @brief Reliable stream of a registered client, the registry lock must be held
+ * @param client handle
+ * @return reliable stream or NULL
+ */
+struct RelPeer *client_rel(int id) {
+	return *(struct RelPeer **)chat_server_ext(&server, id);
+}
+
+/**
+ * @brief Worker a context belongs to
+ * @param context of the worker
+ * @return worker
+ */
+struct Worker *worker_of(struct ChatContext *cx) {
+	return (struct Worker *)((char *)cx - offsetof(struct Worker, cx));
+}
+
+/**
+ * @brief Queue a frame in the stream of a reliable client, rel_lock must be held
+ * @param worker whose socket is used
+ * @param reliable stream
+ * @param client handle
+ * @param frame type
+ * @param frame flags
+ * @param sender id of the frame
+ * @param payload shared by all streams
+ * @param current time in milliseconds
+ * @return true if the frame was queued
+ */
+bool queue_reliable(struct Worker *w, struct RelPeer *rel, int id, int type, int flags, uint32_t sender, struct RelBlob *blob, uint64_t now) {
+	/* the client is a full queue behind, it will time out if it does not catch up */
+	if (rel_queue(rel, type, flags, sender, blob) < 0) {
+		LOG_DEBUG("Reliable queue of client %d is full, dropping frame", id+1);
+		return false;
+	}
+	rel_kick(w, rel, now);
+	return true;
+}
+
+/**
+ * @brief Send the held frames to their audience
+ * @param worker
+ * @return void
+ */
+void coalesce_flush(struct Worker *w) {
+	struct Coalesce *co = &w->co;
+	if (!co->len) return;
+	broadcast_begin(&w->cx.bcast, co->buf, co->len);
+	chat_server_fanout(&w->cx, CHAT_CLIENT_BINARY | CHAT_CLIENT_COALESCE, CLIENT_PROTOCOL, co->except, co->room ? co->room_name : NULL, co->room_len);
+	co->datagrams++;
+	co->len = 0;
+	co->frames = 0;
+}
+
+/**
+ * @brief Hold a broadcast frame for the clients which get several frames per datagram
+ * @param worker
+ * @param room name or NULL for all clients
+ * @param room name length
+ * @param client handle to leave out or -1
+ * @param packed header
+ * @param payload
+ * @param payload length
+ * @return true if the frame is held, false if it has to be sent at once
+ */
+bool coalesce_add(struct Worker *w, const char *room, size_t room_len, int except, const char *header, const char *payload, size_t len) {
+	struct Coalesce *co = &w->co;
+	/* the admin worker has no receive loop which would send the held frames */
+	if (!coalesce_us || w->id < 0 || CHAT_HEADER_LEN + len > sizeof(co->buf) || room_len > sizeof(co->room_name)) {
+		coalesce_flush(w);
+		return false;
+	}
+	bool same = co->except == except && co->room == (room != NULL) &&
+		(!room || (co->room_len == room_len && memcmp(co->room_name, room, room_len) == 0));
+	if (co->len && (!same || co->len + CHAT_HEADER_LEN + len > sizeof(co->buf))) coalesce_flush(w);
+	if (!co->len) {
+		co->room = room != NULL;
+		co->room_len = room ? room_len : 0;
+		if (room) memcpy(co->room_name, room, room_len);
+		co->except = except;
+		co->since_us = now_us();
+	}
+	memcpy(co->buf + co->len, header, CHAT_HEADER_LEN);
+	memcpy(co->buf + co->len + CHAT_HEADER_LEN, payload, len);
+	co->len += CHAT_HEADER_LEN + len;
+	co->frames++;
+	co->total_frames++;
+	return true;
+}
+
+/**
+ * @brief Send the held frames unless more datagrams are waiting and the window is still open
+ * @param worker
+ * @param number of datagrams the last receive picked up
+ * @return void
+ */
+void coalesce_check(struct Worker *w, int received) {
+	int waiting = 0;
+	if (!w->co.len) return;
+	/* only a full batch hints at a burst, the next receive must not block on the held frames */
+	if (received == w->ring.batch && now_us() - w->co.since_us < (uint64_t)coalesce_us &&
+			ioctl(w->cx.sock, FIONREAD, &waiting) == 0 && waiting > 0)
+		return;
+	coalesce_flush(w);
+}
+
+/**
+ * @brief Log how many frames were packed into how many datagrams
+ * @param worker
+ * @return void
+ */
+void coalesce_print_stats(struct Worker *w) {
+	if (!w->co.datagrams) return;
+	LOG_INFO("Coalesced %lu frames into %lu datagrams (%.1f frames per datagram)", w->co.total_frames, w->co.datagrams,
+		(double)w->co.total_frames / w->co.datagrams);
+}
+
+/**
+ * @brief Send a text message to the text clients and a frame to the binary clients of a room.
+ * Reliable clients get the frame with the position in their stream as sequence number.
+ * @param worker whose socket is used
+ * @param room name or NULL for all clients
+ * @param room name length
+ * @param text message or NULL to leave out the text clients
+ * @param text length
+ * @param frame type
+ * @param frame flags
+ * @param sender id of the frame
+ * @param sequence number of the frame
+ * @param frame payload, sent untouched
+ * @param payload length
+ * @param client handle to leave out or -1
+ * @return number of clients the message was sent to
+ */
+int notify_room(struct Worker *w, const char *room, size_t room_len, const char *text, size_t text_len, int type, int flags,
+		uint32_t sender, uint32_t seq, const char *payload, size_t len, int except) {
+	char header[CHAT_HEADER_LEN], zheader[CHAT_HEADER_LEN];
+	struct Broadcast *fan = w->fanout;
+	struct RelBlob *blob = NULL, *zblob = NULL;
+	bool rel_locked = false;
+	uint64_t now = 0;
+	int sent = 0, room_id;
+	size_t zlen = chat_context_compress(&w->cx, payload, len);
+	chat_pack(header, type, flags, sender, seq, len);
+	chat_pack(zheader, type, flags | CHAT_FLAG_COMPRESSED, sender, seq, zlen);
+	/* the held frames go to clients with and without compression, so a compressed frame is never held */
+	if (coalesce_us && zlen) coalesce_flush(w);
+	bool held = coalesce_us && !zlen && coalesce_add(w, room, room_len, except, header, payload, len);
+	broadcast_begin(&fan[FANOUT_TEXT], text, text_len);
+	broadcast_begin_frame(&fan[FANOUT_FRAME], header, CHAT_HEADER_LEN, payload, len);
+	broadcast_begin_frame(&fan[FANOUT_COMPRESSED], zheader, CHAT_HEADER_LEN, w->cx.z.buf, zlen);
+
+	/* one walk sorts every client into the vector of what it gets and queues the
+	 * reliable frames, the vectors are sent after the registry lock is released */
+	pthread_rwlock_rdlock(&server.lock);
+	int count = chat_server_audience(&server, room, room_len, &room_id);
+	for (int v = 0; v < FANOUT_VECTORS; v++)
+		chat_server_reserve(&fan[v], count);
+	const char *addrs = registry_column(&server.clients, CHAT_CLIENT_ADDR);
+	const uint8_t *state = registry_column(&server.clients, CHAT_CLIENT_STATE);
+	for (int k = 0; k < count; k++) {
+		int i, pos = chat_server_audience_pos(&server, room_id, k, &i);
+		if (i == except) continue;
+		const char *addr = addrs + (size_t)pos * server.transport->addrlen;
+		bool compressed = zlen && (state[pos] & CHAT_CLIENT_COMPRESS);
+		if (state[pos] & CHAT_CLIENT_RELIABLE) {
+			/* reliable clients of either kind share one blob per variant */
+			if (!rel_locked) {
+				pthread_mutex_lock(&rel_lock);
+				rel_locked = true;
+				now = now_ms();
+			}
+			if (compressed ? !zblob && !(zblob = rel_blob_get(w->cx.z.buf, zlen)) : !blob && !(blob = rel_blob_get(payload, len))) continue;
+			struct RelPeer *rel = *(struct RelPeer **)registry_at(&server.clients, CHAT_CLIENT_EXT, pos);
+			sent += queue_reliable(w, rel, i, type, compressed ? flags | CHAT_FLAG_COMPRESSED : flags, sender, compressed ? zblob : blob, now);
+		} else if (!(state[pos] & CHAT_CLIENT_BINARY)) {
+			if (text) broadcast_add(&fan[FANOUT_TEXT], addr, i);
+		} else if (compressed) {
+			broadcast_add(&fan[FANOUT_COMPRESSED], addr, i);
+		} else if (!held || !(state[pos] & CHAT_CLIENT_COALESCE)) {
+			broadcast_add(&fan[FANOUT_FRAME], addr, i);
+		}
+	}
+	if (rel_locked) {
+		rel_blob_put(blob);
+		rel_blob_put(zblob);
+		pthread_mutex_unlock(&rel_lock);
+	}
+	pthread_rwlock_unlock(&server.lock);
+
+	for (int v = 0; v < FANOUT_VECTORS; v++)
+		sent += chat_server_broadcast(&w->cx, &fan[v]);
+	return sent;
+}
+
+/**
+ * @brief Send a text to the text clients and a frame to the binary clients of a room, the notify hook of the chat server
+ * @param context of the worker whose socket is used
+ * @param room name or NULL for all clients
+ * @param room name length
+ * @param text message or NULL to leave out the text clients
+ * @param text length
+ * @param frame type
+ * @param frame flags
+ * @param sender id of the frame
+ * @param sequence number of the frame
+ * @param frame payload, sent untouched
+ * @param payload length
+ * @param client handle to leave out or -1
+ * @return number of clients the message was sent to
+ */
+int udp_notify(struct ChatContext *cx, const char *room, size_t room_len, const char *text, size_t text_len, int type, int flags,
+		uint32_t sender, uint32_t seq, const char *payload, size_t len, int except) {
+	return notify_room(worker_of(cx), room, room_len, text, text_len, type, flags, sender, seq, payload, len, except);
+}
+
+/**
+ * @brief Queue a frame in the stream of a reliable client, the registry lock must be held
+ * @param context of the worker whose socket is used
+ * @param client handle
+ * @param frame type
+ * @param frame flags
+ * @param sender id
+ * @param payload
+ * @param payload length
+ * @return false if the client has no reliable stream
+ */
+bool udp_unicast(struct ChatContext *cx, int id, int type, int flags, uint32_t sender, const char *payload, size_t len) {
+	struct RelPeer *rel = client_rel(id);
+	if (!rel) return false;
+	pthread_mutex_lock(&rel_lock);
+	struct RelBlob *blob = rel_blob_get(payload, len);
+	if (blob && rel_queue(rel, type, flags, sender, blob) >= 0) rel_kick(worker_of(cx), rel, now_ms());
+	rel_blob_put(blob);
+	pthread_mutex_unlock(&rel_lock);
+	return true;
+}
+
+/**
+ * @brief Send the frames held by a worker before the audience changes
+ * @param context of the worker
+ * @return void
  */
-char* calctime() {
-	time_t t;
-   	struct tm *tmp;
-   	t = time(NULL);
-   	tmp = localtime(&t);
+void udp_flush(struct ChatContext *cx) {
+	coalesce_flush(worker_of(cx));
+}
 
-	static char t_str[16];
-	strftime(t_str, 16, "%Y%m%d_%H%M%S", tmp);
-	return t_str;
+/**
+ * @brief Open the reliable stream of a client which asked for one, the registry lock is held exclusively
+ * @param context of the worker whose socket is used
+ * @param client handle
+ * @param registration of the client
+ * @return 0 on success, -1 if the stream cant be allocated
+ */
+int udp_attach(struct ChatContext *cx, int id, const struct ChatRegistration *reg) {
+	if (!(chat_server_state(&server, id) & CHAT_CLIENT_RELIABLE)) return 0;
+	struct RelPeer *peer = malloc(sizeof(*peer));
+	if (!peer) {
+		LOG_ERROR("Cant allocate reliable stream");
+		return -1;
+	}
+	/* the server stream starts at 1, the client stream after the registration */
+	rel_peer_init(peer, 1, reg->seq + 1);
+	memcpy(&peer->addr, reg->addr, sizeof(struct sockaddr_in));
+	peer->addrlen = reg->addrlen;
+	peer->id = id;
+	*(struct RelPeer **)chat_server_ext(&server, id) = peer;
+	pthread_mutex_lock(&rel_lock);
+	rel_send_ack(worker_of(cx), peer);
+	pthread_mutex_unlock(&rel_lock);
+	return 0;
 }
 
 /**
- * @brief Cleanup sockets after closing
+ * @brief Close the reliable stream of a client which is removed, the registry lock is held exclusively
+ * @param server
+ * @param client handle
+ * @return void
+ */
+void udp_detach(struct ChatServer *s, int id) {
+	struct RelPeer *rel = client_rel(id);
+	if (!rel) return;
+	pthread_mutex_lock(&rel_lock);
+	timer_wheel_del(&rel_wheel, &rel->timer);
+	rel_peer_free(rel);
+	pthread_mutex_unlock(&rel_lock);
+	free(rel);
+}
+
+/**
+ * @brief Collect a frame of a reliable stream which is next in order, called by rel_on_data
+ * @param reliable stream
+ * @param frame header
+ * @param payload, copied into the arena of the worker
+ * @param delivery list
+ * @return void
+ */
+void deliver_frame(struct RelPeer *p, const struct ChatHeader *h, const char *payload, void *ctx) {
+	struct Delivery *d = ctx;
+	char *copy = arena_alloc(&d->w->cx.arena, h->len);
+	if (!copy || d->n == REL_WINDOW) return;
+	memcpy(copy, payload, h->len);
+	d->h[d->n] = *h;
+	d->payload[d->n++] = copy;
+}
+
+/**
+ * @brief Handle an ack or a frame of a reliable stream. Frames are acknowledged
+ * at once and dispatched in stream order after the locks are released.
+ * @param worker which received the frame
+ * @param frame header
+ * @param payload
+ * @param socket address of client which sent the frame
+ * @param length of the socket address
+ * @return false if the client has no reliable stream yet
+ */
+bool reliable_frame(struct Worker *w, const struct ChatHeader *h, const char *payload, struct sockaddr_in *cliaddress, socklen_t cliaddrlen) {
+	struct Delivery d = { .w = w };
+
+	pthread_rwlock_rdlock(&server.lock);
+	int pos = chat_server_find(&w->cx, cliaddress);
+	struct RelPeer *rel = pos >= 0 ? client_rel(pos) : NULL;
+	/* acks count as well, a reliable client may only be receiving */
+	if (rel) chat_server_seen(&server, pos);
+	if (!rel) {
+		pthread_rwlock_unlock(&server.lock);
+		return h->type == CHAT_ACK;
+	}
+	pthread_mutex_lock(&rel_lock);
+	if (h->type == CHAT_ACK) {
+		uint64_t now = now_ms();
+		rel_on_ack(rel, h, payload, now);
+		/* the window moved, send what waited for it */
+		rel_kick(w, rel, now);
+	} else {
+		rel_on_data(rel, h, payload, deliver_frame, &d);
+		rel_send_ack(w, rel);
+	}
+	pthread_mutex_unlock(&rel_lock);
+	pthread_rwlock_unlock(&server.lock);
+
+	for (int k = 0; k < d.n; k++) {
+		struct ChatRequest r;
+		chat_request_frame(&r, &d.h[k], d.payload[k]);
+		chat_dispatch(chat_server_handlers, &w->cx, &r, cliaddress, cliaddrlen);
+	}
+	return true;
+}
+
+/**
+ * @brief Take the acks and the frames of reliable streams before they are dispatched
+ * @param context of the worker which received the frame
+ * @param request
+ * @param socket address of the client
+ * @param length of the socket address
+ * @return true if the frame was handled
+ */
+bool udp_frame(struct ChatContext *cx, const struct ChatRequest *r, void *addr, socklen_t addrlen) {
+	if (r->h.type != CHAT_ACK && !(r->h.flags & CHAT_FLAG_RELIABLE)) return false;
+	return reliable_frame(worker_of(cx), &r->h, r->payload, addr, addrlen);
+}
+
+/**
+ * @brief Log the statistics of the workers and the reliable streams
+ * @param server
+ * @return void
+ */
+void udp_stats(struct ChatServer *s) {
+	LOG_INFO("Event loop uses %s", event_loop_backend(&server.loop));
+	for (int i = 0; i < n_workers; i++) {
+		if (n_workers > 1) LOG_INFO("Worker %d", i);
+		recv_ring_print_stats(&workers[i].ring);
+		chat_context_print_stats(&workers[i].cx);
+		coalesce_print_stats(&workers[i]);
+	}
+	print_reliable_stats();
+}
+
+/* What only this server does, the chat server does the rest */
+const struct ChatServerOps udp_ops = {
+	.notify = udp_notify,
+	.unicast = udp_unicast,
+	.flush = udp_flush,
+	.attach = udp_attach,
+	.detach = udp_detach,
+	.frame = udp_frame,
+	.stats = udp_stats
+};
+
+/**
+ * @brief Remove a reliable client which stopped acknowledging
+ * @param worker whose socket is used
+ * @param client handle
+ * @param reliable stream found dead
+ * @return void
+ */
+void expire_client(struct Worker *w, int pos, struct RelPeer *p) {
+	char name[CHAT_CLIENT_NAME_LEN + 1];
+	size_t name_len;
+
+	pthread_rwlock_wrlock(&server.lock);
+	/* the client may have left in the meantime, and a new client may have got
+	 * its handle and a stream at the same address, which is not dead yet */
+	bool dead = false;
+	if (chat_server_client(&server, pos) && client_rel(pos) == p) {
+		pthread_mutex_lock(&rel_lock);
+		dead = rel_dead(p);
+		pthread_mutex_unlock(&rel_lock);
+	}
+	if (!dead) {
+		pthread_rwlock_unlock(&server.lock);
+		return;
+	}
+	memcpy(name, chat_server_client(&server, pos)->name, chat_server_client(&server, pos)->name_len + 1);
+	name_len = chat_server_client(&server, pos)->name_len;
+	chat_server_remove(&server, pos);
+	pthread_rwlock_unlock(&server.lock);
+
+	LOG_INFO("Client %s stopped acknowledging and was removed", name);
+	chat_server_left(&w->cx, pos, name, name_len);
+}
+
+/**
+ * @brief Receive one batch of datagrams and dispatch them
+ * @param worker
+ * @return false if the socket failed and the server is shut down
+ */
+bool receive_batch(struct Worker *w) {
+	int n = chat_context_receive(&w->cx, &w->ring);
+	if (n < 0) {
+		LOG_ERROR("Receiving on the socket of worker %d failed: %s", w->id, strerror(errno));
+		coalesce_flush(w);
+		chat_server_shutdown(&server);
+		return false;
+	}
+	if (n == 0) {
+		coalesce_flush(w);
+		return true;
+	}
+	coalesce_check(w, n);
+	chat_context_done(&w->cx);
+	return true;
+}
+
+/**
+ * @brief Event loop callback for a readable chat socket
+ * @param event loop
+ * @param socket
+ * @param unused
+ * @param worker owning the socket
+ * @return void
+ */
+void on_datagrams(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	if (!receive_batch(ctx)) event_loop_del(l, fd);
+}
+
+/**
+ * @brief Log the totals of all reliable streams
  * @param void
  * @return void
  */
-void cleanup() {
-	printf("%s:SERVER: Sucessfully closed server\n", calctime());
-	close(sock);
-	exit(EXIT_SUCCESS);
+void print_reliable_stats() {
+	if (!rel_stats.transmits && !rel_stats.acks_sent) return;
+	LOG_INFO("Reliable streams sent %lu frames, %lu retransmitted (%.2f%% retransmission rate), %lu acks sent, %lu duplicates, "
+		"%lu queue overflows, %lu clients timed out", rel_stats.transmits, rel_stats.retransmits, rel_retransmit_rate(),
+		rel_stats.acks_sent, rel_stats.duplicates, rel_stats.overflows, rel_stats.dead_peers);
 }
 
 /**
- * @brief Handler for Str+C to close sockets
- * @param signal
+ * @brief Retransmit the frames of one reliable stream, called by the timer wheel with rel_lock held
+ * @param timer of the stream
+ * @param tick collecting dead streams
  * @return void
  */
-void exit_handler(int s){
-	char ip_str[INET_ADDRSTRLEN];
-	for (int i = 0; i < n_clients; i++) {
-		if (clients[i].data.sin_family != AF_INET)
-			continue;
-		sendto(
-			sock, 
-			CLOSING_MSG, 
-			strlen(CLOSING_MSG), 
-			0, 
-			(struct sockaddr*)&clients[i].data, 
-			clientlen
-			);
-		inet_ntop(AF_INET, &clients[i].data.sin_addr.s_addr, ip_str, INET_ADDRSTRLEN);
-		printf("%s:SERVER: Sending disconnect message to %d of %d possible clients. Target client: %s\n", 
-						calctime(), i+1, n_clients, ip_str);
+void on_rel_timer(struct TimerEntry *t, void *ctx) {
+	struct RelPeer *p = (struct RelPeer *)((char *)t - offsetof(struct RelPeer, timer));
+	struct RelTick *tick = ctx;
+	uint64_t deadline = rel_poll(p, tick->now, rel_send, &admin);
+	if (deadline == 0) {
+		if (tick->n_dead < REL_MAX_EXPIRED) {
+			tick->dead[tick->n_dead] = p->id;
+			tick->peers[tick->n_dead++] = p;
+		}
+		/* picked up again by the next tick if this one is full */
+		timer_wheel_add(&rel_wheel, t, tick->now + REL_TICK_MS);
+	} else if (deadline != UINT64_MAX) {
+		timer_wheel_add(&rel_wheel, t, deadline);
 	}
-	cleanup();
 }
 
 /**
- * @brief Get Index of client in client list
- * @param socket address of client which sent the message
- * @return index or -1 if not present
+ * @brief Event loop callback for the retransmit tick, advances the timer wheel
+ * @param event loop
+ * @param timerfd
+ * @param number of expirations
+ * @param unused
+ * @return void
+ */
+void on_rel_tick(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	struct RelTick tick = { .now = now_ms() };
+	pthread_mutex_lock(&rel_lock);
+	timer_wheel_advance(&rel_wheel, tick.now, on_rel_timer, &tick);
+	pthread_mutex_unlock(&rel_lock);
+	for (int k = 0; k < tick.n_dead; k++)
+		expire_client(&admin, tick.dead[k], tick.peers[k]);
+	chat_context_done(&admin.cx);
+}
+
+/**
+ * @brief Thread entry of a worker
+ * @param worker
+ * @return void*
+ */
+void *worker_thread(void *arg) {
+	while (!__atomic_load_n(&workers_stop, __ATOMIC_ACQUIRE) && receive_batch(arg));
+	return NULL;
+}
+
+/**
+ * @brief Allocate a worker and bind its socket to the server address
+ * @param worker
+ * @param worker number
+ * @param server address or NULL for a worker without socket
+ * @return void
  */
-int get_client_index(struct sockaddr_in *received_client) {
-	for (int i = 0; i < n_clients; i++) {
-		if (clients[i].data.sin_family != AF_INET) continue;
-		if (debug) printf("%s:DEBUG: Comparing Ports: %d, %d\n", calctime(), received_client->sin_port, clients[i].data.sin_port);
-		if (debug) printf("%s:DEBUG: Comparing IPs: %d, %d\n", calctime(), received_client->sin_addr.s_addr, clients[i].data.sin_addr.s_addr);
-		if (received_client->sin_addr.s_addr == clients[i].data.sin_addr.s_addr 
-			&& received_client->sin_port == clients[i].data.sin_port) {
-				if (debug) printf("%s:DEBUG: Client at index %d\n",calctime(), i);
-				return i;
+void worker_init(struct Worker *w, int id, struct sockaddr_in *address) {
+	w->id = id;
+	if (chat_context_init(&w->cx, &server, -1, (size_t)(server.batch > 0 ? server.batch : 1) * CHAT_SERVER_ARENA_PER_DATAGRAM) < 0) {
+		LOG_ERROR("Cant allocate message arena and broadcast vector");
+		cleanup(EXIT_FAILURE);
+	}
+	for (int v = 0; v < FANOUT_VECTORS; v++) {
+		if (broadcast_init(&w->fanout[v], REGISTRY_CHUNK, server.transport->addrlen) < 0) {
+			LOG_ERROR("Cant allocate the broadcast vectors");
+			cleanup(EXIT_FAILURE);
 		}
 	}
-	return -1;
+	/* the admin worker only sends on the socket of the first worker */
+	if (!address) return;
+	if (recv_ring_init(&w->ring, server.ring_depth, server.batch, BUFFER_LEN) < 0) {
+		LOG_ERROR("Cant allocate receive ring of %d slots", server.ring_depth);
+		cleanup(EXIT_FAILURE);
+	}
+
+	/* with several workers the kernel spreads the clients over their sockets */
+	if ((w->cx.sock = server.transport->bind(address, n_workers > 1)) < 0) {
+		LOG_ERROR("Socket port in use, cant bind the socket of worker %d", id);
+		cleanup(EXIT_FAILURE);
+	}
+	workers_bound++;
+	/* the single worker is driven by the event loop and must never block */
+	if (n_workers == 1) fcntl(w->cx.sock, F_SETFL, fcntl(w->cx.sock, F_GETFL) | O_NONBLOCK);
 }
 
 /**
@@ -121,34 +775,37 @@ int get_client_index(struct sockaddr_in *received_client) {
  * @return success state
  */
 int main (int argc, char* argv[]) {
-
-	char ip_str[INET_ADDRSTRLEN];
-	char *message;
-	if (argc < 2) {
-		printf("%s:ERROR: Please enter client number %s <NUMBER> (-d Debug)\n", calctime(), argv[0]);
-		exit (EXIT_FAILURE);
-	} else if (argc > 3) {
-		printf("%s:ERROR: Too many arguments submitted\n", calctime());
+	if (log_init() < 0) {
+		printf("Cant start the log writer thread\n");
+		exit(EXIT_FAILURE);
 	}
-	if (argc == 3) {
-		if (strcmp(argv[2],"-d") == 0) {
-			debug = 1;
-			printf("%s:DEBUG: Debug mode enabled\n", calctime());
+	atexit(log_shutdown);
+
+	char peer[TRANSPORT_NAME_LEN];
+	int opt;
+	chat_server_defaults(&server);
+	while ((opt = getopt(argc, argv, "w:c:" CHAT_SERVER_OPTIONS)) != -1) {
+		switch (opt) {
+		case 'w':
+			n_workers = atoi(optarg);
+			if (n_workers < 1) n_workers = 1;
+			if (n_workers > MAX_WORKERS) n_workers = MAX_WORKERS;
+			break;
+		case 'c':
+			coalesce_us = atoi(optarg);
+			if (coalesce_us < 0) coalesce_us = 0;
+			break;
+		default:
+			if (chat_server_option(&server, opt, optarg) == 0) break;
+			LOG_ERROR("Usage %s " USAGE, argv[0]);
+			exit (EXIT_FAILURE);
 		}
 	}
-	// Signal handler for str+c
-	signal (SIGINT, exit_handler);
-		
-	n_clients = atoi(argv[1]);
-	printf("%s:SERVER: %d-clients server started\n", calctime(), n_clients);
-	ssize_t nbytes;
-
-	// Temporary client address for saving receiver of incoming messages
-	struct sockaddr_in cliaddress;
-	socklen_t cliaddrlen = sizeof(cliaddress);
-	// Overwrite address
-	memset(&cliaddress,0,cliaddrlen);
-	
+	if (chat_server_limit(&server, argc, argv) < 0) {
+		LOG_ERROR("Please enter the client limit %s " USAGE, argv[0]);
+		exit (EXIT_FAILURE);
+	}
+
 	// Server IP
 	struct sockaddr_in address = {
 		.sin_family = AF_INET,
@@ -156,179 +813,52 @@ int main (int argc, char* argv[]) {
 		.sin_port = htons(SERVER_PORT)
 	};
 	memset(address.sin_zero, '\0', sizeof(address.sin_zero));
-	socklen_t addrlen = sizeof(address);\
-
-	// allocate clients
-	clients = calloc(sizeof(struct Client), n_clients);
-	clientlen = sizeof(clients[0].data);
-
-	sock = socket (AF_INET, SOCK_DGRAM, 0);
-	
-	if ( bind(sock, (struct sockaddr *) &address, addrlen) < 0) {
-		printf("%s:ERROR: Socket port in use, cant bind\n",calctime());
-		cleanup();
-	} 
-	inet_ntop(AF_INET, &address.sin_addr.s_addr, ip_str, INET_ADDRSTRLEN);
-	printf("%s:SERVER: Binding to socket succeeded %s\n", calctime(), ip_str);
-
-	char *buffer = malloc(BUFFER_LEN);
-	/* TODO: start receival and message ping in extra thread, so the console still works
-	 * this is nice for kicking clients server side oder sending messages to all clients */
-	while (1) {
-
-		memset(&cliaddress,0,cliaddrlen);
-		
-		nbytes = recvfrom(sock, buffer, BUFFER_LEN, MSG_WAITALL, (struct sockaddr *) &cliaddress, &cliaddrlen);
-		// Print sender information if debug is on
-		inet_ntop(AF_INET, &cliaddress.sin_addr.s_addr, ip_str, INET_ADDRSTRLEN);
-		if(debug) printf("%s:DEBUG: Sender information %d, %d, %s, %d\n", calctime(), cliaddress.sin_family, cliaddress.sin_port, ip_str, cliaddrlen);
-		
-		if (nbytes < 0) {
-		  exit (EXIT_FAILURE);
-		}
 
-		buffer[nbytes] = '\0';
-		printf ("%s:SERVER: Got message: \"%s\", length = %zd\n", calctime(), buffer, nbytes);
-		if (buffer[0] == '#') {
-			char *cli = malloc (100);
-			snprintf(cli, 100, "%s", buffer+1);
-
-			printf("%s:SERVER: New client [%s] registering...\n", calctime(), cli);
-
-			// client is already registred TOFIX: other chat windows dies
-			if (get_client_index(&cliaddress) >= 0) continue;
-
-			for (int i = 0; i <= n_clients; i++) {
-				/* write reject message if server is full */
-				if (i == n_clients) {
-					const char *reject = "##";
-					// Send reject message if server is full
-					sendto(
-						sock,
-						reject,
-						strlen(reject),
-						0,
-						(struct sockaddr*) &cliaddress,
-						cliaddrlen
-						);
-					break;
-				}
-				// determine an empty slot by checking family
-				if (clients[i].data.sin_family != AF_INET) {
-					if(debug) printf("%s:DEBUG: Empty slot for client available at index %d\n", calctime(), i);
-					
-					// Copy temp client information to client list
-					clients[i].data.sin_family = AF_INET;
-					clients[i].data.sin_addr.s_addr = cliaddress.sin_addr.s_addr;
-					clients[i].data.sin_port = cliaddress.sin_port;
-					strcpy(clients[i].name, cli);
-					const char *connected = "[SERVER] Successfully registered to the server";
-					/* send connect message to connecting client */
-					sendto(
-						sock, 
-						connected, 
-						strlen(connected), 
-						0, 
-						(struct sockaddr *) &cliaddress,
-						cliaddrlen
-						);
-					/* Sending connect message to all clients except the registring client */
-					for(int j = 0; j < n_clients; j ++ ) {
-						if (j == i) continue;
-						
-						char *joined = malloc(strlen("[SERVER] \"") + strlen(clients[i].name) + strlen("\" joined the server") + 1);
-						strcpy(joined, "[SERVER] \"");
-						strcat(joined, clients[i].name);
-						strcat(joined, "\" joined the server");
-						sendto(
-							sock, 
-							joined, 
-							strlen(joined), 
-							0, 
-							(struct sockaddr*)&clients[j].data, 
-							clientlen
-							);
-						free(joined);
-						
-					}
-					printf("%s:SERVER: Client %s succesfully registered to the server\n",calctime(), clients[i].name);
-					break;
-				} else {
-					inet_ntop(AF_INET, &cliaddress.sin_addr.s_addr, ip_str, INET_ADDRSTRLEN);
-					if(debug) printf("%s:DEBUG: Registered client nr. %d is at address %s | %d\n", calctime(), i, ip_str, AF_INET);
-				} 
-			}
-			free(cli);
-		} else if (buffer[0] == DISC_CHAR) {
-			int pos = get_client_index(&cliaddress);
-			if(pos < 0) {
-				if(debug) printf("%s:DEBUG: Unregistred client tried to disconnect\n", calctime());
-				continue;
-			}
-			inet_ntop(AF_INET, &clients[pos].data.sin_addr.s_addr, ip_str, INET_ADDRSTRLEN);
-			printf("%s:SERVER: Client %s with IP %s:%d successfully disconnected\n", calctime(), clients[pos].name, ip_str, ntohs(clients[pos].data.sin_port));
-			/* Set family to unspecified and the path to to \0 if a client disconnects"  */
-			clients[pos].data.sin_family = AF_UNSPEC;
-			clients[pos].data.sin_addr.s_addr = 0;
-			clients[pos].data.sin_port = 0;
-			/* Send disconnect message to every user */
-			for(int j = 0; j < n_clients; j++) {
-				if (clients[j].data.sin_family != AF_INET)
-					continue;
-				inet_ntop(AF_INET, &clients[j].data.sin_addr.s_addr, ip_str, INET_ADDRSTRLEN);
-				ssize_t stlen = strlen("[SERVER] \"") + strlen(clients[pos].name) 
-+ strlen("\" disconnected from the server") + 1;
-				/* construct disconnect message */
-				char *disc = malloc(stlen);
-				snprintf(
-					disc, 
-					stlen, 
-					"%s%s",
-					"[SERVER] \"",
-					clients[pos].name
-					);
-				/* send info message to all clients */
-				strcat(disc,"\" disconnected from the server");
-				sendto(
-					sock, 
-					disc, 
-					strlen(disc), 
-					0, 
-					(struct sockaddr*)&clients[j].data, 
-					clientlen
-					);
-				free(disc);
-			}
-		} else if (buffer[0] == '+') {
-			
-			
-			// if no special character is detected, send the message to every client if the sender is registred
-			int pos = get_client_index(&cliaddress);
-			if (pos < 0) continue;
-           		message = calloc(sizeof(char),BUFFER_LEN + 50 + 3);
-			printf("%s:SERVER: Chat Message: \"%s\"\n", calctime(), buffer+1);
-			snprintf(message, BUFFER_LEN, "[%s] %s", clients[pos].name,buffer+1);
-			
-			if (strlen(buffer)) {
-				for (int i = 0; i < n_clients; i++) {
-					if (clients[i].data.sin_family != AF_INET) continue;
-					sendto(
-						sock, 
-						message, 
-						strlen(message), 
-						0, 
-						(struct sockaddr*)&clients[i].data, 
-						clientlen
-						);
-					inet_ntop(AF_INET, &clients[i].data.sin_addr.s_addr, ip_str, INET_ADDRSTRLEN);
-					if(debug) printf("%s:DEBUG: Sending message to %d of %d possible clients. Target IP: %s:%d: Message \"%s\"\n", 
-						calctime(), i+1, n_clients, ip_str,ntohs(clients[i].data.sin_port), message);
-				}
+	/* reliable streams and packed frames are offered on top of what every server does */
+	server.features = CHAT_CLIENT_RELIABLE | (coalesce_us ? CHAT_CLIENT_COALESCE : 0);
+	if (chat_server_init(&server, &transport_udp, &udp_ops, sizeof(struct RelPeer *), n_workers) < 0)
+		exit(EXIT_FAILURE);
+
+	workers = calloc(n_workers, sizeof(struct Worker));
+	if (!workers) {
+		LOG_ERROR("Cant allocate %d workers", n_workers);
+		exit(EXIT_FAILURE);
+	}
+	for (int i = 0; i < n_workers; i++)
+		worker_init(&workers[i], i, &address);
+	worker_init(&admin, -1, NULL);
+	admin.cx.sock = workers[0].cx.sock;
+	LOG_INFO("Binding to socket succeeded %s", server.transport->format(&address, peer, sizeof(peer)));
+	LOG_INFO("Receiving up to %d datagrams per wakeup into a ring of %d slots", workers[0].ring.batch, workers[0].ring.depth);
+
+	if (chat_server_start(&server, &admin.cx) < 0)
+		exit(EXIT_FAILURE);
+	timer_wheel_init(&rel_wheel, REL_TICK_MS, now_ms());
+	if (event_loop_add_timer(&server.loop, REL_TICK_MS, on_rel_tick, NULL) < 0)
+		LOG_ERROR("Cant start the retransmit timer, reliable clients are not served");
+	if (coalesce_us) LOG_INFO("Broadcast frames are packed up to %d bytes for %d us", CHAT_COALESCE_MAX, coalesce_us);
+
+	if (n_workers == 1) {
+		event_loop_add(&server.loop, workers[0].cx.sock, on_datagrams, &workers[0]);
+	} else {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		for (int i = 0; i < n_workers; i++) {
+			int err = pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]);
+			if (err != 0) {
+				LOG_ERROR("Cant start worker %d: %s", i, strerror(err));
+				cleanup(EXIT_FAILURE);
 			}
+			workers_started++;
+			/* One worker per core */
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(i % (n_cpus > 0 ? n_cpus : 1), &cpus);
+			if (pthread_setaffinity_np(workers[i].thread, sizeof(cpus), &cpus) != 0)
+				LOG_ERROR("Cant pin worker %d to a core", i);
 		}
+		LOG_INFO("%d workers started with SO_REUSEPORT", n_workers);
 	}
-	close (sock);
-	cleanup();
+	/* Runs until SIGINT or SIGTERM */
+	cleanup(chat_server_run(&server) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
 	return 0;
 }
-
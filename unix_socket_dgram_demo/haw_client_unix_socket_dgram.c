@@ -11,7 +11,7 @@
 
 /* UChat Client by Lukas Becker
 UNIX Datagram Socket chat 
-Usage: ./uchat [username] 
+Usage: ./uchat [username] (-t Text protocol) (-s Shared memory ring)
 */
 #include <stdio.h>
 #include <string.h>
@@ -21,18 +21,38 @@ Usage: ./uchat [username]
 #include <pthread.h>
 #include <sys/un.h>
 #include <signal.h>
-#include <sys/ioctl.h> 
 #include <sys/stat.h>
 #include <time.h>
+#include <stdbool.h>
+#include "chat_proto.h"
+#include "chat_client.h"
+#include "chat_engine.h"
+#include "event_loop.h"
+#include "shm_ring.h"
+#include "transport.h"
 
 #define SERVER_SOCKET_FILE_PATH  "/tmp/uchat_ser"
+#define SERVER_RING_NAME "/uchat_ring"
+#define RING_WAIT_MS 1000
 #define CLIENT_SOCKET_FILE_BASEPATH  "/tmp/uchat_cli"
-#define BUFFER_LEN 512
-#define REGISTER_CHAR "#"
-#define DISC_CHAR "%"
 
 char* username;
 int sock_cli;
+struct ChatRoster roster;
+struct ChatClient client;
+struct EventLoop loop;
+/* Frames to all clients are read from the shared memory ring of the server
+ * if it has one, the ring thread and the event loop render and print under the lock */
+bool shared;
+struct ShmReader shm;
+/* The ring thread is started by the first welcome and joined in cleanup */
+pthread_t ring_id;
+bool ring_started;
+bool ring_stop;
+pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+int line = 2;
+/* named in the abstract namespace like the server, no socket file is left behind */
+bool abstract;
 
 /**
  * @brief Return current timestamp as format
@@ -58,10 +78,18 @@ char* calctime() {
 void cleanup() {
 	/* Delete client socket file 
 	 * TODO: two clients with the same name will delete the file when on client disconnects */
-	char *cli = (char*)malloc (strlen(CLIENT_SOCKET_FILE_BASEPATH) -1 + strlen(username));
+	char *cli = (char*)malloc (strlen(CLIENT_SOCKET_FILE_BASEPATH) + strlen(username) + 1);
 	strcpy(cli,CLIENT_SOCKET_FILE_BASEPATH);
 	strcat(cli,username);
-	printf("%s:UCHAT: Clearing up returned %d\n", calctime(), remove(cli));
+	if (ring_started) {
+		/* a wake up missed right before the thread sleeps ends with RING_WAIT_MS */
+		__atomic_store_n(&ring_stop, 1, __ATOMIC_RELEASE);
+		shm_reader_wake(&shm);
+		pthread_join(ring_id, NULL);
+		ring_started = 0;
+	}
+	if (shm.lost) printf("%s:UCHAT: %lu messages were overwritten in the shared memory ring before they were read\n", calctime(), shm.lost);
+	if (!abstract) printf("%s:UCHAT: Clearing up returned %d\n", calctime(), remove(cli));
 	free(cli);
 	exit(EXIT_SUCCESS);
 }
@@ -72,33 +100,21 @@ void cleanup() {
  * @return void
  */
 void disconnect() {
-	size_t bye_len = strlen(DISC_CHAR) + strlen(username) + 1;
-	char *bye = malloc(bye_len);
-
-	snprintf(bye, bye_len, "%s%s", DISC_CHAR, username);
-
-	/* Static initializers also zero all non-specified fields.
-	 * The previous code had possible garbage in the address. */
-	struct sockaddr_un address_ser = {
-		.sun_family = AF_LOCAL,
-		.sun_path = SERVER_SOCKET_FILE_PATH
-	};
-	socklen_t addrlen_ser = sizeof(address_ser);
-
-	/* Send disconnect message to server */
-	sendto (sock_cli, bye, strlen(bye), 0, (struct sockaddr *) &address_ser, addrlen_ser);
+	chat_client_disconnect(&client, 0);
 	printf("%s:UCHAT: Disconnected properly\n", calctime());
 	cleanup();
 	
 }
 
 /**
- * @brief Handler for Str+C to close sockets
- * @param signal
+ * @brief Str+C or kill, delivered through the event loop
+ * @param loop
+ * @param signalfd
+ * @param signal number
+ * @param unused
  * @return void
  */
-void exit_handler(int s){
-	/* Disconnect on str+c */
+void on_signal(struct EventLoop *l, int fd, unsigned long signo, void *ctx) {
 	disconnect();
 }
 
@@ -118,37 +134,135 @@ void output_handler(const char buffer[], int line) {//, struct winsize * size) {
 }
 
 /**
- * @brief Thread to receive messages nonblocking
+ * @brief Show a frame, the roster is updated by the frame
+ * @param frame header
+ * @param payload
+ * @return void
+ */
+void show_frame(const struct ChatHeader *h, const char *payload) {
+	char text[CHAT_CLIENT_TEXT_LEN];
+	pthread_mutex_lock(&output_lock);
+	if (chat_render(&roster, h, payload, text, sizeof(text)) >= 0) {
+		output_handler(text, line);
+		line += 1;
+	}
+	pthread_mutex_unlock(&output_lock);
+}
+
+/**
+ * @brief Thread reading the frames to all clients from the shared memory ring
  * @param threadargs
  * @return void*
  */
-void *receiver_thread(void* threadargs) {
-
-	char *buffer = malloc(BUFFER_LEN);
-	int line = 2;
-
-	//struct winsize size;
-	
-	
-	while(1) {
-		/* Get currenwindow size */
-		// ioctl(STDOUT_FILENO, TIOCGWINSZ, &size);
-		ssize_t nbytes = recv(sock_cli, buffer, BUFFER_LEN, 0);
-		if (nbytes <= 0)
-			break;
-		buffer[nbytes] = '\0';
-		
-		if (strncmp(buffer,"##", strlen("##")) == 0) {
-			printf("%s:ERROR: Server is full, try again later!\n", calctime());
-			cleanup();
+void *ring_thread(void *threadargs) {
+	char frame[SHM_RING_SLOT_BYTES];
+	while (!__atomic_load_n(&ring_stop, __ATOMIC_ACQUIRE)) {
+		const char *record;
+		size_t len;
+		while ((record = shm_reader_peek(&shm, &len))) {
+			/* the record is copied out of the ring once, the server may overwrite it while it is rendered */
+			memcpy(frame, record, len);
+			if (!shm_reader_done(&shm)) continue;
+			struct ChatHeader h;
+			const char *payload = chat_unpack(frame, len, &h);
+			if (payload) show_frame(&h, payload);
 		}
-		output_handler(buffer, line);//,&size);
-		line += 1;
+		/* the closing server tells every client through its socket */
+		if (shm_reader_wait(&shm, RING_WAIT_MS) < 0) break;
 	}
-	/* TODO: Disconnect on server full */
 	return NULL;
 }
 
+/**
+ * @brief Handle one frame of the server
+ * @param client
+ * @param frame header
+ * @param payload
+ * @return void
+ */
+void on_frame(struct ChatClient *c, const struct ChatHeader *h, const char *payload) {
+	if (h->type == CHAT_FULL) {
+		if (h->seq)
+			printf("%s:UCHAT: Server is full, you are number %u in the queue\n", calctime(), h->seq);
+		else
+			printf("%s:UCHAT: Server is full, you are waiting to be registered\n", calctime());
+		chat_client_restart(c);
+		return;
+	} else if (h->type == CHAT_CLOSING) {
+		printf("\n%s:ERROR: Server is closing, you are being disconnected!\n", calctime());
+		cleanup();
+	}
+	show_frame(h, payload);
+	/* the server reads the ring for this client from the seq of the welcome on */
+	if (h->type == CHAT_WELCOME && (h->flags & CHAT_FLAG_SHARED) && shared && !ring_started) {
+		shm_reader_seek(&shm, h->seq);
+		/* the server sends the frames to all clients only through the ring now */
+		if (pthread_create(&ring_id, NULL, ring_thread, NULL) != 0) {
+			printf("%s:ERROR: Cant start the thread reading the shared memory ring\n", calctime());
+			disconnect();
+		}
+		ring_started = 1;
+	}
+}
+
+/**
+ * @brief Show a message of a text server
+ * @param client
+ * @param zero terminated message
+ * @param message length
+ * @return void
+ */
+void on_text(struct ChatClient *c, const char *text, size_t len) {
+	pthread_mutex_lock(&output_lock);
+	output_handler(text, line);
+	line += 1;
+	pthread_mutex_unlock(&output_lock);
+}
+
+/**
+ * @brief Server socket is gone
+ * @param client
+ * @return void
+ */
+void on_lost(struct ChatClient *c) {
+	printf("%s:ERROR: Server not available\n", calctime());
+	cleanup();
+}
+
+/**
+ * @brief Send a line typed by the user
+ * @param zero terminated line
+ * @return void
+ */
+void on_line(char *message) {
+	/* Disconnect if a the user writes either exit or quit */
+	if (strcmp(message, "exit") == 0 || strcmp(message, "quit") == 0) disconnect();
+	if (chat_client_input(&client, message) < 0) {
+		printf("%s:ERROR: Communication to the server has failed.\n", calctime());
+		cleanup();
+	}
+}
+
+/**
+ * @brief Console has input
+ * @param loop
+ * @param stdin
+ * @param unused
+ * @param unused
+ * @return void
+ */
+void on_console(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	static struct ChatConsole console;
+	/* end of input leaves the chat like exit */
+	if (chat_console_read(&console, fd, on_line) < 0) disconnect();
+}
+
+const struct ChatClientOps client_ops = {
+	.frame = on_frame,
+	.text = on_text,
+	.lost = on_lost
+};
+
 /**
  * @brief Main function, handles all communication
  * @param number of arguments
@@ -156,119 +270,107 @@ void *receiver_thread(void* threadargs) {
  * @return success state
  */
 int main (int argc, char* argv[]) {
+	bool text_proto = 0; /* talk the old text protocol instead of binary frames */
+	int signals[] = { SIGINT, SIGTERM };
 
+	int opt;
+	while ((opt = getopt(argc, argv, "tsa")) != -1) {
+		if (opt == 't') {
+			text_proto = 1;
+		} else if (opt == 's') {
+			shared = 1;
+		} else if (opt == 'a') {
+			abstract = 1;
+		} else {
+			printf("%s:UCHAT: Usage %s [name] (-t Text protocol) (-s Shared memory ring) (-a Abstract socket names)\n", calctime(), argv[0]);
+			exit (EXIT_FAILURE);
+		}
+	}
 	// Check if username was supplied
-	if (argc != 2) {
+	if (argc - optind != 1) {
 		printf("%s:UCHAT: Please enter your username /uchat [name]", calctime());
 		exit (EXIT_FAILURE);
 	}
-	username = strdup(argv[1]);
-	signal (SIGINT, exit_handler);
+	username = strdup(argv[optind]);
 	
-	int nbytes;
 	struct sockaddr_un address_cli;
 	socklen_t addrlen_cli = sizeof(address_cli);
 
 	// Create socket path
-	char *cli = (char*)malloc (strlen(CLIENT_SOCKET_FILE_BASEPATH) -1 + strlen(argv[1]));
-	strcat(cli,CLIENT_SOCKET_FILE_BASEPATH);
-	strcat(cli,argv[1]);
-	printf("%s:UCHAT: Your socketfile is %s\n", calctime(), cli);
+	char *cli = (char*)malloc (strlen(CLIENT_SOCKET_FILE_BASEPATH) + strlen(username) + 1);
+	strcpy(cli,CLIENT_SOCKET_FILE_BASEPATH);
+	strcat(cli,username);
+	if (abstract)
+		printf("%s:UCHAT: Your abstract socket name is @%s\n", calctime(), cli);
+	else
+		printf("%s:UCHAT: Your socketfile is %s\n", calctime(), cli);
 
 	// Construct message header containing name and parathenses
-	size_t message_header_len = strlen(argv[1]) + 4;
+	size_t message_header_len = strlen(username) + 4;
 	char *message_header = malloc(message_header_len);
-	snprintf(message_header, message_header_len, "[%s] ", argv[1]);
-	printf("%s:UCHAT: Message prefix is %s\n", calctime(), message_header);
-	
-	// Create login message
-	size_t welcome_len = strlen(REGISTER_CHAR) + strlen(argv[1]) + 1;
-	char *welcome = malloc(welcome_len);
-	snprintf(welcome, welcome_len, "%s%s", REGISTER_CHAR, argv[1]);
+	snprintf(message_header, message_header_len, "[%s] ", username);
+	if (text_proto)
+		printf("%s:UCHAT: Message prefix is %s\n", calctime(), message_header);
+	else
+		printf("%s:UCHAT: Using the binary protocol version %d\n", calctime(), CHAT_PROTO_VERSION);
+	/* only binary frames are written into the ring, a server without a ring has none to map */
+	if (shared && (text_proto || shm_reader_open(&shm, SERVER_RING_NAME) < 0)) {
+		printf("%s:UCHAT: No shared memory ring, everything is received through the socket\n", calctime());
+		shared = 0;
+	}
 
 	// Create client socket.
 	if((sock_cli=socket (AF_LOCAL, SOCK_DGRAM, 0)) > 0) {
 		printf("%s:UCHAT: Client socket created\n", calctime());
 	}
 	// Unline existing previous files;
-	unlink(cli);
+	if (!abstract) unlink(cli);
 	
-  	// Bind client socket to socket file
-        address_cli.sun_family = AF_LOCAL;
-	strcpy(address_cli.sun_path, cli);
+  	// Bind client socket to socket file or abstract name
+	transport_unix_address(&address_cli, cli, abstract);
 	if ( bind(sock_cli, (struct sockaddr *) &address_cli, addrlen_cli) != 0) {
-		printf("%s:ERROR: Socket port in use, cant bind\n", calctime());
+		/* an abstract name is only in use while another client of that name runs */
+		printf("%s:ERROR: Socket %s in use, cant bind\n", calctime(), abstract ? "name" : "port");
 		exit(EXIT_FAILURE);
 	}
-	printf("%s:UCHAT: Binding to socket file succeeded.\n", calctime());
+	printf("%s:UCHAT: Binding to socket %s succeeded.\n", calctime(), abstract ? "name" : "file");
 	
-	/* Set socket file to 666 which means rw for group/user/everyone */
-	char mode[] ="0777";
-	int mod;
-	mod = strtol(mode,0,8);
-	int retval;
-	retval = chmod(cli,mod);
-	if(retval < 0) {
-    		printf("%s:ERROR: A problem occured setting the socket permissions correctly: %d\n", calctime(), retval);
-    		exit(EXIT_FAILURE);
+	if (!abstract) {
+		/* Set socket file to 666 which means rw for group/user/everyone */
+		char mode[] ="0777";
+		int mod;
+		mod = strtol(mode,0,8);
+		int retval;
+		retval = chmod(cli,mod);
+		if(retval < 0) {
+	    		printf("%s:ERROR: A problem occured setting the socket permissions correctly: %d\n", calctime(), retval);
+	    		exit(EXIT_FAILURE);
+		}
+		printf("%s:UCHAT: Setting permissions for socket file to %s\n", calctime(), mode);
 	}
-	printf("%s:UCHAT: Setting permissions for socket file to %s\n", calctime(), mode);
 	
   	// Initialize the server socket address.
-	struct sockaddr_un address_ser = {
-		.sun_family = AF_LOCAL,
-		.sun_path = SERVER_SOCKET_FILE_PATH
-	};
-	socklen_t addrlen_ser = sizeof(address_ser);
+	struct sockaddr_un address_ser;
+	transport_unix_address(&address_ser, SERVER_SOCKET_FILE_PATH, abstract);
+
+	chat_client_init(&client, sock_cli, &address_ser, sizeof(address_ser), username, &client_ops, NULL);
+	client.text_proto = text_proto;
+	snprintf(client.text_prefix, sizeof(client.text_prefix), "%s", message_header);
+	if (shared) client.register_flags |= CHAT_FLAG_SHARED;
 
-  	// Send register message
-	nbytes = sendto (sock_cli, welcome, strlen (welcome), 0, (struct sockaddr *) (struct sockaddr*)&address_ser, addrlen_ser);
-	if (nbytes < 0) {
-		printf("%s:ERROR: Server not available\n", calctime());
+	/* the loop sleeps until the server, the user, a signal or the one timer of the client wakes it,
+	 * the signals are blocked before the ring thread is started so only the loop gets them */
+	if (event_loop_init(&loop, EVENT_BACKEND_EPOLL) < 0 || event_loop_add_signals(&loop, signals, 2, on_signal, NULL) < 0 ||
+			event_loop_add(&loop, STDIN_FILENO, on_console, NULL) < 0) {
+		printf("%s:ERROR: Could not create the event loop\n", calctime());
 		cleanup();
 	}
-	// Init asynchronous receive thread
-	pthread_t thread_id;
-
-	// Spawn thread
-	pthread_create(&thread_id, NULL, receiver_thread, NULL);
-
 	printf("\e[1;1H\e[2J");
-
-	while(1) {
-		size_t bufsize = 100;
-		char *message = malloc(bufsize);
-
-		/* Getline from the user */
-		int len = getline(&message,&bufsize,stdin);
-		
-		/* Disconnect if a the user writes either exit or quit */
-		if(len > 1 && (strncmp(message,"exit", len-1)  == 0 || strncmp(message,"quit",len-1) == 0)) disconnect();
-
-		char *linebreak = strchr(message, '\n');
-		if (linebreak)
-			linebreak[0] = '\0';
-
-		// Send to server
-		if (strlen(message) != 0) {
-			size_t blen = strlen(message_header) + strlen(message) + 1;
-			char *buf = malloc(blen);
-			snprintf(buf, blen, "%s%s", message_header, message);
-			nbytes = sendto (sock_cli,buf,strlen(buf), 0, (struct sockaddr *) &address_ser, addrlen_ser);
-			if (nbytes < 0) {
-				printf("%s:ERROR: Communication to the server has failed.\n", calctime());
-				cleanup();
-			}
-			free(buf);
-		}
-		
-		// free buffers
-		free(message);
-		
-  	}
-	/* close socket */
-	close (sock_cli); 
-	/* remove socket file, the program should actually never get here */
-	unlink(cli);
-		
+	/* sends the registration, the heartbeats follow every 10 seconds */
+	if (chat_client_attach(&client, &loop) < 0) {
+		printf("%s:ERROR: Could not create the event loop\n", calctime());
+		cleanup();
+	}
+	event_loop_run(&loop);
+	cleanup();
 }
@@ -4,10 +4,13 @@
  * @date 23.04.2020
  * @brief Chat server with unix dgram socket
  */
- 
+
 /* UChat Server by Lukas Becker
 UNIX Datagram Socket chat server
-Usage: ./uchat_ser <num clients>
+Usage: ./uchat_ser <max clients, 0 for no limit> (-d Debug) (-b Batch size) (-r Ring depth) (-s Stats interval) (-u io_uring)
+	(-i Idle timeout) (-H History directory) (-n Replayed messages) (-l Messages per second of a client)
+	(-L Messages per second of all clients) (-m Metrics port or socket file) (-S Shared memory ring slots) (-a Abstract namespace)
+	(-P Credentials of the sender) (-U Clients per user) (-q Waiting clients) (-z Shortest compressed payload)
 */
 
 #include <sys/socket.h>
@@ -17,289 +20,413 @@ Usage: ./uchat_ser <num clients>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
-#include <sys/stat.h>
+#include <sys/mman.h>
 #include <signal.h>
-#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include "recv_ring.h"
+#include "log.h"
+#include "event_loop.h"
+#include "chat_proto.h"
+#include "metrics.h"
+#include "shm_ring.h"
+#include "user_table.h"
+#include "chat_server.h"
+
 #define SERVER_SOCKET_FILE_PATH  "/tmp/uchat_ser"
+#define SERVER_RING_NAME "/uchat_ring" /* shared memory object of the broadcast ring */
 #define CLIENT_SOCKET_FILE_BASEPATH  "/tmp/uchat_cli" /* only used for proper message formatting */
-#define BUFFER_LEN 4096
-#define REGISTER_CHAR '#' /* Character to identify a new client */
-#define DISC_CHAR '%' /* Character to identify a disconnection */
+#define BUFFER_LEN CHAT_SERVER_DATAGRAM_LEN
+#define USAGE "<MAX CLIENTS, 0 for no limit> (-S Slots of the shared memory ring for local clients, 0 for none) " \
+	"(-a Abstract socket names instead of socket files) (-P Identify senders by their credentials) (-U Clients per user, with -P) " \
+	CHAT_SERVER_USAGE
+
+/* The server part of a client, only set with credentials */
+struct ClientCred {
+	pid_t pid; /* process which registered the client */
+	struct User *user; /* user of that process */
+};
 
-bool debug = 0;
+/* Registered clients, rooms, waiting clients and everything else every transport does the same */
+struct ChatServer server;
+/* The single thread handling requests, its socket is the server socket */
+struct ChatContext cx;
+struct RecvRing ring;
+/* Frames to all clients are written once into the ring for the clients
+ * mapping it, only if slots are given */
+struct ShmRing shm;
+int shm_slots;
+uint32_t shared_clients;
+/* The server and its clients are named in the abstract namespace, there are no socket files */
+bool abstract;
+/* With credentials the kernel tells the pid and uid of every sender. A client
+ * is the process which registered it, its name carries the login of its user,
+ * and the rate limit of a client applies to all clients of its user. */
+bool passcred;
+struct UserTable users;
+uint32_t user_max_clients;
+unsigned long spoofed;
 
 /**
- * @brief Return current timestamp as format
+ * @brief Log the users and the datagrams dropped because their sender was not the registered process
  * @param void
- * @return time string
+ * @return void
  */
-char* calctime() {
-	time_t t;
-   	struct tm *tmp;
-   	t = time(NULL);
-   	tmp = localtime(&t);
-
-	static char t_str[16];
-	strftime(t_str, 16, "%Y%m%d_%H%M%S", tmp);
-	return t_str;
+void print_cred_stats() {
+	if (!passcred) return;
+	user_table_print_stats(&users);
+	LOG_INFO("%lu datagrams came from another process than the client registered with", spoofed);
 }
 
 /**
- * @brief Cleanup sockets after closing
- * @param void
+ * @brief Cleanup sockets after closing or a failed start
+ * @param exit status
  * @return void
  */
-void cleanup() {
-	printf("%s:SERVER: Clearing up returned %d\n", calctime(), remove(SERVER_SOCKET_FILE_PATH));
-	exit(EXIT_SUCCESS);
+void cleanup(int status) {
+	recv_ring_print_stats(&ring);
+	chat_context_print_stats(&cx);
+	print_cred_stats();
+	chat_server_close(&server);
+	shm_ring_print_stats(&shm);
+	shm_ring_destroy(&shm);
+	if (!abstract) LOG_INFO("Clearing up returned %d", remove(SERVER_SOCKET_FILE_PATH));
+	if (log_dropped()) LOG_INFO("Logger dropped %lu messages", log_dropped());
+	exit(status);
 }
 
 /**
- * @brief Handler for Str+C to close sockets
- * @param signal
- * @return void
+ * @brief Credentials of a registered client
+ * @param client handle
+ * @return credentials, user NULL without them
  */
-void exit_handler(int s){
-	cleanup();
-	// TODO send disconnect message to all clients
+struct ClientCred *client_cred(int id) {
+	return chat_server_ext(&server, id);
 }
 
 /**
- * @brief Get Index of client in client list
- * @param all client addresses
- * @param number of clients
- * @param message buffer
- * @return index or 0 if not present
+ * @brief Name of a client, the part of its socket file or abstract name behind the base path
+ * @param socket address of the client
+ * @return name
  */
-int get_client_index(struct sockaddr_un *clients, int len, char *buffer) {
-	char * tmp_buf = malloc(200);
-	int res = 1;
+const char *client_name(const struct sockaddr_un *addr) {
+	size_t base = strlen(CLIENT_SOCKET_FILE_BASEPATH);
+	const char *path = addr->sun_path[0] ? addr->sun_path : addr->sun_path + 1;
+	if (strncmp(path, CLIENT_SOCKET_FILE_BASEPATH, base) == 0) return path + base;
+	return path;
+}
 
-	snprintf(tmp_buf, 200, "%s%s", CLIENT_SOCKET_FILE_BASEPATH, buffer + 1);
-	
-	char *closing_bracket = strchr(tmp_buf, ']');
-	if (closing_bracket) 
-		closing_bracket[0]  = '\0';
-	for (int i = 0; i < len; i++) {
-		res = strcmp(tmp_buf, clients[i].sun_path);
-		if(!res) return i+1;
+/**
+ * @brief Send a text message to the text clients and a frame to the binary clients of a room, the notify hook of the chat server
+ * @param context of the server thread
+ * @param room name or NULL for all clients
+ * @param room name length
+ * @param text message or NULL to leave out the text clients
+ * @param text length
+ * @param frame type
+ * @param frame flags
+ * @param sender id of the frame
+ * @param sequence number of the frame
+ * @param frame payload, sent untouched
+ * @param payload length
+ * @param client handle to leave out or -1
+ * @return number of clients the message was sent to
+ */
+int unix_notify(struct ChatContext *cx, const char *room, size_t room_len, const char *text, size_t text_len, int type, int flags,
+		uint32_t sender, uint32_t seq, const char *payload, size_t len, int except) {
+	char header[CHAT_HEADER_LEN];
+	int sent = 0;
+	size_t zlen = chat_context_compress(cx, payload, len);
+	/* without a compressed payload the clients which asked for one get the same frame as the others */
+	uint8_t mask = zlen ? CHAT_CLIENT_BINARY | CHAT_CLIENT_COMPRESS : CHAT_CLIENT_BINARY;
+	if (text) {
+		broadcast_begin(&cx->bcast, text, text_len);
+		sent += chat_server_fanout(cx, 0, CHAT_CLIENT_BINARY, except, room, room_len);
 	}
-	
-	free(tmp_buf);
-	return 0;
+	chat_pack(header, type, flags, sender, seq, len);
+	/* a frame to all clients is written once into the shared memory ring, the
+	 * ring cant leave out a client and has no room for long frames */
+	if (!room && except < 0 && shared_clients && shm_ring_publish(&shm, header, CHAT_HEADER_LEN, payload, len) == 0) {
+		sent += shared_clients;
+		mask |= CHAT_CLIENT_SHARED;
+	}
+	broadcast_begin_frame(&cx->bcast, header, CHAT_HEADER_LEN, payload, len);
+	sent += chat_server_fanout(cx, CHAT_CLIENT_BINARY, mask, except, room, room_len);
+	if (zlen) {
+		char zheader[CHAT_HEADER_LEN];
+		chat_pack(zheader, type, flags | CHAT_FLAG_COMPRESSED, sender, seq, zlen);
+		broadcast_begin_frame(&cx->bcast, zheader, CHAT_HEADER_LEN, cx->z.buf, zlen);
+		sent += chat_server_fanout(cx, CHAT_CLIENT_BINARY | CHAT_CLIENT_COMPRESS, mask, except, room, room_len);
+	}
+	return sent;
 }
 
 /**
- * @brief Main function, handles all communication
- * @param number of arguments
- * @param list of arguments
- * @return success state
+ * @brief Name a new client by its socket file and, with credentials, tie it to its process and user
+ * @param context of the server thread
+ * @param client handle
+ * @param registration of the client
+ * @return 0 on success, -1 if its user already has all the clients it may have
  */
-int main (int argc, char* argv[]) {
-
-	if (argc < 2) {
-		printf("%s:ERROR: Please enter client number %s <NUMBER> (-d Debug)\n", calctime(), argv[0]);
-		exit (EXIT_FAILURE);
-	} else if (argc > 3) {
-		printf("%s:ERROR: Too many arguments submitted\n", calctime());
-	}
-	if (argc == 3) {
-		if (strcmp(argv[2],"-d") == 0) {
-			debug = 1;
-			printf("%s:DEBUG: Debug mode enabled\n", calctime());
+int unix_attach(struct ChatContext *cx, int id, const struct ChatRegistration *reg) {
+	struct ChatServerClient *c = chat_server_client(&server, id);
+	const char *own = client_name(chat_server_addr(&server, id));
+	struct User *user = NULL;
+	if (reg->cred) {
+		/* a user over its quota is turned away like on a full server */
+		if (!(user = user_get(&users, reg->cred->uid))) return -1;
+		if (user_max_clients && user->clients >= user_max_clients) {
+			LOG_INFO("User %s already has %u clients", user->login, user->clients);
+			return -1;
 		}
+		client_cred(id)->pid = reg->cred->pid;
+		client_cred(id)->user = user;
+		user->clients++;
+		c->account = &user->account;
+		snprintf(c->name, sizeof(c->name), "%s@%s", own, user->login);
+	} else {
+		snprintf(c->name, sizeof(c->name), "%s", own);
 	}
-	signal (SIGINT, exit_handler);
-		
-	const int n_clients = atoi(argv[1]);
-	printf("%s:SERVER: %d-clients server started\n", calctime(), n_clients);
-	int sock;
-	ssize_t nbytes;
+	c->name_len = strlen(c->name);
+	/* text clients write the socket name in front of their messages */
+	c->tag_len = strlen(own);
+	if (chat_server_state(&server, id) & CHAT_CLIENT_SHARED) shared_clients++;
+	return 0;
+}
 
-	// Client list, server and rejected client sockets
-	struct sockaddr_un address = {
-		.sun_family = AF_LOCAL,
-		.sun_path = SERVER_SOCKET_FILE_PATH
-	};
-	socklen_t addrlen = sizeof(address);\
+/**
+ * @brief Release the user and the ring of a client which is removed
+ * @param server
+ * @param client handle
+ * @return void
+ */
+void unix_detach(struct ChatServer *s, int id) {
+	if (client_cred(id)->user) client_cred(id)->user->clients--;
+	if (chat_server_state(s, id) & CHAT_CLIENT_SHARED) shared_clients--;
+}
 
-	struct sockaddr_un *clients = calloc(sizeof(struct sockaddr_un), n_clients);
-	socklen_t *clientlen = calloc(sizeof(socklen_t), n_clients);
+/**
+ * @brief Check that the datagram being handled comes from the process which registered the client
+ * @param context with the credentials of the sender
+ * @param client handle
+ * @return false if another process uses the address of the client
+ */
+bool unix_verify(struct ChatContext *cx, int id) {
+	struct ClientCred *cred = client_cred(id);
+	/* another process using the address of a client, e.g. through an inherited socket, is not that client */
+	if (!cx->cred || !cred->user || (cred->pid == cx->cred->pid && cred->user->uid == cx->cred->uid)) return true;
+	LOG_DEBUG("Datagram of pid %d for client %s of pid %d dropped", (int)cx->cred->pid, chat_server_client(&server, id)->name, (int)cred->pid);
+	spoofed++;
+	metrics_add(METRIC_DROPS, 1);
+	return false;
+}
 
-	for(int i = 0; i < n_clients;i++) clientlen[i] = sizeof(clients[i]);
-	// fd sets for select
+/**
+ * @brief A client of the ring reads it from the position in the seq of the welcome on
+ * @param context of the server thread
+ * @param client handle
+ * @param flags of the welcome
+ * @param sequence number of the welcome
+ * @return void
+ */
+void unix_welcome(struct ChatContext *cx, int id, int *flags, uint32_t *seq) {
+	if (!(chat_server_state(&server, id) & CHAT_CLIENT_SHARED)) return;
+	*flags = CHAT_FLAG_SHARED;
+	*seq = (uint32_t)shm.head;
+}
 
-	sock = socket (AF_LOCAL, SOCK_DGRAM, 0);
+/**
+ * @brief Client named on the console by its socket file
+ * @param context of the server thread
+ * @param socket file of the client, with or without the base path
+ * @return client handle or -1
+ */
+int unix_named(struct ChatContext *cx, const char *name) {
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	struct sockaddr_un kicked;
+	if (strncmp(name, CLIENT_SOCKET_FILE_BASEPATH, strlen(CLIENT_SOCKET_FILE_BASEPATH)) == 0)
+		snprintf(path, sizeof(path), "%s", name);
+	else
+		snprintf(path, sizeof(path), "%s%s", CLIENT_SOCKET_FILE_BASEPATH, name);
+	transport_unix_address(&kicked, path, abstract);
+	return chat_client_find(&server.index, server.transport, &kicked);
+}
 
-	// Unlink socket file before creating a new on, else fail
-	unlink(SERVER_SOCKET_FILE_PATH);
+/**
+ * @brief Log the process and user of a client
+ * @param server
+ * @param client handle
+ * @return void
+ */
+void unix_list(struct ChatServer *s, int id) {
+	struct ClientCred *cred = client_cred(id);
+	if (cred->user) LOG_INFO("  pid %d of user %s (uid %u)", (int)cred->pid, cred->user->login, (unsigned)cred->user->uid);
+}
 
-	
-	if ( bind(sock, (struct sockaddr *) &address, addrlen) != 0) {
-		printf("%s:ERROR: Socket port in use, cant bind\n",calctime());
-		cleanup();
-	} 
-	printf("%s:SERVER: Binding to socket file succeeded %s\n", calctime(), address.sun_path);
+/**
+ * @brief Log the receive, credential and ring statistics
+ * @param server
+ * @return void
+ */
+void unix_stats(struct ChatServer *s) {
+	LOG_INFO("Event loop uses %s", event_loop_backend(&server.loop));
+	recv_ring_print_stats(&ring);
+	chat_context_print_stats(&cx);
+	print_cred_stats();
+	shm_ring_print_stats(&shm);
+}
 
-	// Set the permissions of the server to 666 so everybody can read and write to it
-	char mode[] ="0777";
-	int mod;
-	mod = strtol(mode,0,8);
-	int retval;
-	retval = chmod(SERVER_SOCKET_FILE_PATH,mod);
-	if(retval < 0) {
-    		printf("%s:ERROR: A problem occured setting the socket permissions correctly: %d\n", calctime(), retval);
-    		cleanup();
+/**
+ * @brief Wake the clients of the ring once for all frames of a batch
+ * @param context of the server thread
+ * @return void
+ */
+void unix_batch_end(struct ChatContext *cx) {
+	shm_ring_flush(&shm);
+}
+
+/* What only this server does, the chat server does the rest */
+const struct ChatServerOps unix_ops = {
+	.notify = unix_notify,
+	.attach = unix_attach,
+	.detach = unix_detach,
+	.verify = unix_verify,
+	.welcome = unix_welcome,
+	.named = unix_named,
+	.list = unix_list,
+	.stats = unix_stats,
+	.batch_end = unix_batch_end
+};
+
+/**
+ * @brief Event loop callback for the readable server socket, dispatches one batch
+ * @param event loop
+ * @param server socket
+ * @param unused
+ * @param unused
+ * @return void
+ */
+void on_datagrams(struct EventLoop *l, int fd, unsigned long value, void *ctx) {
+	int n = chat_context_receive(&cx, &ring);
+	if (n < 0) {
+		LOG_ERROR("Receiving on the server socket failed: %s", strerror(errno));
+		event_loop_del(l, fd);
+		chat_server_shutdown(&server);
+		return;
 	}
-	if (debug) printf("%s:DEBUG: Setting permissions for socket file to %s\n", calctime(), mode);
+	if (n == 0) return;
+	chat_context_done(&cx);
+}
 
-	char *buffer = malloc(BUFFER_LEN);
-	/* TODO: start receival and message ping in extra thread, so the console still works
-	 * this is nice for kicking clients server side oder sending messages to all clients */
-	while (1) {
-		//temp address of client who sent the message
-		struct sockaddr_un cliaddress;
-		socklen_t cliaddrlen = sizeof(cliaddress);
+/**
+ * @brief Main function, handles all communication
+ * @param number of arguments
+ * @param list of arguments
+ * @return success state
+ */
+int main (int argc, char* argv[]) {
+	if (log_init() < 0) {
+		printf("Cant start the log writer thread\n");
+		exit(EXIT_FAILURE);
+	}
+	atexit(log_shutdown);
 
-		nbytes = recvfrom(sock, buffer, BUFFER_LEN, 0, (struct sockaddr *) &cliaddress, &cliaddrlen);
-		if(debug) printf("%s:DEBUG: Sender information %d, %s, %d\n", calctime(), cliaddress.sun_family, cliaddress.sun_path, cliaddrlen);
-		
-		if (nbytes < 0) {
-		  exit (EXIT_FAILURE);
+	int opt;
+	chat_server_defaults(&server);
+	while ((opt = getopt(argc, argv, "S:aPU:" CHAT_SERVER_OPTIONS)) != -1) {
+		switch (opt) {
+		case 'S':
+			shm_slots = atoi(optarg);
+			if (shm_slots < 0) shm_slots = 0;
+			break;
+		case 'a':
+			abstract = true;
+			break;
+		case 'P':
+			passcred = true;
+			break;
+		case 'U':
+			user_max_clients = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			if (chat_server_option(&server, opt, optarg) == 0) break;
+			LOG_ERROR("Usage %s " USAGE, argv[0]);
+			exit (EXIT_FAILURE);
 		}
+	}
+	if (chat_server_limit(&server, argc, argv) < 0) {
+		LOG_ERROR("Please enter client number %s " USAGE, argv[0]);
+		exit (EXIT_FAILURE);
+	}
 
-		buffer[nbytes] = '\0';
-		printf ("%s:SERVER: Got message: \"%s\", length = %zd\n", calctime(), buffer, nbytes);
-		if (buffer[0] == '#') {
-			char *cli = malloc (100);
-			snprintf(cli, 100, "%s", buffer+1);
+	// Client list, server and rejected client sockets
+	struct sockaddr_un address;
+	transport_unix_address(&address, SERVER_SOCKET_FILE_PATH, abstract);
 
-			printf("%s:SERVER: New client [%s] registering...\n", calctime(), cli);
+	/* with credentials the server writes the name in front of a text, text clients format their own messages */
+	server.formatted_text = true;
+	server.verified = passcred;
+	server.features = shm_slots ? CHAT_CLIENT_SHARED : 0;
+	if (chat_server_init(&server, &transport_unix, &unix_ops, sizeof(struct ClientCred), 1) < 0)
+		exit(EXIT_FAILURE);
 
-			// client is already registred TOFIX: other chat windows dies
-			if (get_client_index(clients, n_clients, buffer)) continue;
+	/* a left over socket file is replaced, everybody may write to the new one */
+	int sock = server.transport->bind(&address, false);
+	if (sock < 0) {
+		LOG_ERROR(abstract ? "Abstract socket name in use, cant bind" : "Socket file in use, cant bind");
+		cleanup(EXIT_FAILURE);
+	}
+	char peer[TRANSPORT_NAME_LEN];
+	LOG_INFO("Binding to socket %s succeeded %s", abstract ? "name" : "file", server.transport->format(&address, peer, sizeof(peer)));
 
-			for (int i = 0; i <= n_clients; i++) {
-				/* write reject message if server is full */
-				if (i == n_clients) {
-					const char *reject = "##";
-					sendto(
-						sock,
-						reject,
-						strlen(reject),
-						0,
-						(struct sockaddr*) &cliaddress,
-						cliaddrlen
-						);
-					break;
-				}
-				if (clients[i].sun_family != AF_LOCAL) {
-					if(debug) printf("%s:DEBUG: Empty slot for client available at index %d\n", calctime(), i);
-					clients[i].sun_family = AF_LOCAL;
-					strcpy(clients[i].sun_path, cliaddress.sun_path);
+	if (recv_ring_init(&ring, server.ring_depth, server.batch, BUFFER_LEN) < 0) {
+		LOG_ERROR("Cant allocate receive ring of %d slots", server.ring_depth);
+		cleanup(EXIT_FAILURE);
+	}
+	LOG_INFO("Receiving up to %d datagrams per wakeup into a ring of %d slots", ring.batch, ring.depth);
+	if (passcred) {
+		int one = 1;
+		/* the kernel attaches pid, uid and gid of the sender to every datagram, the sender cant forge them */
+		if (setsockopt(sock, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) < 0 || recv_ring_pass_creds(&ring) < 0 ||
+				user_table_init(&users, USER_TABLE_DEFAULT_LEN) < 0) {
+			LOG_ERROR("Cant receive the credentials of the senders");
+			cleanup(EXIT_FAILURE);
+		}
+		LOG_INFO("Clients are identified by the credentials of their process%s", server.client_limit ? ", the rate limit applies per user" : "");
+		if (user_max_clients) LOG_INFO("Every user may register %u clients", user_max_clients);
+	} else if (user_max_clients) {
+		LOG_INFO("Clients per user need -P, -U is ignored");
+		user_max_clients = 0;
+	}
+	if (chat_context_init(&cx, &server, sock, (size_t)ring.batch * CHAT_SERVER_ARENA_PER_DATAGRAM) < 0) {
+		LOG_ERROR("Cant allocate message arena and broadcast vector");
+		cleanup(EXIT_FAILURE);
+	}
 
-					const char *connected = "[SERVER] Successfully registered to the server";
-					/* send connect message to connecting client */
-					sendto(
-						sock, 
-						connected, 
-						strlen(connected), 
-						0, 
-						(struct sockaddr *) &cliaddress,//(struct sockaddr *)&clients[i], 
-						sizeof(cliaddress)//sizeof(clients[i])
-						);
-					/* Sending connect message to all clients except the registring client */
-					for(int j = 0; j < n_clients; j ++ ) {
-						if (j == i) continue;
-						
-						char *joined = malloc(strlen("[SERVER] \"") + strlen(cli) + strlen("\" joined the server") + 1);
-						strcpy(joined, "[SERVER] \"");
-						strcat(joined, cli);
-						strcat(joined, "\" joined the server");
-						sendto(
-							sock, 
-							joined, 
-							strlen(joined), 
-							0, 
-							(struct sockaddr*)&clients[j], 
-							clientlen[j]
-							);
-						free(joined);
-						
-					}
-					printf("%s:SERVER: Client socket %s succesfully registered to the server\n",calctime(), cli);
-					break;
-				} else {
-					if(debug) printf("%s:DEBUG: Registered client nr. %d is at address %s | %d\n", calctime(), i,clients[i].sun_path, AF_LOCAL);
-				} 
-			}
-			
-			
-			/* TODO: Sent reject message to rejected clients */
-			free(cli);
-		} else if (buffer[0] == DISC_CHAR) {
-			int pos = get_client_index(clients, n_clients, buffer);
-			if(!pos) {
-				if(debug) printf("%s:DEBUG: Unregistred client tried to disconnect\n", calctime());
-				continue;
-			}
-			printf("%s:SERVER: Client %s successfully disconnected\n", calctime(), clients[pos-1].sun_path);
-			/* Set family to unspecified and the path to to \0 if a client disconnects"  */
-			clients[pos-1].sun_family = AF_UNSPEC;
-			clients[pos-1].sun_path[0] = '\0';
-			/* Send disconnect message to every user */
-			for(int j = 0; j < n_clients; j++) {
-				if (clients[j].sun_family != AF_LOCAL)
-					continue;
-				
-				ssize_t stlen = strlen("[SERVER] \"") + strlen(clients[pos-1].sun_path) - strlen(CLIENT_SOCKET_FILE_BASEPATH) + strlen("\" disconnected from the server") + 1;
-				/* construct disconnect message */
-				char *disc = malloc(stlen);
-				snprintf(
-					disc, 
-					stlen, 
-					"%s%s",
-					"[SERVER] \"",
-					clients[pos-1].sun_path + strlen(CLIENT_SOCKET_FILE_BASEPATH)
-					
-					);
-				/* send info message to all clients */
-				strcat(disc,"\" disconnected from the server");
-				sendto(
-					sock, 
-					disc, 
-					strlen(disc), 
-					0, 
-					(struct sockaddr*)&clients[j], 
-					clientlen[j]
-					);
-				free(disc);
-			}
-		} else {
-			if (!get_client_index(clients, n_clients, buffer)) continue;
-           		
-			printf("%s:SERVER: Chat Message: \"%s\"\n", calctime(), buffer);
-			
-			if (strlen(buffer)) {
-				for (int i = 0; i < n_clients; i++) {
-					if (clients[i].sun_family != AF_LOCAL)
-						continue;
-					sendto(
-						sock, 
-						buffer, 
-						strlen(buffer), 
-						0, 
-						(struct sockaddr*)&clients[i], 
-						clientlen[i]
-						);
-					if(debug) printf("%s:DEBUG: Sending message to %d of %d possible clients. Target socket: %s: Message \"%s\"\n", 
-						calctime(), i+1, n_clients, clients[i].sun_path, buffer);
-				}
-			}
+	/* the event loop only reads the socket when it is readable, it must never block */
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+	if (event_loop_add(&server.loop, sock, on_datagrams, NULL) < 0) {
+		LOG_ERROR("Cant watch the server socket");
+		cleanup(EXIT_FAILURE);
+	}
+	if (chat_server_start(&server, &cx) < 0)
+		cleanup(EXIT_FAILURE);
+	if (shm_slots) {
+		if (shm_ring_create(&shm, SERVER_RING_NAME, shm_slots) < 0) {
+			LOG_ERROR("Cant create the shared memory ring %s", SERVER_RING_NAME);
+			cleanup(EXIT_FAILURE);
 		}
+		LOG_INFO("Frames to all clients go through the shared memory ring %s of %d slots", SERVER_RING_NAME, shm_slots);
+	} else {
+		/* a ring left by an earlier server must not be read by new clients */
+		shm_unlink(SERVER_RING_NAME);
 	}
-	close (sock);
-	cleanup();
+
+	/* Runs until SIGINT or SIGTERM */
+	int ret = chat_server_run(&server);
+	close (cx.sock);
+	cleanup(ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
 	return 0;
 }
 